@@ -3,70 +3,234 @@
 #include <pthread.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <math.h>
 
+/*
+ * Built against faigz.h by default; -DFAIGZ_BENCH_MINIMAL builds the same
+ * benchmark against faigz_minimal.c so the two backends can be compared.
+ */
+#ifdef FAIGZ_BENCH_MINIMAL
+#include "faigz_minimal.h"
+#define BENCH_BACKEND "minimal"
+#define BENCH_END(end) ((end) + 1)    // Minimal fetches take an exclusive end
+#else
 #define REENTRANT_FAIDX_IMPLEMENTATION
 #include "faigz.h"
+#define BENCH_BACKEND "faigz"
+#define BENCH_END(end) (end)
+#endif
+
+#include "faigz_writer.h"
+
+#ifndef PRIhts_pos
+#define PRIhts_pos PRId64
+#endif
+
+// Access patterns
+enum bench_workload {
+    WORKLOAD_UNIFORM,         // Windows anywhere in the genome, every base equally likely
+    WORKLOAD_ZIPF,            // A fixed set of hot windows drawn with Zipfian skew
+    WORKLOAD_WINDOW,          // Each thread slides a window along the genome
+    WORKLOAD_BED              // Regions from a BED file, sorted and fetched in batches
+};
+
+static const char *workload_names[] = {"uniform", "zipf", "window", "bed"};
+
+// Hot windows the Zipfian workload draws from
+#define ZIPF_WINDOWS 4096
+
+// Latency histogram: 16 linear sub-buckets per power of two, so values are within ~3%
+#define LAT_SUB_BITS 4
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
 
 // Benchmark configuration
 typedef struct {
     char *fasta_file;         // Path to input FASTA file
     int num_threads;          // Number of threads to use
+    int *sweep;               // Thread counts to run in turn (just num_threads without -T)
+    int n_sweep;
     int seq_count;            // Number of sequences to fetch per thread
     int seq_length;           // Length of sequences to fetch
+    int workload;             // enum bench_workload
+    double zipf_s;            // Zipf exponent
+    int step;                 // Window step for the sliding window workload
+    char *bed_file;           // Regions for the BED workload
+    int batch_size;           // Regions per batch for the BED workload
+    int cache_blocks;         // Per-reader BGZF block cache size
+    int shared_cache_mb;      // Shared BGZF block cache budget in MB
+    int inflate_threads;      // Threads inflating long fetches
+    int seq_mode;             // Soft-mask transform applied while fetching
     char *output_file;        // Optional output file (NULL for no output)
+    int shard_output;         // Each thread writes its own output_file.<thread>
+    char *json_file;          // Optional JSON results ("-" for stdout)
+    FILE *report;             // Human-readable report; stderr when stdout carries JSON or sequences
     unsigned int seed;        // PRNG seed
     int verbose;              // Verbose output
 } bench_config_t;
 
+// One region of the BED workload
+typedef struct {
+    char *name;
+    hts_pos_t beg, end;       // 0-based, end inclusive
+} bench_region_t;
+
+// What every thread reads from; built once before the runs
+typedef struct {
+    faidx_meta_t *meta;
+    int n_seqs;
+    uint64_t *cum_len;        // Bases before each sequence, n_seqs + 1 entries
+    int *hot_tid;             // Zipfian hot windows
+    hts_pos_t *hot_beg;
+    double *hot_cdf;          // Cumulative probability of each hot window
+    bench_region_t *regions;  // BED regions in sorted order
+    size_t n_regions;
+} bench_input_t;
+
 // Per-thread data
 typedef struct {
     int thread_id;                // Thread ID
-    faidx_meta_t *meta;           // Shared metadata
+    int n_threads;                // Threads in this run
+    const bench_input_t *input;   // Shared workload input
     const bench_config_t *config; // Benchmark configuration
     uint64_t num_bases;           // Total bases retrieved
+    uint64_t num_fetches;         // Fetches completed (regions for the BED workload)
+    uint64_t num_ops;             // Timed operations (batches for the BED workload)
     double elapsed_time;          // Time spent in seconds
-    unsigned int seed;            // Thread-specific PRNG seed
-    pthread_mutex_t *output_mutex; // Mutex for writing to output
-    FILE *output_fp;              // Output file (shared)
+    uint64_t cache_hits;          // Blocks served from the reader's cache
+    uint64_t cache_misses;        // Blocks inflated by the reader
+    uint64_t rng;                 // Thread-private xorshift state
+    uint64_t *lat;                // LAT_BUCKETS latency counts in ns
+    uint64_t lat_sum, lat_max;
+    faidx_writer_t *writer;       // Output writer, shared unless sharded; NULL for no output
+    faidx_wbuf_t out;             // This thread's buffer in front of the writer
+    int write_failed;
 } thread_data_t;
 
+// Summary of one run of the sweep
+typedef struct {
+    int threads;
+    uint64_t fetches, ops, bases;
+    double wall, avg_time;
+    double lat_mean;
+    uint64_t p50, p99, p999, lat_max;
+    uint64_t cache_hits, cache_misses;
+#ifndef FAIGZ_BENCH_MINIMAL
+    faidx_stats_t stats;          // Library counters accumulated during the run
+#endif
+} run_result_t;
+
 // Function to display usage info
 void usage(const char *prog) {
-    fprintf(stderr, 
+    fprintf(stderr,
         "Usage: %s [options] <fasta_file>\n"
         "Options:\n"
         "  -t INT    Number of threads [4]\n"
+        "  -T LIST   Thread counts to sweep: comma-separated, or N for 1,2,4..N\n"
         "  -n INT    Number of sequences to fetch per thread [1000]\n"
         "  -l INT    Length of each sequence to fetch [100]\n"
+        "  -w STR    Workload: uniform, zipf, window or bed [uniform]\n"
+        "  -z FLOAT  Zipf exponent over %d hot windows [1.0]\n"
+        "  -S INT    Step of the sliding window workload [length]\n"
+        "  -b FILE   BED file of regions for the bed workload\n"
+        "  -B INT    Regions per batch for the bed workload [1000]\n"
+        "  -c INT    BGZF blocks cached per reader [0]\n"
+        "  -m INT    Shared BGZF block cache size in MB [0]\n"
+        "  -@ INT    Threads inflating long fetches in parallel [0]\n"
+        "  -u        Uppercase soft-masked bases while fetching\n"
         "  -o FILE   Output fetched sequences to file [none]\n"
+        "  -k        Write one output file per thread, FILE.<thread>\n"
+        "  -j FILE   Write results as JSON, - for stdout (report on stderr) [none]\n"
         "  -s INT    Random seed [42]\n"
         "  -v        Verbose output\n"
         "  -h        Show this help message\n",
-        prog
+        prog, ZIPF_WINDOWS
     );
 }
 
+/* Thread counts from -T: an explicit list, or powers of two up to N */
+static int parse_sweep(const char *s, int **out) {
+    int n = 0, m = 8, *v = malloc(m * sizeof(int));
+
+    if (!v) return -1;
+    if (!strchr(s, ',')) {
+        int max = atoi(s);
+        for (int t = 1; t > 0 && t < max; t *= 2) {
+            if (n == m) v = realloc(v, (m *= 2) * sizeof(int));
+            v[n++] = t;
+        }
+        if (n == m) v = realloc(v, (m *= 2) * sizeof(int));
+        v[n++] = max;
+    } else {
+        for (const char *p = s; *p; p++) {
+            if (n == m) v = realloc(v, (m *= 2) * sizeof(int));
+            v[n++] = atoi(p);
+            while (*p && *p != ',') p++;
+            if (!*p) break;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (v[i] < 1) {
+            free(v);
+            return -1;
+        }
+    }
+    *out = v;
+    return n;
+}
+
 // Parse command line arguments
 bench_config_t parse_args(int argc, char **argv) {
     bench_config_t config = {
         .fasta_file = NULL,
         .num_threads = 4,
+        .sweep = NULL,
+        .n_sweep = 0,
         .seq_count = 1000,
         .seq_length = 100,
+        .workload = WORKLOAD_UNIFORM,
+        .zipf_s = 1.0,
+        .step = 0,
+        .bed_file = NULL,
+        .batch_size = 1000,
+        .cache_blocks = 0,
+        .shared_cache_mb = 0,
+        .inflate_threads = 0,
+        .seq_mode = FAIDX_SEQ_AS_IS,
         .output_file = NULL,
+        .shard_output = 0,
+        .json_file = NULL,
         .seed = 42,
         .verbose = 0
     };
+    const char *sweep = NULL;
 
     int c;
-    while ((c = getopt(argc, argv, "t:n:l:o:s:vh")) != -1) {
+    while ((c = getopt(argc, argv, "t:T:n:l:w:z:S:b:B:c:m:@:uo:kj:s:vh")) != -1) {
         switch (c) {
             case 't': config.num_threads = atoi(optarg); break;
+            case 'T': sweep = optarg; break;
             case 'n': config.seq_count = atoi(optarg); break;
             case 'l': config.seq_length = atoi(optarg); break;
+            case 'w':
+                config.workload = -1;
+                for (int i = 0; i < 4; i++) {
+                    if (strcmp(optarg, workload_names[i]) == 0) config.workload = i;
+                }
+                break;
+            case 'z': config.zipf_s = atof(optarg); break;
+            case 'S': config.step = atoi(optarg); break;
+            case 'b': config.bed_file = optarg; break;
+            case 'B': config.batch_size = atoi(optarg); break;
+            case 'c': config.cache_blocks = atoi(optarg); break;
+            case 'm': config.shared_cache_mb = atoi(optarg); break;
+            case '@': config.inflate_threads = atoi(optarg); break;
+            case 'u': config.seq_mode = FAIDX_SEQ_UPPER; break;
             case 'o': config.output_file = optarg; break;
+            case 'k': config.shard_output = 1; break;
+            case 'j': config.json_file = optarg; break;
             case 's': config.seed = atoi(optarg); break;
             case 'v': config.verbose = 1; break;
             case 'h': usage(argv[0]); exit(0);
@@ -87,6 +251,17 @@ bench_config_t parse_args(int argc, char **argv) {
         fprintf(stderr, "Error: Number of threads must be >= 1\n");
         exit(1);
     }
+    if (sweep) {
+        config.n_sweep = parse_sweep(sweep, &config.sweep);
+        if (config.n_sweep <= 0) {
+            fprintf(stderr, "Error: Thread counts to sweep must be >= 1\n");
+            exit(1);
+        }
+    } else {
+        config.sweep = malloc(sizeof(int));
+        config.sweep[0] = config.num_threads;
+        config.n_sweep = 1;
+    }
     if (config.seq_count < 1) {
         fprintf(stderr, "Error: Number of sequences must be >= 1\n");
         exit(1);
@@ -95,256 +270,727 @@ bench_config_t parse_args(int argc, char **argv) {
         fprintf(stderr, "Error: Sequence length must be >= 1\n");
         exit(1);
     }
+    if (config.workload < 0) {
+        fprintf(stderr, "Error: Workload must be uniform, zipf, window or bed\n");
+        exit(1);
+    }
+    if (config.workload == WORKLOAD_ZIPF && config.zipf_s <= 0) {
+        fprintf(stderr, "Error: Zipf exponent must be > 0\n");
+        exit(1);
+    }
+    if (config.step < 0) {
+        fprintf(stderr, "Error: Window step must be >= 0\n");
+        exit(1);
+    }
+    if (config.step == 0) config.step = config.seq_length;
+    if (config.workload == WORKLOAD_BED && !config.bed_file) {
+        fprintf(stderr, "Error: The bed workload needs a BED file (-b)\n");
+        exit(1);
+    }
+    if (config.batch_size < 1) {
+        fprintf(stderr, "Error: Batch size must be >= 1\n");
+        exit(1);
+    }
+    if (config.cache_blocks < 0 || config.shared_cache_mb < 0) {
+        fprintf(stderr, "Error: Cache size must be >= 0\n");
+        exit(1);
+    }
+    if (config.inflate_threads < 0) {
+        fprintf(stderr, "Error: Number of inflate threads must be >= 0\n");
+        exit(1);
+    }
+    if (config.shard_output && !config.output_file) {
+        fprintf(stderr, "Error: Sharded output needs an output file (-o)\n");
+        exit(1);
+    }
+    if (config.output_file && config.n_sweep > 1) {
+        fprintf(stderr, "Error: Output file can't be combined with a thread sweep\n");
+        exit(1);
+    }
+    if (config.json_file && config.output_file && strcmp(config.json_file, "-") == 0 &&
+        strcmp(config.output_file, "-") == 0) {
+        fprintf(stderr, "Error: JSON results and sequences can't both go to stdout\n");
+        exit(1);
+    }
+    config.report = (config.json_file && strcmp(config.json_file, "-") == 0) ||
+                    (config.output_file && strcmp(config.output_file, "-") == 0) ? stderr : stdout;
+#ifdef FAIGZ_BENCH_MINIMAL
+    if (config.cache_blocks || config.shared_cache_mb || config.inflate_threads) {
+        fprintf(stderr, "Error: Block caches and inflate threads need the faigz backend\n");
+        exit(1);
+    }
+#endif
 
     return config;
 }
 
+/* xorshift64*: private to each thread, so drawing numbers never contends */
+static inline uint64_t rng_next(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Seed a generator from the run seed and a stream number (splitmix64) */
+static uint64_t rng_seed(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+static inline double rng_unit(uint64_t *s) {
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline int lat_bucket(uint64_t v) {
+    if (v < (1u << LAT_SUB_BITS)) return (int)v;
+    int shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+    return ((shift + 1) << LAT_SUB_BITS) + (int)((v >> shift) & ((1u << LAT_SUB_BITS) - 1));
+}
+
+/* Middle of the values a bucket counts */
+static uint64_t lat_value(int b) {
+    if (b < (1 << LAT_SUB_BITS)) return (uint64_t)b;
+    int shift = (b >> LAT_SUB_BITS) - 1;
+    uint64_t lo = (uint64_t)((1 << LAT_SUB_BITS) + (b & ((1 << LAT_SUB_BITS) - 1))) << shift;
+    return lo + ((1ULL << shift) >> 1);
+}
+
+static inline void lat_record(thread_data_t *data, uint64_t ns) {
+    data->lat[lat_bucket(ns)]++;
+    data->lat_sum += ns;
+    if (ns > data->lat_max) data->lat_max = ns;
+    data->num_ops++;
+}
+
+/* Smallest latency at or above fraction q of the operations */
+static uint64_t lat_quantile(const uint64_t *lat, uint64_t total, double q) {
+    uint64_t want = (uint64_t)ceil(q * total), seen = 0;
+
+    if (want == 0) want = 1;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += lat[b];
+        if (seen >= want) return lat_value(b);
+    }
+    return 0;
+}
+
+/* Window of length len starting at a uniformly chosen base of the genome */
+static void pick_uniform(const bench_input_t *in, uint64_t *rng, hts_pos_t len,
+                         int *tid, hts_pos_t *beg) {
+    uint64_t pos = rng_next(rng) % in->cum_len[in->n_seqs];
+    int lo = 0, hi = in->n_seqs - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (in->cum_len[mid] <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+
+    hts_pos_t seq_len = (hts_pos_t)(in->cum_len[lo + 1] - in->cum_len[lo]);
+    hts_pos_t b = (hts_pos_t)(pos - in->cum_len[lo]);
+    if (b > seq_len - len) b = seq_len - len > 0 ? seq_len - len : 0;
+    *tid = lo;
+    *beg = b;
+}
+
+/* Buffer a fetched region; the writer takes it from there in large chunks */
+static void write_seq(thread_data_t *data, const char *name, hts_pos_t beg, hts_pos_t end,
+                      const char *seq, hts_pos_t len) {
+    char local[256], *hdr = local;
+
+    // Convert to 1-based coordinates for output (matching samtools faidx format)
+    int n = snprintf(local, sizeof(local), "%s:%"PRIhts_pos"-%"PRIhts_pos, name, beg + 1, end + 1);
+    if (n >= (int)sizeof(local)) {
+        if (!(hdr = malloc(n + 1))) return;
+        snprintf(hdr, n + 1, "%s:%"PRIhts_pos"-%"PRIhts_pos, name, beg + 1, end + 1);
+    }
+    if (faidx_wbuf_fasta(&data->out, hdr, seq, (size_t)len, 0) < 0 && !data->write_failed) {
+        fprintf(stderr, "Thread %d: Error writing to output file: %s\n",
+               data->thread_id, strerror(errno));
+        data->write_failed = 1;
+    }
+    if (hdr != local) free(hdr);
+}
+
+/* BED workload: this thread's share of the sorted regions, a batch at a time */
+static void run_bed(thread_data_t *data, faidx_reader_t *reader) {
+    const bench_input_t *in = data->input;
+    size_t batch = (size_t)data->config->batch_size;
+    size_t per = (in->n_regions + data->n_threads - 1) / data->n_threads;
+    size_t first = per * data->thread_id, last = first + per;
+    kstring_t *out = calloc(batch, sizeof(kstring_t));
+
+    hts_pos_t *lens = malloc(batch * sizeof(hts_pos_t));
+#ifndef FAIGZ_BENCH_MINIMAL
+    faidx_region_t *regs = malloc(batch * sizeof(faidx_region_t));
+    if (!regs) goto done;
+#endif
+    if (!out || !lens) goto done;
+    if (last > in->n_regions) last = in->n_regions;
+
+    for (size_t i = first; i < last; i += batch) {
+        size_t k = last - i < batch ? last - i : batch;
+        const bench_region_t *r = &in->regions[i];
+        uint64_t t0 = now_ns();
+
+#ifndef FAIGZ_BENCH_MINIMAL
+        for (size_t j = 0; j < k; j++) {
+            regs[j].name = r[j].name;
+            regs[j].beg = r[j].beg;
+            regs[j].end = r[j].end;
+        }
+        faidx_reader_fetch_batch(reader, regs, k, out, lens);
+        lat_record(data, now_ns() - t0);
+        for (size_t j = 0; j < k; j++) {
+            if (lens[j] < 0) continue;
+            data->num_bases += lens[j];
+            data->num_fetches++;
+        }
+#else
+        /* No batch call: fetch the sorted regions one after another */
+        for (size_t j = 0; j < k; j++) {
+            hts_pos_t n = lens[j] = faidx_reader_fetch_seq_into(reader, r[j].name, r[j].beg,
+                                                                BENCH_END(r[j].end), &out[j]);
+            if (n < 0) continue;
+            data->num_bases += n;
+            data->num_fetches++;
+        }
+        lat_record(data, now_ns() - t0);
+#endif
+
+        if (data->writer) {
+            for (size_t j = 0; j < k; j++) {
+                if (lens[j] >= 0) write_seq(data, r[j].name, r[j].beg, r[j].end, out[j].s, lens[j]);
+            }
+        }
+    }
+
+done:
+    if (out) {
+        for (size_t j = 0; j < batch; j++) free(out[j].s);
+    }
+    free(out);
+    free(lens);
+#ifndef FAIGZ_BENCH_MINIMAL
+    free(regs);
+#endif
+}
+
 // Thread worker function
 void *worker_thread(void *arg) {
     thread_data_t *data = (thread_data_t *)arg;
+    const bench_input_t *in = data->input;
+    const bench_config_t *config = data->config;
     faidx_reader_t *reader;
-    char *seq;
-    hts_pos_t seq_len;
+    kstring_t seq = {0, 0, NULL};  // Reused across fetches
     struct timespec start_time, end_time;
-    int i, seq_idx;
-    uint64_t bases_fetched = 0;
-    
-    // Initialize thread-specific PRNG
-    unsigned int thread_seed = data->seed + data->thread_id;
-    srand(thread_seed);
-    
-    if (data->config->verbose) {
-        printf("Thread %d: Starting with seed %u\n", data->thread_id, thread_seed);
-    }
-    
+    hts_pos_t len = config->seq_length;
+
+    if (config->verbose) {
+        fprintf(config->report, "Thread %d: Starting with seed %u\n", data->thread_id, config->seed);
+    }
+
     // Create a reader
-    reader = faidx_reader_create(data->meta);
+#ifndef FAIGZ_BENCH_MINIMAL
+    reader = faidx_reader_create_cached(in->meta, config->cache_blocks);
+#else
+    reader = faidx_reader_create(in->meta);
+#endif
     if (!reader) {
         fprintf(stderr, "Thread %d: Failed to create reader\n", data->thread_id);
-        pthread_exit(NULL);
+        return NULL;
     }
-    
-    // Get the number of sequences in the file
-    int num_seqs = faidx_meta_nseq(data->meta);
-    if (num_seqs <= 0) {
-        fprintf(stderr, "Thread %d: No sequences found in the file\n", data->thread_id);
-        faidx_reader_destroy(reader);
-        pthread_exit(NULL);
+    faidx_reader_set_seq_mode(reader, (enum faidx_seq_mode)config->seq_mode);
+
+    // Sharded output: this thread's own file, written from this thread
+    if (config->shard_output) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.%d", config->output_file, data->thread_id);
+        if (!(data->writer = faidx_writer_open(path, 0))) {
+            fprintf(stderr, "Thread %d: Failed to open output file: %s\n", data->thread_id, path);
+            data->write_failed = 1;
+            faidx_reader_destroy(reader);
+            return NULL;
+        }
     }
-    
+    if (data->writer) faidx_wbuf_init(&data->out, data->writer);
+
+    // Sliding windows start somewhere different in each thread
+    int w_tid = 0;
+    hts_pos_t w_beg = 0;
+    if (config->workload == WORKLOAD_WINDOW) pick_uniform(in, &data->rng, len, &w_tid, &w_beg);
+
     // Start timing
     clock_gettime(CLOCK_MONOTONIC, &start_time);
-    
-    // Fetch random sequences
-    for (i = 0; i < data->config->seq_count; i++) {
-        // Choose a random sequence
-        seq_idx = rand() % num_seqs;
-        const char *seq_name = faidx_meta_iseq(data->meta, seq_idx);
-        
-        // Get the sequence length
-        hts_pos_t total_seq_len = faidx_meta_seq_len(data->meta, seq_name);
-        if (total_seq_len <= 0) {
-            if (data->config->verbose) {
-                fprintf(stderr, "Thread %d: Invalid sequence length for %s, skipping\n", 
-                       data->thread_id, seq_name);
+
+    if (config->workload == WORKLOAD_BED) run_bed(data, reader);
+
+    for (int i = 0; config->workload != WORKLOAD_BED && i < config->seq_count; i++) {
+        int tid;
+        hts_pos_t start;
+
+        // Choose the window for this workload
+        if (config->workload == WORKLOAD_UNIFORM) {
+            pick_uniform(in, &data->rng, len, &tid, &start);
+        } else if (config->workload == WORKLOAD_ZIPF) {
+            double u = rng_unit(&data->rng);
+            int lo = 0, hi = ZIPF_WINDOWS - 1;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (in->hot_cdf[mid] < u) lo = mid + 1;
+                else hi = mid;
             }
-            continue;
-        }
-        
-        // Choose a random start position, ensuring we don't go past the end
-        // Adjust sequence length if the sequence is shorter than requested
-        int adjusted_seq_length = data->config->seq_length;
-        if (total_seq_len < adjusted_seq_length) {
-            adjusted_seq_length = total_seq_len;
-            if (data->config->verbose) {
-                printf("Thread %d: Sequence %s is shorter than requested length (%"PRIhts_pos" < %d), adjusting\n",
-                      data->thread_id, seq_name, total_seq_len, data->config->seq_length);
+            tid = in->hot_tid[lo];
+            start = in->hot_beg[lo];
+        } else {
+            // Move on to the next sequence once the window runs off the end
+            if (w_beg >= faidx_meta_seq_len_id(in->meta, w_tid)) {
+                w_tid = (w_tid + 1) % in->n_seqs;
+                w_beg = 0;
             }
+            tid = w_tid;
+            start = w_beg;
+            w_beg += config->step;
         }
-        
-        hts_pos_t max_start = total_seq_len - adjusted_seq_length;
-        if (max_start < 0) max_start = 0;
-        
-        hts_pos_t start = max_start > 0 ? rand() % (max_start + 1) : 0;
-        hts_pos_t end = start + adjusted_seq_length - 1;
+
+        hts_pos_t end = start + len - 1;
+        hts_pos_t total_seq_len = faidx_meta_seq_len_id(in->meta, tid);
         if (end >= total_seq_len) end = total_seq_len - 1;
-        
+        if (end < start) continue;
+
         // Fetch the sequence
-        seq = faidx_reader_fetch_seq(reader, seq_name, start, end, &seq_len);
-        if (!seq) {
-            if (data->config->verbose) {
-                fprintf(stderr, "Thread %d: Failed to fetch %s:%"PRIhts_pos"-%"PRIhts_pos"\n", 
-                       data->thread_id, seq_name, start, end);
+        uint64_t t0 = now_ns();
+        hts_pos_t seq_len = faidx_reader_fetch_seq_id_into(reader, tid, start, BENCH_END(end), &seq);
+        lat_record(data, now_ns() - t0);
+        if (seq_len < 0) {
+            if (config->verbose) {
+                fprintf(stderr, "Thread %d: Failed to fetch %s:%"PRIhts_pos"-%"PRIhts_pos"\n",
+                       data->thread_id, faidx_meta_iseq(in->meta, tid), start, end);
             }
             continue;
         }
-        
+
         // Update the number of bases fetched
-        bases_fetched += seq_len;
-        
+        data->num_bases += seq_len;
+        data->num_fetches++;
+
         // Write to output file if requested
-        if (data->output_fp) {
-            pthread_mutex_lock(data->output_mutex);
-            // Convert to 1-based coordinates for output (matching samtools faidx format)
-            int write_status = fprintf(data->output_fp, ">%s:%"PRIhts_pos"-%"PRIhts_pos"\n%s\n", 
-                   seq_name, start + 1, end + 1, seq);
-            if (write_status < 0) {
-                fprintf(stderr, "Thread %d: Error writing to output file: %s\n", 
-                       data->thread_id, strerror(errno));
-            }
-            fflush(data->output_fp); // Ensure immediate write to disk
-            pthread_mutex_unlock(data->output_mutex);
-            
-            if (data->config->verbose) {
-                printf("Thread %d: Wrote sequence %s:%"PRIhts_pos"-%"PRIhts_pos" to output file\n",
-                      data->thread_id, seq_name, start + 1, end + 1);
-            }
-        }
-        
-        free(seq);
+        if (data->writer) write_seq(data, faidx_meta_iseq(in->meta, tid), start, end, seq.s, seq_len);
     }
-    
+
+    // Hand over the last of the output; the writer finishes it off the clock
+    if (data->writer && faidx_wbuf_free(&data->out) < 0 && !data->write_failed) {
+        fprintf(stderr, "Thread %d: Error writing to output file: %s\n",
+               data->thread_id, strerror(errno));
+        data->write_failed = 1;
+    }
+
     // End timing
     clock_gettime(CLOCK_MONOTONIC, &end_time);
-    data->elapsed_time = (end_time.tv_sec - start_time.tv_sec) + 
+    data->elapsed_time = (end_time.tv_sec - start_time.tv_sec) +
                         (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
-    data->num_bases = bases_fetched;
-    
-    if (data->config->verbose) {
-        printf("Thread %d: Fetched %"PRIu64" bases in %.3f seconds (%.2f bases/sec)\n", 
-               data->thread_id, bases_fetched, data->elapsed_time, 
-               bases_fetched / data->elapsed_time);
-    }
-    
+#ifndef FAIGZ_BENCH_MINIMAL
+    faidx_reader_cache_stats(reader, &data->cache_hits, &data->cache_misses);
+#endif
+
+    if (config->verbose) {
+        fprintf(config->report, "Thread %d: Fetched %"PRIu64" bases in %.3f seconds (%.2f bases/sec)\n",
+                data->thread_id, data->num_bases, data->elapsed_time,
+                data->num_bases / data->elapsed_time);
+    }
+
+    if (config->shard_output && faidx_writer_close(data->writer) < 0 && !data->write_failed) {
+        fprintf(stderr, "Thread %d: Error writing to output file: %s\n",
+               data->thread_id, strerror(errno));
+        data->write_failed = 1;
+    }
+
+    free(seq.s);
     faidx_reader_destroy(reader);
     return NULL;
 }
 
+static int region_cmp(const void *a, const void *b) {
+    const bench_region_t *x = (const bench_region_t*)a, *y = (const bench_region_t*)b;
+    int c = strcmp(x->name, y->name);
+    if (c) return c;
+    return x->beg < y->beg ? -1 : (x->beg > y->beg);
+}
+
+/* Load BED regions on sequences of the index, sorted by sequence and start */
+static int load_bed(const char *path, bench_input_t *in) {
+    FILE *fp = fopen(path, "r");
+    char line[4096], name[1024];
+    size_t m = 0, skipped = 0;
+
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        long long beg, end;
+        if (line[0] == '#' || strncmp(line, "track", 5) == 0 || strncmp(line, "browser", 7) == 0) {
+            continue;
+        }
+        if (sscanf(line, "%1023s %lld %lld", name, &beg, &end) != 3) continue;
+        if (beg < 0 || end <= beg || !faidx_meta_has_seq(in->meta, name)) {
+            skipped++;
+            continue;
+        }
+        if (in->n_regions == m) {
+            m = m ? m * 2 : 1024;
+            bench_region_t *r = realloc(in->regions, m * sizeof(bench_region_t));
+            if (!r) {
+                fclose(fp);
+                return -1;
+            }
+            in->regions = r;
+        }
+        bench_region_t *r = &in->regions[in->n_regions];
+        size_t l = strlen(name) + 1;
+        if (!(r->name = malloc(l))) {
+            fclose(fp);
+            return -1;
+        }
+        memcpy(r->name, name, l);
+        in->n_regions++;
+        r->beg = beg;
+        r->end = end - 1;    // BED ends are exclusive
+    }
+    fclose(fp);
+
+    if (skipped) fprintf(stderr, "Skipped %zu BED regions not in the index\n", skipped);
+    qsort(in->regions, in->n_regions, sizeof(bench_region_t), region_cmp);
+    return in->n_regions ? 0 : -1;
+}
+
+/* Everything the workers share: sequence offsets, hot windows or BED regions */
+static int build_input(const bench_config_t *config, bench_input_t *in) {
+    in->n_seqs = faidx_meta_nseq(in->meta);
+    if (in->n_seqs <= 0) return -1;
+
+    in->cum_len = malloc((in->n_seqs + 1) * sizeof(uint64_t));
+    if (!in->cum_len) return -1;
+    in->cum_len[0] = 0;
+    for (int i = 0; i < in->n_seqs; i++) {
+        in->cum_len[i + 1] = in->cum_len[i] + (uint64_t)faidx_meta_seq_len_id(in->meta, i);
+    }
+    if (in->cum_len[in->n_seqs] == 0) return -1;
+
+    if (config->workload == WORKLOAD_ZIPF) {
+        uint64_t rng = rng_seed(config->seed, UINT32_MAX);
+        double sum = 0;
+
+        in->hot_tid = malloc(ZIPF_WINDOWS * sizeof(int));
+        in->hot_beg = malloc(ZIPF_WINDOWS * sizeof(hts_pos_t));
+        in->hot_cdf = malloc(ZIPF_WINDOWS * sizeof(double));
+        if (!in->hot_tid || !in->hot_beg || !in->hot_cdf) return -1;
+
+        // Rank k is drawn with probability proportional to 1 / k^s
+        for (int k = 0; k < ZIPF_WINDOWS; k++) {
+            pick_uniform(in, &rng, config->seq_length, &in->hot_tid[k], &in->hot_beg[k]);
+            sum += 1.0 / pow(k + 1, config->zipf_s);
+            in->hot_cdf[k] = sum;
+        }
+        for (int k = 0; k < ZIPF_WINDOWS; k++) in->hot_cdf[k] /= sum;
+        in->hot_cdf[ZIPF_WINDOWS - 1] = 1.0;
+    }
+
+    if (config->workload == WORKLOAD_BED && load_bed(config->bed_file, in) < 0) {
+        fprintf(stderr, "No usable regions in %s\n", config->bed_file);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_input(bench_input_t *in) {
+    for (size_t i = 0; i < in->n_regions; i++) free(in->regions[i].name);
+    free(in->regions);
+    free(in->cum_len);
+    free(in->hot_tid);
+    free(in->hot_beg);
+    free(in->hot_cdf);
+}
+
+/* One run at n_threads threads */
+static int run_once(const bench_config_t *config, const bench_input_t *in, int n_threads,
+                    faidx_writer_t *writer, run_result_t *res) {
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = calloc(n_threads, sizeof(thread_data_t));
+    uint64_t *lat = calloc(LAT_BUCKETS, sizeof(uint64_t));
+    double total_time = 0;
+    int i, started = 0, failed = 0;
+
+    memset(res, 0, sizeof(*res));
+    res->threads = n_threads;
+    if (!threads || !thread_data || !lat) goto fail;
+
+#ifndef FAIGZ_BENCH_MINIMAL
+    faidx_stats_t before;
+    faidx_meta_stats(in->meta, &before);
+#endif
+
+    // Create and start threads
+    uint64_t t0 = now_ns();
+    for (i = 0; i < n_threads; i++) {
+        thread_data[i].thread_id = i;
+        thread_data[i].n_threads = n_threads;
+        thread_data[i].input = in;
+        thread_data[i].config = config;
+        thread_data[i].rng = rng_seed(config->seed, i);
+        thread_data[i].writer = writer;
+        thread_data[i].lat = calloc(LAT_BUCKETS, sizeof(uint64_t));
+        if (!thread_data[i].lat) break;
+
+        if (pthread_create(&threads[i], NULL, worker_thread, &thread_data[i]) != 0) {
+            fprintf(stderr, "Failed to create thread %d\n", i);
+            free(thread_data[i].lat);
+            break;
+        }
+        started++;
+    }
+
+    // Wait for all threads to finish
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    res->wall = (now_ns() - t0) / 1e9;
+
+    for (i = 0; i < started; i++) {
+        thread_data_t *d = &thread_data[i];
+        if (d->write_failed) failed = 1;
+        total_time += d->elapsed_time;
+        res->bases += d->num_bases;
+        res->fetches += d->num_fetches;
+        res->ops += d->num_ops;
+        res->cache_hits += d->cache_hits;
+        res->cache_misses += d->cache_misses;
+        res->lat_mean += d->lat_sum;
+        if (d->lat_max > res->lat_max) res->lat_max = d->lat_max;
+        for (int b = 0; b < LAT_BUCKETS; b++) lat[b] += d->lat[b];
+        free(d->lat);
+    }
+    if (started < n_threads || failed) goto fail;
+
+    res->avg_time = total_time / n_threads;
+    if (res->ops) {
+        res->lat_mean /= res->ops;
+        res->p50 = lat_quantile(lat, res->ops, 0.50);
+        res->p99 = lat_quantile(lat, res->ops, 0.99);
+        res->p999 = lat_quantile(lat, res->ops, 0.999);
+        // Bucket midpoints can overshoot the largest latency actually seen
+        if (res->p50 > res->lat_max) res->p50 = res->lat_max;
+        if (res->p99 > res->lat_max) res->p99 = res->lat_max;
+        if (res->p999 > res->lat_max) res->p999 = res->lat_max;
+    }
+
+#ifndef FAIGZ_BENCH_MINIMAL
+    // Library counters for this run alone
+    faidx_meta_stats(in->meta, &res->stats);
+    uint64_t *after = (uint64_t*)&res->stats;
+    const uint64_t *prev = (const uint64_t*)&before;
+    for (size_t k = 0; k < sizeof(faidx_stats_t) / sizeof(uint64_t); k++) after[k] -= prev[k];
+#endif
+
+    free(threads);
+    free(thread_data);
+    free(lat);
+    return 0;
+
+fail:
+    free(threads);
+    free(thread_data);
+    free(lat);
+    return -1;
+}
+
+static void print_result(const bench_config_t *config, const run_result_t *r) {
+    const char *op = config->workload == WORKLOAD_BED ? "batch" : "fetch";
+    FILE *out = config->report;
+
+    fprintf(out, "\nBenchmark Results (%d threads):\n", r->threads);
+    fprintf(out, "  Total sequences fetched: %"PRIu64"\n", r->fetches);
+    fprintf(out, "  Total bases fetched:     %"PRIu64"\n", r->bases);
+    fprintf(out, "  Wall time:               %.3f seconds\n", r->wall);
+    fprintf(out, "  Latency per %s:       mean %.0f ns, p50 %"PRIu64", p99 %"PRIu64", p99.9 %"PRIu64", max %"PRIu64" ns\n",
+            op, r->lat_mean, r->p50, r->p99, r->p999, r->lat_max);
+    if (config->cache_blocks > 0) {
+        uint64_t lookups = r->cache_hits + r->cache_misses;
+        fprintf(out, "  Block cache hits:        %"PRIu64" / %"PRIu64" (%.1f%%)\n", r->cache_hits, lookups,
+                lookups ? 100.0 * r->cache_hits / lookups : 0.0);
+    }
+#ifndef FAIGZ_BENCH_MINIMAL
+    if (config->verbose) {
+        fprintf(out, "  Blocks inflated:         %"PRIu64" (%"PRIu64" compressed bytes read, %"PRIu64" seeks)\n",
+                r->stats.blocks_inflated, r->stats.bytes_read, r->stats.seeks);
+        fprintf(out, "  Time in I/O/inflate/copy: %.3f / %.3f / %.3f seconds\n", r->stats.io_ns / 1e9,
+                r->stats.inflate_ns / 1e9, r->stats.copy_ns / 1e9);
+    }
+#endif
+    fprintf(out, "  Average time per thread: %.3f seconds\n", r->avg_time);
+    fprintf(out, "  Total throughput:        %.2f bases/second\n", r->wall > 0 ? r->bases / r->wall : 0.0);
+}
+
+static void json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(fp, "\\u%04x", (unsigned char)*s);
+        else fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_json(FILE *fp, const bench_config_t *config, const run_result_t *runs, int n) {
+    fprintf(fp, "{\n  \"backend\": \"%s\",\n  \"file\": ", BENCH_BACKEND);
+    json_string(fp, config->fasta_file);
+    fprintf(fp, ",\n  \"workload\": \"%s\",\n", workload_names[config->workload]);
+    fprintf(fp, "  \"length\": %d,\n  \"fetches_per_thread\": %d,\n", config->seq_length,
+            config->seq_count);
+    if (config->workload == WORKLOAD_ZIPF) fprintf(fp, "  \"zipf_s\": %g,\n", config->zipf_s);
+    if (config->workload == WORKLOAD_WINDOW) fprintf(fp, "  \"step\": %d,\n", config->step);
+    if (config->workload == WORKLOAD_BED) {
+        fprintf(fp, "  \"bed\": ");
+        json_string(fp, config->bed_file);
+        fprintf(fp, ",\n  \"batch_size\": %d,\n", config->batch_size);
+    }
+    fprintf(fp, "  \"cache_blocks\": %d,\n  \"shared_cache_mb\": %d,\n  \"inflate_threads\": %d,\n",
+            config->cache_blocks, config->shared_cache_mb, config->inflate_threads);
+    fprintf(fp, "  \"inflate\": \"%s\",\n  \"seed\": %u,\n  \"runs\": [\n", faidx_inflate_backend(),
+            config->seed);
+
+    for (int i = 0; i < n; i++) {
+        const run_result_t *r = &runs[i];
+        fprintf(fp, "    {\"threads\": %d, \"fetches\": %"PRIu64", \"ops\": %"PRIu64", "
+                "\"bases\": %"PRIu64", \"wall_s\": %.6f, ", r->threads, r->fetches, r->ops, r->bases,
+                r->wall);
+        fprintf(fp, "\"bases_per_s\": %.1f, \"fetches_per_s\": %.1f, ",
+                r->wall > 0 ? r->bases / r->wall : 0.0, r->wall > 0 ? r->fetches / r->wall : 0.0);
+        fprintf(fp, "\"latency_ns\": {\"mean\": %.1f, \"p50\": %"PRIu64", \"p99\": %"PRIu64", "
+                "\"p999\": %"PRIu64", \"max\": %"PRIu64"}, ", r->lat_mean, r->p50, r->p99, r->p999,
+                r->lat_max);
+        fprintf(fp, "\"cache_hits\": %"PRIu64", \"cache_misses\": %"PRIu64, r->cache_hits,
+                r->cache_misses);
+#ifndef FAIGZ_BENCH_MINIMAL
+        fprintf(fp, ", \"stats\": {\"blocks_inflated\": %"PRIu64", \"bytes_read\": %"PRIu64", "
+                "\"seeks\": %"PRIu64", \"io_ns\": %"PRIu64", \"inflate_ns\": %"PRIu64", "
+                "\"copy_ns\": %"PRIu64"}", r->stats.blocks_inflated, r->stats.bytes_read,
+                r->stats.seeks, r->stats.io_ns, r->stats.inflate_ns, r->stats.copy_ns);
+#endif
+        fprintf(fp, "}%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
 int main(int argc, char **argv) {
     bench_config_t config;
-    faidx_meta_t *meta;
-    pthread_t *threads;
-    thread_data_t *thread_data;
-    pthread_mutex_t output_mutex;
-    FILE *output_fp = NULL;
-    int i;
-    double total_time = 0.0;
-    uint64_t total_bases = 0;
-    
+    bench_input_t input;
+    run_result_t *runs;
+    faidx_writer_t *writer = NULL;
+    FILE *out;
+    int i, ret = 1;
+
     // Parse command line arguments
     config = parse_args(argc, argv);
-    
-    printf("Benchmark configuration:\n");
-    printf("  FASTA file:  %s\n", config.fasta_file);
-    printf("  Threads:     %d\n", config.num_threads);
-    printf("  Seq count:   %d per thread (%d total)\n", config.seq_count, 
-           config.seq_count * config.num_threads);
-    printf("  Seq length:  %d\n", config.seq_length);
-    printf("  Output:      %s\n", config.output_file ? config.output_file : "none");
-    printf("  Seed:        %u\n", config.seed);
-    printf("  Verbose:     %s\n", config.verbose ? "yes" : "no");
-    
-    // Output file handling message
-    if (!config.output_file) {
-        if (config.verbose) {
-            printf("\nNote: No output file specified. Use -o option to write sequences to a file.\n");
-        }
+    out = config.report;
+    memset(&input, 0, sizeof(input));
+
+    fprintf(out, "Benchmark configuration:\n");
+    fprintf(out, "  Backend:     %s\n", BENCH_BACKEND);
+    fprintf(out, "  FASTA file:  %s\n", config.fasta_file);
+    fprintf(out, "  Threads:    ");
+    for (i = 0; i < config.n_sweep; i++) fprintf(out, " %d", config.sweep[i]);
+    fprintf(out, "\n");
+    fprintf(out, "  Workload:    %s\n", workload_names[config.workload]);
+    if (config.workload == WORKLOAD_BED) {
+        fprintf(out, "  Regions:     %s, %d per batch\n", config.bed_file, config.batch_size);
     } else {
-        printf("Output file: %s will be created/overwritten\n", config.output_file);
+        fprintf(out, "  Seq count:   %d per thread\n", config.seq_count);
+        fprintf(out, "  Seq length:  %d\n", config.seq_length);
     }
-    
+    fprintf(out, "  Cache:       %d blocks per reader, %d MB shared\n",
+            config.cache_blocks, config.shared_cache_mb);
+    fprintf(out, "  Inflate:     %s\n", faidx_inflate_backend());
+    fprintf(out, "  Output:      %s\n", config.output_file ? config.output_file : "none");
+    fprintf(out, "  Seed:        %u\n", config.seed);
+    fprintf(out, "  Verbose:     %s\n", config.verbose ? "yes" : "no");
+
     // Load the FASTA index metadata
-    meta = faidx_meta_load(config.fasta_file, FAI_FASTA, FAI_CREATE);
-    if (!meta) {
+#ifndef FAIGZ_BENCH_MINIMAL
+    input.meta = faidx_meta_load_cached(config.fasta_file, FAI_FASTA, FAI_CREATE,
+                                        (size_t)config.shared_cache_mb << 20);
+#else
+    input.meta = faidx_meta_load(config.fasta_file, FAI_FASTA, FAI_CREATE);
+#endif
+    if (!input.meta) {
         fprintf(stderr, "Failed to load FASTA index\n");
         return 1;
     }
-    
-    printf("Loaded index with %d sequences\n", faidx_meta_nseq(meta));
-    
-    // Open output file if specified
-    if (config.output_file) {
-        output_fp = fopen(config.output_file, "w");
-        if (!output_fp) {
+
+    fprintf(out, "Loaded index with %d sequences\n", faidx_meta_nseq(input.meta));
+
+#ifndef FAIGZ_BENCH_MINIMAL
+    if (faidx_meta_set_threads(input.meta, config.inflate_threads) < 0) {
+        fprintf(stderr, "Failed to start %d inflate threads\n", config.inflate_threads);
+        goto done;
+    }
+#endif
+    if (build_input(&config, &input) < 0) {
+        fprintf(stderr, "Failed to prepare the %s workload\n", workload_names[config.workload]);
+        goto done;
+    }
+
+    // Open output file if specified; shards are opened by their threads
+    if (config.output_file && !config.shard_output) {
+        writer = faidx_writer_open(config.output_file, 1);
+        if (!writer) {
             fprintf(stderr, "Failed to open output file: %s\n", config.output_file);
-            faidx_meta_destroy(meta);
-            return 1;
+            goto done;
         }
-        pthread_mutex_init(&output_mutex, NULL);
-    }
-    
-    // Allocate thread resources
-    threads = malloc(config.num_threads * sizeof(pthread_t));
-    thread_data = malloc(config.num_threads * sizeof(thread_data_t));
-    if (!threads || !thread_data) {
-        fprintf(stderr, "Failed to allocate memory for threads\n");
-        if (output_fp) fclose(output_fp);
-        faidx_meta_destroy(meta);
-        return 1;
     }
-    
-    // Create and start threads
-    for (i = 0; i < config.num_threads; i++) {
-        thread_data[i].thread_id = i;
-        thread_data[i].meta = meta;
-        thread_data[i].config = &config;
-        thread_data[i].seed = config.seed;
-        thread_data[i].output_mutex = &output_mutex;
-        thread_data[i].output_fp = output_fp;
-        thread_data[i].num_bases = 0;
-        thread_data[i].elapsed_time = 0.0;
-        
-        if (pthread_create(&threads[i], NULL, worker_thread, &thread_data[i]) != 0) {
-            fprintf(stderr, "Failed to create thread %d\n", i);
-            faidx_meta_destroy(meta);
-            free(threads);
-            free(thread_data);
-            if (output_fp) {
-                fclose(output_fp);
-                pthread_mutex_destroy(&output_mutex);
-            }
-            return 1;
+
+    runs = calloc(config.n_sweep, sizeof(run_result_t));
+    if (!runs) goto done;
+    for (i = 0; i < config.n_sweep; i++) {
+        if (run_once(&config, &input, config.sweep[i], writer, &runs[i]) < 0) {
+            fprintf(stderr, "Run with %d threads failed\n", config.sweep[i]);
+            free(runs);
+            goto done;
         }
+        print_result(&config, &runs[i]);
     }
-    
-    // Wait for all threads to finish
-    for (i = 0; i < config.num_threads; i++) {
-        pthread_join(threads[i], NULL);
-        total_time += thread_data[i].elapsed_time;
-        total_bases += thread_data[i].num_bases;
-    }
-    
-    // Calculate average time and throughput
-    double avg_time = total_time / config.num_threads;
-    double throughput = total_bases / avg_time;
-    
-    printf("\nBenchmark Results:\n");
-    printf("  Total sequences fetched: %d\n", config.seq_count * config.num_threads);
-    printf("  Total bases fetched:     %"PRIu64"\n", total_bases);
-    printf("  Average time per thread: %.3f seconds\n", avg_time);
-    printf("  Total throughput:        %.2f bases/second\n", throughput);
-    
-    // Clean up
-    free(threads);
-    free(thread_data);
-    faidx_meta_destroy(meta);
-    
-    if (output_fp) {
-        fclose(output_fp);
-        pthread_mutex_destroy(&output_mutex);
-        
-        // Check if output file was created successfully
-        FILE *check_fp = fopen(config.output_file, "r");
-        if (check_fp) {
-            fseek(check_fp, 0, SEEK_END);
-            long file_size = ftell(check_fp);
-            fclose(check_fp);
-            printf("Sequences written to %s (size: %ld bytes)\n", config.output_file, file_size);
-        } else {
-            fprintf(stderr, "Warning: Cannot verify output file %s: %s\n", 
-                   config.output_file, strerror(errno));
+
+    if (config.json_file) {
+        FILE *fp = strcmp(config.json_file, "-") == 0 ? stdout : fopen(config.json_file, "w");
+        if (!fp) {
+            fprintf(stderr, "Failed to open JSON file: %s\n", config.json_file);
+            free(runs);
+            goto done;
         }
+        write_json(fp, &config, runs, config.n_sweep);
+        if (fp != stdout) fclose(fp);
     }
-    
-    return 0;
+    free(runs);
+    ret = 0;
+
+done:
+    if (writer && faidx_writer_close(writer) < 0) {
+        fprintf(stderr, "Failed to write output file: %s\n", strerror(errno));
+        ret = 1;
+    }
+    if (config.output_file && ret == 0) {
+        fprintf(out, "Sequences written to %s%s\n", config.output_file,
+                config.shard_output ? ".<thread>" : "");
+    }
+    free_input(&input);
+    free(config.sweep);
+    faidx_meta_destroy(input.meta);
+    return ret;
 }
@@ -0,0 +1,102 @@
+// bench_faigz_hpp.cpp - cost of the faigz.hpp wrapper against the C API
+//
+// Fetches the same random regions three ways: faidx_reader_fetch_seq with
+// a malloc and free per region, faigz::Reader::fetch into the reader's
+// reused buffer, and faigz::parallel_fetch on the requested threads.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#define REENTRANT_FAIDX_IMPLEMENTATION
+#include "faigz.hpp"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <fasta_file>\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -t INT    Threads for parallel_fetch [4]\n");
+    fprintf(stderr, "  -n INT    Regions to fetch [100000]\n");
+    fprintf(stderr, "  -l INT    Region length [100]\n");
+    fprintf(stderr, "  -c INT    Decompressed BGZF blocks cached per reader [0]\n");
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void report(const char *what, size_t n, uint64_t bases, double secs) {
+    printf("%-16s %10.0f regions/s %8.1f Mbases/s (%.3f s)\n", what,
+           n / secs, bases / secs / 1e6, secs);
+}
+
+int main(int argc, char **argv) {
+    int n_threads = 4, cache_blocks = 0, c;
+    long n_regions = 100000, length = 100;
+
+    while ((c = getopt(argc, argv, "t:n:l:c:h")) != -1) {
+        switch (c) {
+            case 't': n_threads = atoi(optarg); break;
+            case 'n': n_regions = atol(optarg); break;
+            case 'l': length = atol(optarg); break;
+            case 'c': cache_blocks = atoi(optarg); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc || n_threads < 1 || n_regions < 1 || length < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        faigz::Meta meta(argv[optind]);
+        std::vector<faigz::Region> regions;
+        std::mt19937_64 rng(11);
+        for (long i = 0, tries = 0; i < n_regions && tries < n_regions * 100; tries++) {
+            int tid = (int)(rng() % meta.size());
+            hts_pos_t len = meta.length(tid);
+            if (len < length) continue;
+            hts_pos_t beg = (hts_pos_t)(rng() % (uint64_t)(len - length + 1));
+            regions.push_back(faigz::Region{meta.name(tid), beg, beg + length - 1});
+            i++;
+        }
+        if (regions.empty()) {
+            fprintf(stderr, "No sequence is at least %ld bases long\n", length);
+            return 1;
+        }
+
+        faigz::Reader reader(meta, cache_blocks);
+        uint64_t bases = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (const auto &r : regions) {
+            hts_pos_t n;
+            char *seq = faidx_reader_fetch_seq(reader.get(), r.name.c_str(), r.beg, r.end, &n);
+            if (seq) bases += n;
+            free(seq);
+        }
+        report("C fetch_seq", regions.size(), bases, seconds_since(t0));
+
+        bases = 0;
+        t0 = std::chrono::steady_clock::now();
+        for (const auto &r : regions) {
+            auto seq = reader.fetch(r);
+            if (seq) bases += seq->size();
+        }
+        report("Reader::fetch", regions.size(), bases, seconds_since(t0));
+
+        std::atomic<uint64_t> pbases(0);
+        t0 = std::chrono::steady_clock::now();
+        faigz::parallel_fetch(meta, regions, n_threads, [&](size_t, std::string_view seq, hts_pos_t) {
+            pbases.fetch_add(seq.size(), std::memory_order_relaxed);
+        }, cache_blocks);
+        report("parallel_fetch", regions.size(), pbases.load(), seconds_since(t0));
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
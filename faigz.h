@@ -7,6 +7,12 @@
 #include <errno.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <time.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "htslib/bgzf.h"
 #include "htslib/faidx.h"
@@ -14,6 +20,12 @@
 #include "htslib/kstring.h"
 #include "htslib/khash.h"
 
+#include "faigz_simd.h"
+#include "faigz_index.h"
+#include "faigz_inflate.h"
+#include "faigz_build.h"
+#include "faigz_pack.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,35 +33,154 @@ extern "C" {
 // Forward declarations
 typedef struct faidx_meta_t faidx_meta_t;
 typedef struct faidx_reader_t faidx_reader_t;
+typedef struct faidx_iter_t faidx_iter_t;
+typedef struct faidx_async_t faidx_async_t;
+
+// Region for batched fetches
+typedef struct {
+    const char *name;            // Sequence name
+    hts_pos_t beg, end;          // 0-based, end inclusive as for faidx_reader_fetch_seq
+} faidx_region_t;
+
+// Activity counters of a reader, or summed over every reader of a meta
+typedef struct {
+    uint64_t fetches;            // Fetches that returned data
+    uint64_t bytes_out;          // Bytes of sequence, quality or packed codes returned
+    uint64_t blocks_inflated;    // BGZF blocks decompressed
+    uint64_t bytes_read;         // Compressed bytes read from the file
+    uint64_t cache_hits;         // Block lookups served by the reader's, last or shared block
+    uint64_t cache_misses;       // Block lookups that had to read and inflate
+    uint64_t seeks;              // Repositionings of the file handle
+    uint64_t io_ns;              // Time spent reading
+    uint64_t inflate_ns;         // Time spent inflating, wall clock for parallel inflates
+    uint64_t copy_ns;            // Time spent stripping, copying and decoding bases
+} faidx_stats_t;
 
-// Key structures needed for our implementation
+// Key structures needed for our implementation; a record's id is its index in meta->seq
 typedef struct {
-    int id;
-    uint32_t line_len, line_blen;
-    uint64_t len;
-    uint64_t seq_offset;
-    uint64_t qual_offset;
+    uint32_t line_len, line_blen; // Bytes per line including terminator, bases per line
+    uint64_t len;                // Sequence length in bases
+    uint64_t seq_offset;         // Uncompressed file offset of the first base
+    uint64_t qual_offset;        // Uncompressed file offset of the first quality (FASTQ)
 } faidx1_t;
 
-// Simple string hash function
-static khint_t faigz_str_hash_func(const char *s) {
-    khint_t h = 0;
-    while (*s) {
-        h = (h << 5) - h + *s++;
-    }
-    return h;
-}
+// One entry of the BGZF block index (.gzi)
+typedef struct {
+    uint64_t caddr;              // Compressed offset of the block in the file
+    uint64_t uaddr;              // Uncompressed offset of the block's first byte
+} faidx_gzi_entry_t;
+
+// Block cache lookup: compressed block offset -> cache slot
+KHASH_MAP_INIT_INT64(faigz_blk, int)
+
+// One decompressed BGZF block held in a reader's cache
+typedef struct {
+    int64_t caddr;               // Compressed offset of the block, -1 if unused
+    int len;                     // Decompressed length
+    int prev, next;              // LRU list links (slot indices, -1 at the ends)
+    uint8_t *data;               // BGZF_MAX_BLOCK_SIZE bytes
+} faidx_cache_slot_t;
+
+// One decompressed BGZF block in the cache shared by all readers of a meta
+typedef struct faidx_shared_block_t {
+    int64_t caddr;               // Compressed offset of the block
+    int len;                     // Decompressed length, -1 while being inflated
+    int failed;                  // Set if the inflating reader gave up
+    int listed;                  // Set while on the shard's LRU list
+    int refs;                    // Held by the cache while listed, plus once per user
+    struct faidx_shared_block_t *prev, *next; // Shard LRU list
+    uint8_t *data;               // BGZF_MAX_BLOCK_SIZE bytes following the struct
+} faidx_shared_block_t;
+
+KHASH_MAP_INIT_INT64(faigz_sblk, faidx_shared_block_t*)
+
+// Independently locked part of the shared cache
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;        // Signalled when a block finishes inflating
+    khash_t(faigz_sblk) *map;    // Compressed offset -> block
+    faidx_shared_block_t *head, *tail; // Most and least recently used
+    size_t bytes, max_bytes;     // Current and allowed size of the listed blocks
+    uint64_t hits, misses;
+} faidx_cache_shard_t;
+
+typedef struct {
+    int n_shards;                // Power of two
+    faidx_cache_shard_t *shards;
+} faidx_shared_cache_t;
+
+// Parallel loop queued on a thread pool
+typedef struct faidx_tpool_job_t {
+    void (*fn)(void *arg, int i); // Called once for each i in [0, n)
+    void *arg;
+    int n;                       // Number of iterations
+    int next;                    // Next iteration to hand out
+    int pending;                 // Iterations not yet finished
+    struct faidx_tpool_job_t *link; // Next queued job
+} faidx_tpool_job_t;
+
+// Worker threads shared by all readers of a meta
+typedef struct {
+    pthread_t *threads;
+    int n_threads;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work;         // Signalled when a job is queued or on shutdown
+    pthread_cond_t done;         // Signalled when a job's last iteration finishes
+    faidx_tpool_job_t *head;     // Jobs with iterations left to hand out
+} faidx_tpool_t;
+
+// Completed asynchronous fetch
+typedef struct {
+    uint64_t id;                 // As returned by faidx_async_submit
+    void *arg;                   // Caller's pointer given to faidx_async_submit
+    char *seq;                   // NUL-terminated bases, freed by the caller; NULL on error
+    hts_pos_t len;               // Sequence length, -1 on error or -2 if the sequence is not present
+} faidx_async_result_t;
+
+// Called on a worker thread when a fetch submitted with it completes
+typedef void (*faidx_async_cb)(faidx_async_result_t *res);
+
+// Uncompressed byte range a prefetch warms, both ends inclusive
+typedef struct {
+    uint64_t first, last;
+} faidx_span_t;
+
+// One submitted fetch, queued for a worker and then for faidx_async_poll
+typedef struct faidx_async_req_t {
+    faidx_async_result_t res;
+    int tid;                     // Sequence id, -1 if the name wasn't found
+    hts_pos_t beg, end;          // As for faidx_reader_fetch_seq
+    faidx_async_cb cb;           // NULL to deliver through faidx_async_poll
+    faidx_span_t *spans;         // Ranges to warm if this is a prefetch, which has no result
+    size_t n_spans;
+    struct faidx_async_req_t *next;
+} faidx_async_req_t;
 
-// String hash type with unique macro names to avoid collision
-#define kh_faigz_hash_func(key) faigz_str_hash_func(key)
-#define kh_faigz_hash_equal(a, b) (strcmp((a), (b)) == 0)
-KHASH_INIT(str, kh_cstr_t, faidx1_t, 1, kh_faigz_hash_func, kh_faigz_hash_equal)
+// Worker threads, each with its own reader, fetching submitted regions
+struct faidx_async_t {
+    faidx_meta_t *meta;          // Referenced for the queue's lifetime
+    pthread_t *threads;
+    int n_threads;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work;         // Signalled when a fetch is queued or on shutdown
+    pthread_cond_t done;         // Signalled when a fetch completes
+    faidx_async_req_t *head, *tail; // Waiting for a worker, oldest first
+    faidx_async_req_t *done_head, *done_tail; // Completed and not yet polled
+    int64_t n_polled;            // Fetches without a callback not yet returned by faidx_async_poll
+    uint64_t next_id;
+};
 
 // Shared metadata structure containing only the indices
 struct faidx_meta_t {
     int n, m;                     // Sequence count and allocation size
-    char **name;                  // Array of sequence names
-    khash_t(str) *hash;          // Hash table mapping names to positions
+    char *names;                 // Arena of NUL-terminated sequence names
+    size_t names_len;            // Bytes used in names
+    uint64_t *name_off;          // Offset of each sequence's name in names
+    faidx1_t *seq;               // Records indexed by sequence id
+    faidx_name_slot_t *slots;    // Name table mapping names to ids
+    uint32_t slot_mask;          // Name table slots - 1
     enum fai_format_options format; // FAI_FASTA or FAI_FASTQ
     
     // Source file paths
@@ -57,30 +188,171 @@ struct faidx_meta_t {
     char *fai_path;              // Path to the .fai index
     char *gzi_path;              // Path to the .gzi index (if using BGZF)
     
-    // Reference count and mutex for thread safety
+    // BGZF block index, loaded once and shared by all readers
+    faidx_gzi_entry_t *gzi;      // Block offsets; gzi[0] is always {0, 0}
+    int64_t n_gzi;               // Number of entries in gzi
+    
+    // Mapped snapshot the arrays above point into (read-only), base NULL if none
+    faidx_snapshot_t snapshot;
+    char *shm_name;              // Shared memory segment holding the snapshot, NULL if a file
+    
+    // Decompressed blocks shared by all readers, NULL if disabled
+    faidx_shared_cache_t *shared_cache;
+    
+    // Threads inflating long fetches in parallel, NULL if disabled
+    faidx_tpool_t *pool;
+    
+    // Reference count (updated atomically) and mutex for thread safety
     int ref_count;
     pthread_mutex_t mutex;
     
+    // Idle readers kept by faidx_meta_acquire_reader; slots are exchanged atomically
+    faidx_reader_t **reader_slots; // max_readers slots, NULL where empty
+    int max_readers;             // Readers the pool may create, 0 if there is no pool
+    int reader_cache_blocks;     // Block cache of each pooled reader
+    int n_readers;               // Readers created by the pool (atomic)
+    int n_waiting;               // Threads waiting for a reader (atomic)
+    pthread_cond_t reader_cond;  // Signalled under mutex when a reader is released
+    
     // Flag indicating if the source is BGZF compressed
     int is_bgzf;
+    
+    // Read-only mapping of an uncompressed file, NULL if not mapped
+    const char *map;
+    size_t map_size;
+    
+    // BGZF file kept open for readahead hints from prefetches, -1 if none
+    int advise_fd;
+    
+    // Packed companion file sequence fetches are served from, base NULL if none
+    faidx_pack_t pack;
+    
+    // Live readers and the summed counters of destroyed ones, both under mutex
+    faidx_reader_t *live;
+    faidx_stats_t retired;
 };
 
 // Reader structure containing thread-specific data
 struct faidx_reader_t {
     faidx_meta_t *meta;          // Shared metadata (not owned)
-    faidx_t *fai;                // Thread-local faidx handle
+    BGZF *bgzf;                  // Thread-local file handle, NULL when the meta is mapped
+    kstring_t buf;               // Raw bytes of the current fetch, line terminators included
+    kstring_t view;              // Bases returned by faidx_reader_fetch_seq_view when copied
+    int seq_mode;                // enum faidx_seq_mode applied to fetched sequence
+    int64_t gzi_hint;            // Index of the last block seeked to in meta->gzi
+    kstring_t cbuf;              // Compressed bytes of a multithreaded read
+    uint8_t *edge;               // Two blocks for partially wanted blocks of a multithreaded read
+    faidx_inflater_t inflater;   // Block decoder for the selected backend
+    uint8_t *blk;                // Last block inflated outside the caches
+    int blk_len;
+    int64_t blk_caddr;           // Compressed offset of blk, -1 if none
+    
+    // LRU cache of decompressed blocks (BGZF only)
+    faidx_cache_slot_t *cache;   // cache_size slots
+    int cache_size;              // Capacity in blocks, 0 disables the cache
+    int cache_used;              // Slots holding a block
+    int lru_head, lru_tail;      // Most and least recently used slots
+    khash_t(faigz_blk) *cache_map; // Compressed offset -> slot
+    uint64_t cache_hits, cache_misses;
+    
+    int pooled;                  // Created by the meta's reader pool
+    int pool_slot;               // Slot it was last acquired from
+    
+    // Counters, updated with relaxed atomics so faidx_meta_stats can read them live
+    faidx_stats_t stats;
+    unsigned stat_tick;          // Copies seen, picking the ones timed
+    faidx_reader_t *live_prev, *live_next; // Links in meta->live
+};
+
+/* Bases per chunk of a sequential iterator when none is given */
+#define FAIDX_ITER_CHUNK (1 << 20)
+
+// Sequential walk over whole sequences in fixed-size chunks
+struct faidx_iter_t {
+    faidx_reader_t *reader;      // Reader the chunks are read through (not owned)
+    int tid;                     // Sequence being walked
+    int end_tid;                 // One past the last sequence to walk
+    hts_pos_t pos;               // Next base to return within tid
+    hts_pos_t chunk;             // Bases per chunk
+    kstring_t out;               // Bases of the current chunk, reused for every chunk
 };
 
 /**
  * Load FASTA/FASTQ index metadata.
  * 
+ * With FAI_SNAPSHOT in flags, the names, records, name table and block
+ * index are taken from a read-only mapping of <file>.fai.bin when it is
+ * newer than the .fai and .gzi, which needs no parsing at all. Otherwise
+ * the indexes are parsed as usual and the snapshot is (re)written for next
+ * time; failing to write it is not an error.
+ * 
+ * FAI_SHM does the same with a POSIX shared memory segment instead of a
+ * file, so every process on the host attaches to one copy in microseconds.
+ * The segment is removed when the last meta attached to it is destroyed.
+ * 
+ * A FASTA with a current <file>.pk2 (see faigz_pack.h) has its sequence
+ * served from that instead, with no inflate; FAI_PACK writes it first if
+ * it is missing or stale, which reads the whole file once.
+ * 
  * @param filename Path to the FASTA/FASTQ file
  * @param format FAI_FASTA or FAI_FASTQ
- * @param flags Option flags (see FAI_CREATE in faidx.h)
+ * @param flags Option flags (FAI_CREATE from faidx.h, FAI_SNAPSHOT, FAI_SHM, FAI_PACK)
  * @return Pointer to metadata or NULL on error
  */
 faidx_meta_t *faidx_meta_load(const char *filename, enum fai_format_options format, int flags);
 
+/**
+ * Load FASTA/FASTQ index metadata with a shared block cache.
+ * 
+ * All readers created from the returned metadata share one cache of
+ * decompressed BGZF blocks, so a hot block is inflated once per process
+ * rather than once per thread. The cache is split into independently
+ * locked shards and never grows past cache_bytes in total.
+ * 
+ * @param filename Path to the FASTA/FASTQ file
+ * @param format FAI_FASTA or FAI_FASTQ
+ * @param flags Option flags, as for faidx_meta_load
+ * @param cache_bytes Memory budget for the shared cache, 0 to disable it
+ * @return Pointer to metadata or NULL on error
+ */
+faidx_meta_t *faidx_meta_load_cached(const char *filename, enum fai_format_options format,
+                                     int flags, size_t cache_bytes);
+
+/**
+ * Get the shared block cache counters
+ * 
+ * @param meta Metadata
+ * @param hits Output parameter for blocks found in the shared cache (may be NULL)
+ * @param misses Output parameter for blocks that had to be inflated (may be NULL)
+ */
+void faidx_meta_cache_stats(const faidx_meta_t *meta, uint64_t *hits, uint64_t *misses);
+
+/**
+ * Set the number of threads used to inflate long fetches
+ * 
+ * Fetches spanning many BGZF blocks, such as whole chromosomes, then
+ * inflate consecutive blocks in parallel on a pool owned by the metadata
+ * and shared by all of its readers. Short fetches are unaffected. Must
+ * not be called while readers of this metadata are fetching.
+ * 
+ * @param meta Metadata
+ * @param n_threads Number of worker threads, 0 to inflate on the calling thread only
+ * @return 0 on success, -1 on error
+ */
+int faidx_meta_set_threads(faidx_meta_t *meta, int n_threads);
+
+/**
+ * Get the counters summed over every reader of a meta, live or destroyed
+ * 
+ * Counters are updated with relaxed atomics and each is read once, so a
+ * snapshot taken while readers are busy can be slightly behind. All are
+ * zero when built with FAIGZ_NO_STATS.
+ * 
+ * @param meta Metadata
+ * @param stats Receives the counters
+ */
+void faidx_meta_stats(faidx_meta_t *meta, faidx_stats_t *stats);
+
 /**
  * Increment reference count on metadata
  * 
@@ -105,6 +377,37 @@ void faidx_meta_destroy(faidx_meta_t *meta);
  */
 faidx_reader_t *faidx_reader_create(faidx_meta_t *meta);
 
+/**
+ * Create a reader with a cache of decompressed BGZF blocks
+ * 
+ * Fetches that land in a recently used block are served from the cache
+ * instead of inflating it again, which pays off for clustered queries
+ * such as sliding windows. Each cached block takes up to 64KB. The cache
+ * is ignored for uncompressed files.
+ * 
+ * @param meta Shared metadata (reference count is incremented)
+ * @param cache_blocks Number of blocks to keep, 0 for no cache
+ * @return New reader or NULL on error
+ */
+faidx_reader_t *faidx_reader_create_cached(faidx_meta_t *meta, int cache_blocks);
+
+/**
+ * Get the block cache counters of a reader
+ * 
+ * @param reader Reader
+ * @param hits Output parameter for blocks served from the cache (may be NULL)
+ * @param misses Output parameter for blocks that had to be inflated (may be NULL)
+ */
+void faidx_reader_cache_stats(const faidx_reader_t *reader, uint64_t *hits, uint64_t *misses);
+
+/**
+ * Get a reader's counters
+ * 
+ * @param reader Reader
+ * @param stats Receives the counters
+ */
+void faidx_reader_stats(const faidx_reader_t *reader, faidx_stats_t *stats);
+
 /**
  * Destroy a reader.
  * This does not affect the shared metadata.
@@ -113,6 +416,56 @@ faidx_reader_t *faidx_reader_create(faidx_meta_t *meta);
  */
 void faidx_reader_destroy(faidx_reader_t *reader);
 
+/**
+ * Let the metadata keep a pool of readers for faidx_meta_acquire_reader
+ * 
+ * Task-based runtimes can then borrow a reader per task instead of
+ * creating one, so file handles and buffers are set up once per worker.
+ * At most max_readers are ever opened; acquiring beyond that waits for
+ * one to be released. Must not be called while pooled readers are out.
+ * 
+ * @param meta Metadata
+ * @param max_readers Maximum number of pooled readers, 0 to drop the pool
+ * @param cache_blocks Blocks cached by each pooled reader, as for faidx_reader_create_cached
+ * @return 0 on success, -1 on error or if pooled readers are still acquired
+ */
+int faidx_meta_set_reader_pool(faidx_meta_t *meta, int max_readers, int cache_blocks);
+
+/**
+ * Borrow a reader from the metadata's pool
+ * 
+ * An idle reader is taken with one atomic exchange, preferring the one
+ * this thread used last; a new one is opened while fewer than the
+ * maximum exist. Without a pool this is faidx_reader_create. The reader
+ * must be given back with faidx_meta_release_reader, not destroyed.
+ * 
+ * @param meta Metadata (reference count is incremented while the reader is out)
+ * @return Reader or NULL on error
+ */
+faidx_reader_t *faidx_meta_acquire_reader(faidx_meta_t *meta);
+
+/**
+ * Give back a reader from faidx_meta_acquire_reader
+ * 
+ * Its sequence mode is reset to FAIDX_SEQ_AS_IS; its caches are kept.
+ * 
+ * @param meta Metadata the reader was acquired from
+ * @param reader Reader to release
+ */
+void faidx_meta_release_reader(faidx_meta_t *meta, faidx_reader_t *reader);
+
+/**
+ * Set how soft-masked bases are returned by this reader's sequence fetches
+ * 
+ * The transform is fused into the copy that strips line terminators, so
+ * it costs no extra pass. Quality strings are never transformed.
+ * 
+ * @param reader Reader
+ * @param mode FAIDX_SEQ_AS_IS (the default), FAIDX_SEQ_UPPER or FAIDX_SEQ_MASK_N
+ * @return 0 on success, -1 on an unknown mode
+ */
+int faidx_reader_set_seq_mode(faidx_reader_t *reader, enum faidx_seq_mode mode);
+
 /**
  * Fetch sequence from a specific region
  * 
@@ -139,6 +492,259 @@ char *faidx_reader_fetch_seq(faidx_reader_t *reader, const char *c_name,
 char *faidx_reader_fetch_qual(faidx_reader_t *reader, const char *c_name,
                             hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
 
+/**
+ * Fetch sequence from a specific region into a caller-owned buffer
+ * 
+ * The buffer is grown as needed and can be reused across calls, so a
+ * fetch loop does no per-region allocation. On success out->s holds the
+ * NUL-terminated sequence and out->l its length.
+ * 
+ * @param reader Reader to use
+ * @param c_name Region name
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param out Output buffer (initialise to {0, 0, NULL}; free out->s when done)
+ * @return Sequence length, -1 on error or -2 if the sequence is not present
+ */
+hts_pos_t faidx_reader_fetch_seq_into(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
+
+/**
+ * Fetch the quality string for a specific region into a caller-owned buffer (FASTQ only)
+ * 
+ * @param reader Reader to use
+ * @param c_name Region name
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param out Output buffer, reused as for faidx_reader_fetch_seq_into
+ * @return String length, -1 on error or -2 if absent or not a FASTQ index
+ */
+hts_pos_t faidx_reader_fetch_qual_into(faidx_reader_t *reader, const char *c_name,
+                                     hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
+
+/**
+ * Fetch sequence by id
+ * 
+ * Same as faidx_reader_fetch_seq, but the sequence is given by its index
+ * in the .fai (as enumerated by faidx_meta_iseq, or a tid from
+ * faidx_meta_parse_region), so no name is hashed or compared.
+ * 
+ * @param reader Reader to use
+ * @param tid Sequence id, 0 to faidx_meta_nseq() - 1
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param len Output parameter for sequence length
+ * @return Sequence string (must be freed by caller) or NULL on error
+ */
+char *faidx_reader_fetch_seq_id(faidx_reader_t *reader, int tid,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
+
+/**
+ * Fetch sequence by id into a caller-owned buffer
+ * 
+ * @param reader Reader to use
+ * @param tid Sequence id, 0 to faidx_meta_nseq() - 1
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param out Output buffer, reused as for faidx_reader_fetch_seq_into
+ * @return Sequence length, -1 on error or -2 if tid is out of range
+ */
+hts_pos_t faidx_reader_fetch_seq_id_into(faidx_reader_t *reader, int tid,
+                                       hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
+
+/**
+ * Fetch sequence from a specific region without copying where possible
+ * 
+ * For an uncompressed file whose region lies on a single line, *seq
+ * points straight into the metadata's read-only mapping of the file and
+ * stays valid until the metadata is destroyed. Otherwise the bases are
+ * copied into a buffer owned by the reader, valid until its next fetch.
+ * In both cases *seq is not necessarily NUL-terminated.
+ * 
+ * @param reader Reader to use
+ * @param c_name Region name
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param seq Output parameter for the first base
+ * @return Sequence length, -1 on error or -2 if the sequence is not present
+ */
+hts_pos_t faidx_reader_fetch_seq_view(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, const char **seq);
+
+/**
+ * Fetch sequence packed to 2 or 4 bits per base
+ * 
+ * Line terminators are stripped and the bases packed in the same pass, so
+ * no ASCII copy of the region is made. Base i is stored in the lowest bits
+ * first: bits 2*(i%4) of byte i/4 for FAIDX_PACK_2BIT, and bits 4*(i%2) of
+ * byte i/2 for FAIDX_PACK_4BIT (the opposite nibble order to BAM). Bit i%8
+ * of byte i/8 of mask is set for every base other than A, C, G or T, which
+ * FAIDX_PACK_2BIT stores as 0. With FAIDX_SEQ_MASK_N soft-masked bases
+ * count as N; otherwise case is ignored. Unused trailing bits are zero.
+ * 
+ * @param reader Reader to use
+ * @param c_name Region name
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param type FAIDX_PACK_2BIT or FAIDX_PACK_4BIT
+ * @param out Buffer for the packed bases, reused as for faidx_reader_fetch_seq_into
+ * @param mask Buffer for the ambiguity mask, or NULL if not wanted
+ * @return Number of bases, -1 on error or -2 if the sequence is not present
+ */
+hts_pos_t faidx_reader_fetch_packed(faidx_reader_t *reader, const char *c_name,
+                                  hts_pos_t p_beg_i, hts_pos_t p_end_i, int type,
+                                  kstring_t *out, kstring_t *mask);
+
+/**
+ * Fetch many regions at once
+ * 
+ * Regions are sorted by file offset, overlapping and adjacent ones are
+ * merged into a single read, and the results are scattered back in the
+ * caller's order. Each BGZF block is therefore decompressed at most once
+ * per merged read, and the file is visited front to back.
+ * 
+ * @param reader Reader to use
+ * @param regions Array of n regions (same coordinates as faidx_reader_fetch_seq)
+ * @param n Number of regions
+ * @param out Array of n buffers, reused as for faidx_reader_fetch_seq_into
+ * @param lens Optional array of n results: the length, -1 on error or -2 if absent
+ * @return Number of regions fetched successfully, or -1 if the batch could not be run
+ */
+int64_t faidx_reader_fetch_batch(faidx_reader_t *reader, const faidx_region_t *regions,
+                                 size_t n, kstring_t *out, hts_pos_t *lens);
+
+/**
+ * Warm the data of regions that will be fetched soon
+ * 
+ * The BGZF blocks holding the regions are found through the .gzi, and the
+ * kernel is asked to read their compressed bytes ahead with one
+ * posix_fadvise(POSIX_FADV_WILLNEED) per merged span. With a reader or
+ * shared cache the blocks are then inflated into it, in file order and
+ * only as many as the caches hold; without one the hint is all that is
+ * done, so the call returns without waiting for the I/O. Mapped
+ * uncompressed files get posix_madvise(POSIX_MADV_WILLNEED). Where those
+ * calls aren't declared (platforms without them, or -std=c99 without
+ * _POSIX_C_SOURCE, which the Makefile sets) the compressed bytes are read
+ * and the mapped pages touched instead, which blocks. Unknown names are
+ * skipped; faidx_async_prefetch does the same on a worker thread.
+ * 
+ * @param reader Reader
+ * @param regions Regions, end inclusive
+ * @param n Number of regions
+ * @return Number of BGZF blocks warmed, or -1 on error
+ */
+int64_t faidx_reader_prefetch(faidx_reader_t *reader, const faidx_region_t *regions, size_t n);
+
+/**
+ * Create an iterator streaming whole sequences in fixed-size chunks
+ * 
+ * Each chunk is read with a single sequential read of the file and stripped
+ * of line terminators into one buffer that is reused for every chunk, so
+ * memory stays bounded by the chunk size however long the sequence is. The
+ * block straddling two chunks is inflated only once, and with
+ * faidx_meta_set_threads() a chunk's blocks are inflated in parallel.
+ * Other fetches may be interleaved through the same reader, at the cost of
+ * that reuse.
+ * 
+ * @param reader Reader to read through
+ * @param tid Sequence id to walk, or -1 for every sequence in file order
+ * @param chunk Bases per chunk, 0 for FAIDX_ITER_CHUNK
+ * @return Iterator or NULL on error
+ */
+faidx_iter_t *faidx_reader_iter(faidx_reader_t *reader, int tid, hts_pos_t chunk);
+
+/**
+ * Get the next chunk of an iterator
+ * 
+ * Chunks come in file order and never span two sequences; sequences of
+ * length zero yield no chunk. The bases follow the reader's sequence mode.
+ * 
+ * @param iter Iterator
+ * @param tid Output parameter for the chunk's sequence id
+ * @param pos Output parameter for the chunk's first base (0-based)
+ * @param seq Output parameter for the bases, NUL-terminated and valid until the next call
+ * @return Chunk length, 0 once every sequence is done, or -1 on error
+ */
+hts_pos_t faidx_iter_next(faidx_iter_t *iter, int *tid, hts_pos_t *pos, const char **seq);
+
+/**
+ * Destroy an iterator; the reader stays open
+ * 
+ * @param iter Iterator
+ */
+void faidx_iter_destroy(faidx_iter_t *iter);
+
+/**
+ * Create a queue fetching regions asynchronously
+ * 
+ * Each of the n_threads workers has its own reader, so up to n_threads
+ * reads are in flight at once while the submitting thread carries on. On
+ * high-latency storage (network filesystems, FUSE mounts) dozens of
+ * workers hide most of the per-read latency; inflating on one worker
+ * overlaps with I/O on the others.
+ * 
+ * @param meta Metadata (reference count is incremented)
+ * @param n_threads Number of workers, at least 1
+ * @return Queue or NULL on error
+ */
+faidx_async_t *faidx_async_create(faidx_meta_t *meta, int n_threads);
+
+/**
+ * Queue a region for fetching
+ * 
+ * The name is looked up before returning, so it needn't outlive the call.
+ * Fetches are started in submission order. When one completes, cb is
+ * called with its result on a worker thread if cb is not NULL; otherwise
+ * the result is kept for faidx_async_poll. Either way the receiver owns
+ * res->seq. Names not in the index complete with len -2.
+ * 
+ * @param q Queue
+ * @param c_name Region name
+ * @param p_beg_i Beginning position (0-based)
+ * @param p_end_i End position (0-based)
+ * @param cb Completion callback, or NULL to poll for the result
+ * @param arg Pointer handed back in the result
+ * @return Id of the fetch, or -1 on error
+ */
+int64_t faidx_async_submit(faidx_async_t *q, const char *c_name, hts_pos_t p_beg_i,
+                           hts_pos_t p_end_i, faidx_async_cb cb, void *arg);
+
+/**
+ * Warm regions in the background, as faidx_reader_prefetch does
+ * 
+ * The work is queued like a fetch and taken by the next free worker.
+ * Workers' readers have no block cache of their own, so the blocks go to
+ * the meta's shared cache (see faidx_meta_load_cached), or only to the OS
+ * page cache without one. Nothing is delivered when it completes.
+ * 
+ * @param q Queue
+ * @param regions Regions, end inclusive; not needed after the call
+ * @param n Number of regions
+ * @return 0 on success, -1 on error
+ */
+int faidx_async_prefetch(faidx_async_t *q, const faidx_region_t *regions, size_t n);
+
+/**
+ * Reap completed fetches submitted without a callback, in completion order
+ * 
+ * @param q Queue
+ * @param res Array for up to max results
+ * @param max Size of res
+ * @param wait If set, block until at least one result is ready, unless none is outstanding
+ * @return Number of results stored, 0 if none are ready (or outstanding when waiting)
+ */
+int faidx_async_poll(faidx_async_t *q, faidx_async_result_t *res, int max, int wait);
+
+/**
+ * Destroy a queue once every submitted fetch has completed
+ * 
+ * Outstanding fetches are finished and their callbacks run; results not
+ * yet polled are discarded.
+ * 
+ * @param q Queue
+ */
+void faidx_async_destroy(faidx_async_t *q);
+
 /**
  * Get number of sequences in the index
  * 
@@ -165,6 +771,15 @@ const char *faidx_meta_iseq(const faidx_meta_t *meta, int i);
  */
 hts_pos_t faidx_meta_seq_len(const faidx_meta_t *meta, const char *seq);
 
+/**
+ * Get sequence length by id
+ * 
+ * @param meta Metadata
+ * @param tid Sequence id, 0 to faidx_meta_nseq() - 1
+ * @return Sequence length or -1 if tid is out of range
+ */
+hts_pos_t faidx_meta_seq_len_id(const faidx_meta_t *meta, int tid);
+
 /**
  * Check if a sequence exists in the index
  * 
@@ -199,10 +814,71 @@ const char *faidx_meta_parse_region(const faidx_meta_t *meta, const char *s,
 // Helper functions for internal use
 static char *kstrdup(const char *str);
 static int faidx_adjust_position(const faidx_meta_t *meta, int end_adjust,
-                              faidx1_t *val_out, const char *c_name,
+                              const faidx1_t **val_out, const char *c_name,
                               hts_pos_t *p_beg_i, hts_pos_t *p_end_i,
                               hts_pos_t *len);
 static int fai_name2id(void *v, const char *ref);
+static int faidx_meta_load_fai(faidx_meta_t *meta);
+static int faidx_meta_load_gzi(faidx_meta_t *meta);
+static hts_pos_t faidx_reader_retrieve(faidx_reader_t *reader, const faidx1_t *val,
+                                     uint64_t offset, hts_pos_t beg, hts_pos_t end,
+                                     int mode, kstring_t *out);
+
+/*
+ * Only the reader's own thread updates its counters, so a relaxed load and
+ * store replace a locked add while still giving faidx_meta_stats untorn
+ * values; timed work adds a monotonic clock read on either side.
+ * -DFAIGZ_NO_STATS compiles them out.
+ */
+#ifndef FAIGZ_NO_STATS
+#define FAIDX_STAT_ADD(r, field, v) \
+    __atomic_store_n(&(r)->stats.field, \
+                     __atomic_load_n(&(r)->stats.field, __ATOMIC_RELAXED) + (uint64_t)(v), \
+                     __ATOMIC_RELAXED)
+#else
+#define FAIDX_STAT_ADD(r, field, v) ((void)(r), (void)(v))
+#endif
+#define FAIDX_STAT_FETCH(r, n) (FAIDX_STAT_ADD(r, fetches, 1), FAIDX_STAT_ADD(r, bytes_out, n))
+
+/* Monotonic time in ns for the timing counters, 0 where unavailable or compiled out */
+static inline uint64_t faidx_stat_ns(void) {
+#if !defined(FAIGZ_NO_STATS) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Copies are often too short for two clock reads to be negligible, so one
+ * in FAIDX_STAT_SAMPLE is timed and counted that many times over.
+ */
+#define FAIDX_STAT_SAMPLE 64
+
+static inline uint64_t faidx_stat_copy_begin(faidx_reader_t *reader) {
+#ifndef FAIGZ_NO_STATS
+    if ((++reader->stat_tick & (FAIDX_STAT_SAMPLE - 1)) == 0) return faidx_stat_ns();
+#else
+    (void)reader;
+#endif
+    return 0;
+}
+
+static inline void faidx_stat_copy_end(faidx_reader_t *reader, uint64_t t0) {
+    if (t0) FAIDX_STAT_ADD(reader, copy_ns, (faidx_stat_ns() - t0) * FAIDX_STAT_SAMPLE);
+}
+
+/* Helper: Add the counters of src, each read atomically, to dst */
+static void faidx_stats_add(faidx_stats_t *dst, const faidx_stats_t *src) {
+    uint64_t *d = (uint64_t*)dst;
+    const uint64_t *s = (const uint64_t*)src;
+    
+    for (size_t i = 0; i < sizeof(faidx_stats_t) / sizeof(uint64_t); i++) {
+        d[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    }
+}
 
 // Implementation of helper functions
 
@@ -214,274 +890,2286 @@ static char *kstrdup(const char *str) {
     return s;
 }
 
+/* Helper: Id of a sequence name, or -1 */
+static int faidx_meta_find(const faidx_meta_t *meta, const char *name) {
+    if (!meta->slots) return -1;
+    return faidx_name_find(meta->slots, meta->slot_mask, meta->names, meta->name_off, name);
+}
+
 static int fai_name2id(void *v, const char *ref) {
-    faidx_meta_t *meta = (faidx_meta_t*)v;
-    khint_t k = kh_get(str, meta->hash, ref);
-    return k == kh_end(meta->hash) ? -1 : kh_val(meta->hash, k).id;
+    return faidx_meta_find((const faidx_meta_t*)v, ref);
 }
 
-/* Load metadata from a FASTA/FASTQ file */
-faidx_meta_t *faidx_meta_load(const char *filename, enum fai_format_options format, int flags) {
-    kstring_t fai_kstr = {0}, gzi_kstr = {0};
-    faidx_t *fai = NULL;
-    faidx_meta_t *meta = NULL;
-    FILE *fp = NULL;
-    int is_bgzf = 0;
-    
-    /* Handle NULL filename */
-    if (!filename) {
-        errno = EINVAL;
-        return NULL;
-    }
-    
-    /* Construct file paths */
-    if (ksprintf(&fai_kstr, "%s.fai", filename) < 0) goto fail;
-    if (ksprintf(&gzi_kstr, "%s.gzi", filename) < 0) goto fail;
+/* Read a whole (small) file into a NUL-terminated kstring */
+static int faidx_slurp(const char *path, kstring_t *ks) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
     
-    /* Check if file is BGZF compressed */
-    fp = fopen(filename, "rb");
-    if (fp) {
-        unsigned char magic[2];
-        if (fread(magic, 1, 2, fp) == 2) {
-            is_bgzf = (magic[0] == 0x1f && magic[1] == 0x8b);
+    ks->l = 0;
+    for (;;) {
+        if (ks_resize(ks, ks->l + 65536 + 1) < 0) {
+            fclose(fp);
+            return -1;
+        }
+        size_t got = fread(ks->s + ks->l, 1, ks->m - ks->l - 1, fp);
+        ks->l += got;
+        if (got == 0) break;
+    }
+    
+    int err = ferror(fp);
+    fclose(fp);
+    if (err) return -1;
+    ks->s[ks->l] = '\0';
+    return 0;
+}
+
+/* Parse one unsigned decimal .fai column; returns NULL if it is malformed */
+static char *faidx_parse_u64(char *p, uint64_t *out) {
+    uint64_t v = 0;
+    char *start = p;
+    while (*p >= '0' && *p <= '9') v = v * 10 + (uint64_t)(*p++ - '0');
+    if (p == start) return NULL;
+    *out = v;
+    return p;
+}
+
+/* Parse the text .fai into the shared record table */
+static int faidx_meta_load_fai(faidx_meta_t *meta) {
+    kstring_t text = {0, 0, NULL};
+    int ncols = meta->format == FAI_FASTQ ? 6 : 5;
+    char *p, *line_end, *arena;
+    size_t arena_len = 0;        // Names are compacted in place at the front of text
+    int n_rec = 0, i;            // Records parsed, duplicate names included
+    
+    if (faidx_slurp(meta->fai_path, &text) < 0) {
+        free(text.s);
+        return -1;
+    }
+    
+    for (p = text.s; p < text.s + text.l; p = line_end + 1) {
+        uint64_t col[5] = {0};
+        char *name = p, *q;
+        
+        line_end = strchr(p, '\n');
+        if (!line_end) line_end = text.s + text.l;
+        *line_end = '\0';
+        if (line_end > p && line_end[-1] == '\r') line_end[-1] = '\0';
+        if (*p == '\0') continue;
+        
+        q = strchr(p, '\t');
+        if (!q) goto fail;
+        *q++ = '\0';
+        size_t name_len = (size_t)(q - name);
+        
+        /* LENGTH OFFSET LINEBASES LINEWIDTH [QUALOFFSET] */
+        for (i = 0; i < ncols - 1; i++) {
+            q = faidx_parse_u64(q, &col[i]);
+            if (!q || (*q != '\t' && *q != '\0')) goto fail;
+            if (*q == '\t') q++;
+        }
+        
+        if (n_rec == meta->m) {
+            int new_m = meta->m ? meta->m * 2 : 1024;
+            uint64_t *new_off = (uint64_t*)realloc(meta->name_off, new_m * sizeof(uint64_t));
+            if (!new_off) goto fail;
+            meta->name_off = new_off;
+            faidx1_t *new_seq = (faidx1_t*)realloc(meta->seq, new_m * sizeof(faidx1_t));
+            if (!new_seq) goto fail;
+            meta->seq = new_seq;
+            meta->m = new_m;
+        }
+        
+        /* The line layout drives the seek math, so reject entries it can't describe */
+        if (col[2] > UINT32_MAX || col[3] > UINT32_MAX || col[3] < col[2]) goto fail;
+        if (col[0] > 0 && col[2] == 0) goto fail;
+        
+        faidx1_t *val = &meta->seq[n_rec];
+        val->len = col[0];
+        val->seq_offset = col[1];
+        val->line_blen = (uint32_t)col[2];
+        val->line_len = (uint32_t)col[3];
+        val->qual_offset = ncols == 6 ? col[4] : 0;
+        
+        /* The arena never overtakes the line being parsed */
+        memmove(text.s + arena_len, name, name_len);
+        meta->name_off[n_rec++] = arena_len;
+        arena_len += name_len;
+    }
+    
+    /* Keep only the names; shrinking can't fail in practice, but stay correct if it does */
+    arena = (char*)realloc(text.s, arena_len ? arena_len : 1);
+    meta->names = arena ? arena : text.s;
+    meta->names_len = arena_len;
+    text.s = NULL;
+    
+    /* Index the names once the arena no longer moves */
+    meta->slots = faidx_name_table_alloc((size_t)n_rec, &meta->slot_mask);
+    if (!meta->slots) return -1;
+    for (i = 0; i < n_rec; i++) {
+        const char *name = meta->names + meta->name_off[i];
+        
+        /* Duplicate name: keep the first entry, as htslib does */
+        if (!faidx_name_insert(meta->slots, meta->slot_mask, meta->names, meta->name_off,
+                               name, meta->n)) {
+            continue;
+        }
+        meta->seq[meta->n] = meta->seq[i];
+        meta->name_off[meta->n] = meta->name_off[i];
+        meta->n++;
+    }
+    
+    return 0;
+    
+fail:
+    free(text.s);
+    return -1;
+}
+
+static uint64_t faidx_le64(const unsigned char *b) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | b[i];
+    return v;
+}
+
+/* Load the .gzi block index; entry 0 is the implicit first block */
+static int faidx_meta_load_gzi(faidx_meta_t *meta) {
+    kstring_t data = {0, 0, NULL};
+    uint64_t n, i;
+    
+    if (faidx_slurp(meta->gzi_path, &data) < 0 || data.l < 8) goto fail;
+    
+    n = faidx_le64((unsigned char*)data.s);
+    if (n > (data.l - 8) / 16) goto fail;
+    
+    meta->gzi = (faidx_gzi_entry_t*)malloc((n + 1) * sizeof(faidx_gzi_entry_t));
+    if (!meta->gzi) goto fail;
+    
+    meta->gzi[0].caddr = 0;
+    meta->gzi[0].uaddr = 0;
+    for (i = 0; i < n; i++) {
+        const unsigned char *e = (unsigned char*)data.s + 8 + i * 16;
+        meta->gzi[i + 1].caddr = faidx_le64(e);
+        meta->gzi[i + 1].uaddr = faidx_le64(e + 8);
+    }
+    meta->n_gzi = (int64_t)n + 1;
+    
+    free(data.s);
+    return 0;
+    
+fail:
+    free(data.s);
+    return -1;
+}
+
+static int faidx_file_exists(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    fclose(fp);
+    return 1;
+}
+
+/* Bytes charged against the shared cache budget for one block */
+#define FAIDX_SHARED_BLOCK_BYTES (sizeof(faidx_shared_block_t) + BGZF_MAX_BLOCK_SIZE)
+
+static void faidx_shared_cache_destroy(faidx_shared_cache_t *cache);
+
+/* Create a shared cache, using enough shards for concurrency while keeping each one useful */
+static faidx_shared_cache_t *faidx_shared_cache_init(size_t max_bytes) {
+    faidx_shared_cache_t *cache = (faidx_shared_cache_t*)calloc(1, sizeof(faidx_shared_cache_t));
+    if (!cache) return NULL;
+    
+    int n = 1;
+    while (n < 64 && max_bytes / (2 * n) >= 16 * FAIDX_SHARED_BLOCK_BYTES) n *= 2;
+    
+    cache->shards = (faidx_cache_shard_t*)calloc(n, sizeof(faidx_cache_shard_t));
+    if (!cache->shards) {
+        free(cache);
+        return NULL;
+    }
+    
+    for (int i = 0; i < n; i++) {
+        faidx_cache_shard_t *sh = &cache->shards[i];
+        sh->max_bytes = max_bytes / n;
+        sh->map = kh_init(faigz_sblk);
+        if (!sh->map || pthread_mutex_init(&sh->lock, NULL) != 0) {
+            kh_destroy(faigz_sblk, sh->map);
+            faidx_shared_cache_destroy(cache);
+            return NULL;
+        }
+        if (pthread_cond_init(&sh->ready, NULL) != 0) {
+            pthread_mutex_destroy(&sh->lock);
+            kh_destroy(faigz_sblk, sh->map);
+            faidx_shared_cache_destroy(cache);
+            return NULL;
+        }
+        cache->n_shards = i + 1;
+    }
+    
+    return cache;
+}
+
+/* Drop one reference to a shared block */
+static void faidx_shared_block_release(faidx_shared_block_t *blk) {
+    if (__atomic_sub_fetch(&blk->refs, 1, __ATOMIC_ACQ_REL) == 0) free(blk);
+}
+
+static void faidx_shared_cache_destroy(faidx_shared_cache_t *cache) {
+    if (!cache) return;
+    
+    for (int i = 0; i < cache->n_shards; i++) {
+        faidx_cache_shard_t *sh = &cache->shards[i];
+        for (khint_t k = kh_begin(sh->map); k != kh_end(sh->map); k++) {
+            if (kh_exist(sh->map, k)) free(kh_val(sh->map, k));
+        }
+        kh_destroy(faigz_sblk, sh->map);
+        pthread_cond_destroy(&sh->ready);
+        pthread_mutex_destroy(&sh->lock);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+static faidx_cache_shard_t *faidx_shared_cache_shard(faidx_shared_cache_t *cache, int64_t caddr) {
+    uint64_t h = (uint64_t)caddr * 0x9E3779B97F4A7C15ULL;
+    return &cache->shards[(h >> 32) & (uint64_t)(cache->n_shards - 1)];
+}
+
+/* Helper: Unlink a block from its shard's LRU list (shard lock held) */
+static void faidx_shard_unlink(faidx_cache_shard_t *sh, faidx_shared_block_t *blk) {
+    if (blk->prev) blk->prev->next = blk->next;
+    else sh->head = blk->next;
+    if (blk->next) blk->next->prev = blk->prev;
+    else sh->tail = blk->prev;
+    blk->prev = blk->next = NULL;
+    blk->listed = 0;
+}
+
+static void faidx_shard_push_front(faidx_cache_shard_t *sh, faidx_shared_block_t *blk) {
+    blk->prev = NULL;
+    blk->next = sh->head;
+    if (sh->head) sh->head->prev = blk;
+    sh->head = blk;
+    if (!sh->tail) sh->tail = blk;
+    blk->listed = 1;
+}
+
+/* Helper: Remove a block from the shard and drop the cache's reference (shard lock held) */
+static void faidx_shard_evict(faidx_cache_shard_t *sh, faidx_shared_block_t *blk) {
+    khint_t k = kh_get(faigz_sblk, sh->map, blk->caddr);
+    if (k != kh_end(sh->map)) kh_del(faigz_sblk, sh->map, k);
+    if (blk->listed) {
+        faidx_shard_unlink(sh, blk);
+        sh->bytes -= FAIDX_SHARED_BLOCK_BYTES;
+    }
+    faidx_shared_block_release(blk);
+}
+
+/*
+ * Look up a block, returning it with a reference held for the caller.
+ * If it is absent an empty block is listed and returned with *fill set;
+ * the caller must then inflate it into blk->data and call
+ * faidx_shared_cache_done. Concurrent lookups of that block wait for it.
+ */
+static faidx_shared_block_t *faidx_shared_cache_get(faidx_shared_cache_t *cache,
+                                                  int64_t caddr, int *fill) {
+    faidx_cache_shard_t *sh = faidx_shared_cache_shard(cache, caddr);
+    faidx_shared_block_t *blk;
+    khint_t k;
+    int absent;
+    
+    *fill = 0;
+    if (sh->max_bytes < FAIDX_SHARED_BLOCK_BYTES) return NULL;
+    
+    pthread_mutex_lock(&sh->lock);
+    k = kh_get(faigz_sblk, sh->map, caddr);
+    if (k != kh_end(sh->map)) {
+        blk = kh_val(sh->map, k);
+        __atomic_add_fetch(&blk->refs, 1, __ATOMIC_RELAXED);
+        while (blk->len < 0 && !blk->failed) pthread_cond_wait(&sh->ready, &sh->lock);
+        if (blk->failed) {
+            pthread_mutex_unlock(&sh->lock);
+            faidx_shared_block_release(blk);
+            return NULL;
+        }
+        if (blk->listed) {
+            faidx_shard_unlink(sh, blk);
+            faidx_shard_push_front(sh, blk);
+        }
+        sh->hits++;
+        pthread_mutex_unlock(&sh->lock);
+        return blk;
+    }
+    
+    sh->misses++;
+    blk = (faidx_shared_block_t*)malloc(FAIDX_SHARED_BLOCK_BYTES);
+    if (!blk) {
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    blk->caddr = caddr;
+    blk->len = -1;
+    blk->failed = 0;
+    blk->listed = 0;
+    blk->refs = 2;
+    blk->prev = blk->next = NULL;
+    blk->data = (uint8_t*)(blk + 1);
+    
+    k = kh_put(faigz_sblk, sh->map, caddr, &absent);
+    if (absent < 0) {
+        pthread_mutex_unlock(&sh->lock);
+        free(blk);
+        return NULL;
+    }
+    kh_val(sh->map, k) = blk;
+    pthread_mutex_unlock(&sh->lock);
+    
+    *fill = 1;
+    return blk;
+}
+
+/* Publish a block the caller inflated (len >= 0) or withdraw it (len < 0) */
+static void faidx_shared_cache_done(faidx_shared_cache_t *cache, faidx_shared_block_t *blk, int len) {
+    faidx_cache_shard_t *sh = faidx_shared_cache_shard(cache, blk->caddr);
+    
+    pthread_mutex_lock(&sh->lock);
+    if (len < 0) {
+        blk->failed = 1;
+        faidx_shard_evict(sh, blk);
+    } else {
+        blk->len = len;
+        faidx_shard_push_front(sh, blk);
+        sh->bytes += FAIDX_SHARED_BLOCK_BYTES;
+        
+        /* Trim to budget; blocks still in use are freed by their last user */
+        while (sh->bytes > sh->max_bytes && sh->tail && sh->tail != blk) {
+            faidx_shard_evict(sh, sh->tail);
+        }
+    }
+    pthread_cond_broadcast(&sh->ready);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* Get shared block cache counters */
+void faidx_meta_cache_stats(const faidx_meta_t *meta, uint64_t *hits, uint64_t *misses) {
+    uint64_t h = 0, m = 0;
+    
+    if (meta && meta->shared_cache) {
+        for (int i = 0; i < meta->shared_cache->n_shards; i++) {
+            faidx_cache_shard_t *sh = &meta->shared_cache->shards[i];
+            pthread_mutex_lock(&sh->lock);
+            h += sh->hits;
+            m += sh->misses;
+            pthread_mutex_unlock(&sh->lock);
+        }
+    }
+    if (hits) *hits = h;
+    if (misses) *misses = m;
+}
+
+/* Helper: Remove a job from the pool queue (pool lock held) */
+static void faidx_tpool_unlink(faidx_tpool_t *pool, faidx_tpool_job_t *job) {
+    faidx_tpool_job_t **pp = &pool->head;
+    while (*pp && *pp != job) pp = &(*pp)->link;
+    if (*pp) *pp = job->link;
+}
+
+/* Helper: Run one iteration of job, then account for it (pool lock held on entry and exit) */
+static void faidx_tpool_step(faidx_tpool_t *pool, faidx_tpool_job_t *job) {
+    int i = job->next++;
+    if (job->next >= job->n) faidx_tpool_unlink(pool, job);
+    
+    pthread_mutex_unlock(&pool->lock);
+    job->fn(job->arg, i);
+    pthread_mutex_lock(&pool->lock);
+    
+    if (--job->pending == 0) pthread_cond_broadcast(&pool->done);
+}
+
+static void *faidx_tpool_worker(void *arg) {
+    faidx_tpool_t *pool = (faidx_tpool_t*)arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        if (!pool->head) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        faidx_tpool_step(pool, pool->head);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void faidx_tpool_destroy(faidx_tpool_t *pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->n_threads; i++) pthread_join(pool->threads[i], NULL);
+    
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+static faidx_tpool_t *faidx_tpool_init(int n_threads) {
+    faidx_tpool_t *pool = (faidx_tpool_t*)calloc(1, sizeof(faidx_tpool_t));
+    if (!pool) return NULL;
+    
+    pool->threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, faidx_tpool_worker, pool) != 0) {
+            faidx_tpool_destroy(pool);
+            return NULL;
+        }
+        pool->n_threads = i + 1;
+    }
+    
+    return pool;
+}
+
+/* Run fn(arg, i) for i in [0, n) on the pool; the calling thread helps and returns when all are done */
+static void faidx_tpool_run(faidx_tpool_t *pool, void (*fn)(void*, int), void *arg, int n) {
+    faidx_tpool_job_t job;
+    
+    if (n <= 0) return;
+    job.fn = fn;
+    job.arg = arg;
+    job.n = n;
+    job.next = 0;
+    job.pending = n;
+    job.link = NULL;
+    
+    pthread_mutex_lock(&pool->lock);
+    faidx_tpool_job_t **pp = &pool->head;
+    while (*pp) pp = &(*pp)->link;
+    *pp = &job;
+    pthread_cond_broadcast(&pool->work);
+    
+    while (job.next < job.n) faidx_tpool_step(pool, &job);
+    while (job.pending > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Set the number of inflate threads */
+int faidx_meta_set_threads(faidx_meta_t *meta, int n_threads) {
+    if (!meta || n_threads < 0) return -1;
+    
+    faidx_tpool_destroy(meta->pool);
+    meta->pool = NULL;
+    if (n_threads == 0 || !meta->is_bgzf) return 0;
+    
+    meta->pool = faidx_tpool_init(n_threads);
+    return meta->pool ? 0 : -1;
+}
+
+/* Helper: Path of the snapshot kept next to the .fai, or NULL */
+static char *faidx_meta_snapshot_path(const faidx_meta_t *meta) {
+    kstring_t path = {0, 0, NULL};
+    if (ksprintf(&path, "%s.bin", meta->fai_path) < 0) {
+        free(path.s);
+        return NULL;
+    }
+    return path.s;
+}
+
+/* Helper: Point the meta's indexes into a snapshot, dropping any parsed copies */
+static void faidx_meta_use_snapshot(faidx_meta_t *meta, const faidx_snapshot_t *snap) {
+    free(meta->names);
+    free(meta->name_off);
+    free(meta->seq);
+    free(meta->slots);
+    free(meta->gzi);
+    
+    /* Everything stays in the mapping; the pointers are only ever read through */
+    meta->snapshot = *snap;
+    meta->names = (char*)snap->names;
+    meta->names_len = (size_t)snap->hdr->names_len;
+    meta->name_off = (uint64_t*)snap->name_off;
+    meta->seq = (faidx1_t*)snap->seq;
+    meta->slots = (faidx_name_slot_t*)snap->slots;
+    meta->slot_mask = (uint32_t)snap->hdr->mask;
+    meta->n = meta->m = (int)snap->hdr->n;
+    meta->gzi = meta->is_bgzf ? (faidx_gzi_entry_t*)snap->gzi : NULL;
+    meta->n_gzi = meta->is_bgzf ? (int64_t)snap->hdr->n_gzi : 0;
+}
+
+/* Helper: Describe the parsed indexes for writing a snapshot */
+static void faidx_meta_snapshot_src(const faidx_meta_t *meta, faidx_snapshot_src_t *src) {
+    src->fai_path = meta->fai_path;
+    src->gzi_path = meta->is_bgzf ? meta->gzi_path : NULL;
+    src->format = (uint32_t)meta->format;
+    src->names = meta->names;
+    src->names_len = meta->names_len;
+    src->name_off = meta->name_off;
+    src->seq = meta->seq;
+    src->rec_size = sizeof(faidx1_t);
+    src->n = (uint64_t)meta->n;
+    src->slots = meta->slots;
+    src->mask = meta->slot_mask;
+    src->gzi = meta->gzi;
+    src->n_gzi = (uint64_t)meta->n_gzi;
+}
+
+/* Helper: Take the indexes from a current shared memory segment or .fai.bin instead of parsing them */
+static int faidx_meta_load_snapshot(faidx_meta_t *meta, int flags) {
+    const char *gzi_path = meta->is_bgzf ? meta->gzi_path : NULL;
+    faidx_snapshot_t snap;
+    char name[128];
+    
+    if ((flags & FAI_SHM) && faidx_shm_name(meta->fai_path, gzi_path, name, sizeof(name)) == 0) {
+        int ret = faidx_shm_attach(name, meta->fai_path, gzi_path, (uint32_t)meta->format,
+                                   sizeof(faidx1_t), &snap);
+        
+        /* Keep the name to create the segment only if there wasn't an unusable one */
+        if (ret == 0 || ret == FAIDX_SHM_ABSENT) meta->shm_name = kstrdup(name);
+        if (ret == 0) {
+            if (meta->shm_name) {
+                faidx_meta_use_snapshot(meta, &snap);
+                return 0;
+            }
+            faidx_shm_detach(name, &snap);
+        }
+    }
+    
+    if (flags & FAI_SNAPSHOT) {
+        char *path = faidx_meta_snapshot_path(meta);
+        if (!path) return -1;
+        int ret = faidx_snapshot_map(path, meta->fai_path, gzi_path, (uint32_t)meta->format,
+                                     sizeof(faidx1_t), &snap);
+        free(path);
+        if (ret == 0) {
+            free(meta->shm_name);
+            meta->shm_name = NULL;
+            faidx_meta_use_snapshot(meta, &snap);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Helper: Publish the parsed indexes for the next load (best effort) */
+static void faidx_meta_save_snapshot(faidx_meta_t *meta, int flags) {
+    faidx_snapshot_src_t src;
+    faidx_snapshot_t snap;
+    
+    faidx_meta_snapshot_src(meta, &src);
+    
+    /* Move into shared memory, or attach to the copy of whoever beat us to it */
+    if ((flags & FAI_SHM) && meta->shm_name) {
+        int ret = faidx_shm_create(meta->shm_name, &src, &snap);
+        if (ret < 0 && errno == EEXIST) {
+            ret = faidx_shm_attach(meta->shm_name, src.fai_path, src.gzi_path, src.format,
+                                   src.rec_size, &snap);
+            /* A stale half-built segment was in the way and has been removed */
+            if (ret == FAIDX_SHM_ABSENT) ret = faidx_shm_create(meta->shm_name, &src, &snap);
+        }
+        if (ret == 0) {
+            faidx_meta_use_snapshot(meta, &snap);
+            return;
+        }
+        free(meta->shm_name);
+        meta->shm_name = NULL;
+    }
+    
+    if (flags & FAI_SNAPSHOT) {
+        char *path = faidx_meta_snapshot_path(meta);
+        if (!path) return;
+        faidx_snapshot_write(path, &src);
+        free(path);
+    }
+}
+
+/* Helper: Write the packed companion file at path by streaming every sequence through a reader */
+static int faidx_meta_write_pack(faidx_meta_t *meta, const char *path) {
+    faidx_snapshot_src_t src;
+    faidx_pack_writer_t w;
+    faidx_reader_t *reader;
+    faidx_iter_t *iter = NULL;
+    const char *seq;
+    hts_pos_t n, pos;
+    int tid, ret = -1;
+    
+    reader = faidx_reader_create(meta);
+    if (!reader) return -1;
+    faidx_meta_snapshot_src(meta, &src);
+    if (faidx_pack_writer_open(&w, path, meta->fasta_path, &src) < 0) goto out;
+    
+    for (int i = 0; i < meta->n; i++) {
+        iter = faidx_reader_iter(reader, i, 0);
+        if (!iter) break;
+        while ((n = faidx_iter_next(iter, &tid, &pos, &seq)) > 0) {
+            if (faidx_pack_writer_add(&w, seq, (size_t)n) < 0) break;
+        }
+        faidx_iter_destroy(iter);
+        if (n != 0 || faidx_pack_writer_next(&w) < 0) break;
+    }
+    if (w.cur == w.hdr.n) ret = faidx_pack_writer_close(&w, path);
+    else faidx_pack_writer_abort(&w);
+    
+out:
+    faidx_reader_destroy(reader);
+    return ret;
+}
+
+/* Helper: Map a current companion file, writing one first if flags ask for it (best effort) */
+static void faidx_meta_load_pack(faidx_meta_t *meta, int flags) {
+    const char *gzi_path = meta->is_bgzf ? meta->gzi_path : NULL;
+    kstring_t path = {0, 0, NULL};
+    faidx_pack_t pk;
+    int ok = 0;
+    
+    if (meta->format != FAI_FASTA || ksprintf(&path, "%s.pk2", meta->fasta_path) < 0) {
+        free(path.s);
+        return;
+    }
+    
+    for (int attempt = 0; attempt < 2 && !ok; attempt++) {
+        if (attempt == 1 && (!(flags & FAI_PACK) || faidx_meta_write_pack(meta, path.s) < 0)) break;
+        if (faidx_pack_map(path.s, meta->fasta_path, meta->fai_path, gzi_path, (uint32_t)meta->format,
+                           sizeof(faidx1_t), &pk) < 0) {
+            continue;
+        }
+        
+        /* The embedded table was checked against the .fai; make sure it describes these records */
+        ok = 1;
+        for (int i = 0; ok && i < meta->n; i++) ok = pk.seqs[i].len == meta->seq[i].len;
+        if (!ok) faidx_pack_unmap(&pk);
+    }
+    if (ok) meta->pack = pk;
+    free(path.s);
+}
+
+/* Helper: Map an uncompressed file read-only, leaving meta->map NULL on failure */
+static void faidx_meta_map(faidx_meta_t *meta) {
+    struct stat st;
+    int fd = open(meta->fasta_path, O_RDONLY);
+    
+    if (fd < 0) return;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (uint64_t)st.st_size <= SIZE_MAX) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            meta->map = (const char*)p;
+            meta->map_size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+}
+
+/* fai_build3 under temporary names, renamed into place as faidx_build_index does */
+static int faidx_build_htslib(const char *fn, const char *fai_path, const char *gzi_path, int is_bgzf) {
+    char *fai_tmp = faidx_build_tmp_path(fai_path), *gzi_tmp = faidx_build_tmp_path(gzi_path);
+    int ret = -1;
+    
+    if (fai_tmp && gzi_tmp) {
+        ret = fai_build3(fn, fai_tmp, gzi_tmp) < 0 ? -1 : 0;
+        ret = faidx_build_commit(ret, fai_tmp, fai_path, is_bgzf ? gzi_tmp : NULL, gzi_path);
+    }
+    free(fai_tmp);
+    free(gzi_tmp);
+    return ret;
+}
+
+/* Load metadata from a FASTA/FASTQ file */
+faidx_meta_t *faidx_meta_load(const char *filename, enum fai_format_options format, int flags) {
+    return faidx_meta_load_cached(filename, format, flags, 0);
+}
+
+/* Load metadata with a shared block cache */
+faidx_meta_t *faidx_meta_load_cached(const char *filename, enum fai_format_options format,
+                                     int flags, size_t cache_bytes) {
+    kstring_t fai_kstr = {0}, gzi_kstr = {0};
+    faidx_meta_t *meta = NULL;
+    FILE *fp = NULL;
+    int is_bgzf = 0;
+    
+    /* Handle NULL filename */
+    if (!filename) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    /* Construct file paths */
+    if (ksprintf(&fai_kstr, "%s.fai", filename) < 0) goto fail;
+    if (ksprintf(&gzi_kstr, "%s.gzi", filename) < 0) goto fail;
+    
+    /* Check if file is BGZF compressed */
+    fp = fopen(filename, "rb");
+    if (!fp) goto fail;
+    unsigned char magic[2];
+    if (fread(magic, 1, 2, fp) == 2) {
+        is_bgzf = (magic[0] == 0x1f && magic[1] == 0x8b);
+    }
+    fclose(fp);
+    fp = NULL;
+    
+    /* Build the indexes if asked to and they are missing: FASTA in parallel, with
+       htslib kept for FASTQ and for whatever the parallel builder turns down */
+    if ((flags & FAI_CREATE) &&
+        (!faidx_file_exists(fai_kstr.s) || (is_bgzf && !faidx_file_exists(gzi_kstr.s)))) {
+        if ((format != FAI_FASTA ||
+             faidx_build_index(filename, fai_kstr.s, gzi_kstr.s, faidx_build_threads()) < 0) &&
+            faidx_build_htslib(filename, fai_kstr.s, gzi_kstr.s, is_bgzf) < 0) {
+            goto fail;
         }
-        fclose(fp);
-        fp = NULL;
     }
     
-    /* Load the FASTA/FASTQ index using fai_load3_format which handles either FASTA or FASTQ */
-    fai = fai_load3_format(filename, fai_kstr.s, gzi_kstr.s, flags, format);
-    if (!fai) goto fail;
-    
     /* Create the metadata structure */
     meta = (faidx_meta_t*)calloc(1, sizeof(faidx_meta_t));
     if (!meta) goto fail;
     
-    /* Initialize the mutex */
-    if (pthread_mutex_init(&meta->mutex, NULL) != 0) goto fail;
+    /* Initialize the mutex */
+    if (pthread_mutex_init(&meta->mutex, NULL) != 0) {
+        free(meta);
+        meta = NULL;
+        goto fail;
+    }
+    if (pthread_cond_init(&meta->reader_cond, NULL) != 0) {
+        pthread_mutex_destroy(&meta->mutex);
+        free(meta);
+        meta = NULL;
+        goto fail;
+    }
+    
+    meta->format = format;
+    meta->ref_count = 1;
+    meta->is_bgzf = is_bgzf;
+    meta->advise_fd = -1;
+    
+    /* Store file paths */
+    meta->fasta_path = kstrdup(filename);
+    meta->fai_path = kstrdup(fai_kstr.s);
+    meta->gzi_path = kstrdup(gzi_kstr.s);
+    if (!meta->fasta_path || !meta->fai_path || !meta->gzi_path) goto fail;
+    
+    /* Parse the record table and block index once; readers only reference them */
+    if (faidx_meta_load_snapshot(meta, flags) < 0) {
+        if (faidx_meta_load_fai(meta) < 0) goto fail;
+        if (is_bgzf && faidx_meta_load_gzi(meta) < 0) goto fail;
+        faidx_meta_save_snapshot(meta, flags);
+    }
+    
+    if (is_bgzf && cache_bytes > 0) {
+        meta->shared_cache = faidx_shared_cache_init(cache_bytes);
+        if (!meta->shared_cache) goto fail;
+    }
+    
+    /* Uncompressed files are served from one mapping; readers fall back to stdio if it fails */
+    if (!is_bgzf) faidx_meta_map(meta);
+#ifdef POSIX_FADV_WILLNEED
+    if (is_bgzf) meta->advise_fd = open(filename, O_RDONLY);
+#endif
+    faidx_meta_load_pack(meta, flags);
+    
+    /* Clean up */
+    free(fai_kstr.s);
+    free(gzi_kstr.s);
+    
+    return meta;
+    
+fail:
+    if (meta) faidx_meta_destroy(meta);
+    free(fai_kstr.s);
+    free(gzi_kstr.s);
+    return NULL;
+}
+
+/* Reference counting for metadata */
+faidx_meta_t *faidx_meta_ref(faidx_meta_t *meta) {
+    if (!meta) return NULL;
+    
+    /* A new reference is always taken through an existing one, so no ordering is needed */
+    __atomic_add_fetch(&meta->ref_count, 1, __ATOMIC_RELAXED);
+    
+    return meta;
+}
+
+/* Helper: Take a reader off the meta's live list, keeping its counters */
+static void faidx_meta_retire_reader(faidx_meta_t *meta, faidx_reader_t *reader) {
+    pthread_mutex_lock(&meta->mutex);
+    faidx_stats_add(&meta->retired, &reader->stats);
+    if (reader->live_prev) reader->live_prev->live_next = reader->live_next;
+    else if (meta->live == reader) meta->live = reader->live_next;
+    if (reader->live_next) reader->live_next->live_prev = reader->live_prev;
+    reader->live_prev = reader->live_next = NULL;
+    pthread_mutex_unlock(&meta->mutex);
+}
+
+/* Sum the counters of every reader */
+void faidx_meta_stats(faidx_meta_t *meta, faidx_stats_t *stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!meta) return;
+    
+    pthread_mutex_lock(&meta->mutex);
+    faidx_stats_add(stats, &meta->retired);
+    for (faidx_reader_t *r = meta->live; r; r = r->live_next) faidx_stats_add(stats, &r->stats);
+    pthread_mutex_unlock(&meta->mutex);
+}
+
+/* Helper: Close the idle pooled readers; they hold no reference to the meta */
+static void faidx_meta_drop_readers(faidx_meta_t *meta) {
+    for (int i = 0; i < meta->max_readers; i++) {
+        faidx_reader_t *r = meta->reader_slots[i];
+        if (!r) continue;
+        meta->reader_slots[i] = NULL;
+        faidx_meta_retire_reader(meta, r);
+        r->meta = NULL;
+        faidx_reader_destroy(r);
+    }
+    meta->n_readers = 0;
+}
+
+/* Destroy metadata */
+void faidx_meta_destroy(faidx_meta_t *meta) {
+    if (!meta) return;
+    
+    /*
+     * Release our uses of the meta; the thread dropping the last reference
+     * acquires everyone else's before tearing it down.
+     */
+    int should_free = __atomic_sub_fetch(&meta->ref_count, 1, __ATOMIC_ACQ_REL) <= 0;
+    
+    if (should_free) {
+        faidx_meta_drop_readers(meta);
+        free(meta->reader_slots);
+        
+        /* Names live in one arena, so this is a handful of frees however many sequences */
+        if (meta->snapshot.base && meta->shm_name) {
+            faidx_shm_detach(meta->shm_name, &meta->snapshot);
+        } else if (meta->snapshot.base) {
+            munmap(meta->snapshot.base, meta->snapshot.size);
+        } else {
+            free(meta->names);
+            free(meta->name_off);
+            free(meta->seq);
+            free(meta->slots);
+            free(meta->gzi);
+        }
+        
+        faidx_tpool_destroy(meta->pool);
+        faidx_shared_cache_destroy(meta->shared_cache);
+        if (meta->map) munmap((void*)meta->map, meta->map_size);
+        if (meta->advise_fd >= 0) close(meta->advise_fd);
+        faidx_pack_unmap(&meta->pack);
+        free(meta->shm_name);
+        free(meta->fasta_path);
+        free(meta->fai_path);
+        free(meta->gzi_path);
+        
+        pthread_cond_destroy(&meta->reader_cond);
+        pthread_mutex_destroy(&meta->mutex);
+        free(meta);
+    }
+}
+
+/* Create a reader */
+faidx_reader_t *faidx_reader_create(faidx_meta_t *meta) {
+    return faidx_reader_create_cached(meta, 0);
+}
+
+/* Create a reader with a block cache */
+faidx_reader_t *faidx_reader_create_cached(faidx_meta_t *meta, int cache_blocks) {
+    if (!meta || cache_blocks < 0) return NULL;
+    
+    faidx_reader_t *reader = (faidx_reader_t*)calloc(1, sizeof(faidx_reader_t));
+    if (!reader) return NULL;
+    
+    /* Reference the metadata */
+    reader->meta = faidx_meta_ref(meta);
+    reader->lru_head = reader->lru_tail = -1;
+    reader->blk_caddr = -1;
+    
+    /* Listed for faidx_meta_stats until destroyed */
+    pthread_mutex_lock(&meta->mutex);
+    reader->live_next = meta->live;
+    if (meta->live) meta->live->live_prev = reader;
+    meta->live = reader;
+    pthread_mutex_unlock(&meta->mutex);
+    
+    /* Only the file handle is per reader; the indexes and any mapping stay in the meta */
+    if (!meta->map) {
+        reader->bgzf = bgzf_open(meta->fasta_path, "r");
+        if (!reader->bgzf) goto fail;
+    }
+    
+    /* Block buffers are allocated as the cache fills */
+    if (cache_blocks > 0 && meta->is_bgzf) {
+        reader->cache = (faidx_cache_slot_t*)calloc(cache_blocks, sizeof(faidx_cache_slot_t));
+        reader->cache_map = kh_init(faigz_blk);
+        if (!reader->cache || !reader->cache_map) goto fail;
+        reader->cache_size = cache_blocks;
+    }
+    
+    return reader;
+    
+fail:
+    faidx_reader_destroy(reader);
+    return NULL;
+}
+
+/* Get block cache counters */
+void faidx_reader_cache_stats(const faidx_reader_t *reader, uint64_t *hits, uint64_t *misses) {
+    if (hits) *hits = reader ? reader->cache_hits : 0;
+    if (misses) *misses = reader ? reader->cache_misses : 0;
+}
+
+/* Get a reader's counters */
+void faidx_reader_stats(const faidx_reader_t *reader, faidx_stats_t *stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (reader) faidx_stats_add(stats, &reader->stats);
+}
+
+/* Destroy a reader */
+void faidx_reader_destroy(faidx_reader_t *reader) {
+    if (!reader) return;
+    
+    if (reader->meta) faidx_meta_retire_reader(reader->meta, reader);
+    
+    if (reader->bgzf) {
+        bgzf_close(reader->bgzf);
+    }
+    
+    if (reader->cache) {
+        for (int i = 0; i < reader->cache_used; i++) {
+            free(reader->cache[i].data);
+        }
+        free(reader->cache);
+    }
+    if (reader->cache_map) kh_destroy(faigz_blk, reader->cache_map);
+    
+    free(reader->buf.s);
+    free(reader->view.s);
+    free(reader->cbuf.s);
+    free(reader->edge);
+    free(reader->blk);
+    faidx_inflater_free(&reader->inflater);
+    faidx_meta_destroy(reader->meta);
+    free(reader);
+}
+
+/* Set up the reader pool */
+int faidx_meta_set_reader_pool(faidx_meta_t *meta, int max_readers, int cache_blocks) {
+    faidx_reader_t **slots = NULL;
+    int idle = 0;
+    
+    if (!meta || max_readers < 0 || cache_blocks < 0) return -1;
+    
+    /* Every reader the pool created must be back in a slot */
+    for (int i = 0; i < meta->max_readers; i++) idle += meta->reader_slots[i] != NULL;
+    if (idle != meta->n_readers) return -1;
+    
+    if (max_readers > 0) {
+        slots = (faidx_reader_t**)calloc(max_readers, sizeof(faidx_reader_t*));
+        if (!slots) return -1;
+    }
+    faidx_meta_drop_readers(meta);
+    free(meta->reader_slots);
+    meta->reader_slots = slots;
+    meta->max_readers = max_readers;
+    meta->reader_cache_blocks = cache_blocks;
+    return 0;
+}
+
+#if defined(__GNUC__)
+/* Slot this thread last took a reader from, so it tends to get the same one back */
+static __thread int faidx_reader_hint;
+#define FAIDX_READER_HINT faidx_reader_hint
+#else
+#define FAIDX_READER_HINT 0
+#endif
+
+/* Helper: Take any idle reader, starting from slot start; NULL if there is none */
+static faidx_reader_t *faidx_meta_take_reader(faidx_meta_t *meta, int start) {
+    for (int k = 0; k < meta->max_readers; k++) {
+        int i = (start + k) % meta->max_readers;
+        if (!__atomic_load_n(&meta->reader_slots[i], __ATOMIC_RELAXED)) continue;
+        
+        faidx_reader_t *r = __atomic_exchange_n(&meta->reader_slots[i], (faidx_reader_t*)NULL,
+                                                __ATOMIC_SEQ_CST);
+        if (r) {
+            r->pool_slot = i;
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/* Borrow a reader */
+faidx_reader_t *faidx_meta_acquire_reader(faidx_meta_t *meta) {
+    faidx_reader_t *r;
+    int start, n;
+    
+    if (!meta) return NULL;
+    if (meta->max_readers == 0) return faidx_reader_create(meta);
+    
+    start = FAIDX_READER_HINT;
+    if (start < 0 || start >= meta->max_readers) start = 0;
+    
+    r = faidx_meta_take_reader(meta, start);
+    
+    /* Open another reader while under the limit */
+    n = __atomic_load_n(&meta->n_readers, __ATOMIC_RELAXED);
+    while (!r && n < meta->max_readers) {
+        if (!__atomic_compare_exchange_n(&meta->n_readers, &n, n + 1, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        r = faidx_reader_create_cached(meta, meta->reader_cache_blocks);
+        if (!r) {
+            __atomic_sub_fetch(&meta->n_readers, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        r->pooled = 1;
+        r->pool_slot = start;
+        return r;
+    }
+    
+    /*
+     * All are out: wait for a release. Registering as a waiter before the
+     * final scan pairs with release storing the reader before checking for
+     * waiters, so either we see the reader or the releaser sees us.
+     */
+    if (!r) {
+        pthread_mutex_lock(&meta->mutex);
+        __atomic_add_fetch(&meta->n_waiting, 1, __ATOMIC_SEQ_CST);
+        while (!(r = faidx_meta_take_reader(meta, start))) {
+            pthread_cond_wait(&meta->reader_cond, &meta->mutex);
+        }
+        __atomic_sub_fetch(&meta->n_waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&meta->mutex);
+    }
+    
+    /* Idle readers hold no reference, so the meta can't be freed with them out */
+    faidx_meta_ref(meta);
+    return r;
+}
+
+/* Give a reader back */
+void faidx_meta_release_reader(faidx_meta_t *meta, faidx_reader_t *reader) {
+    if (!reader) return;
+    if (!meta || !reader->pooled || reader->meta != meta) {
+        faidx_reader_destroy(reader);
+        return;
+    }
+    
+    reader->seq_mode = FAIDX_SEQ_AS_IS;
+#if defined(__GNUC__)
+    faidx_reader_hint = reader->pool_slot;
+#endif
+    
+    /* A free slot always exists: there are as many as readers, and this one is out */
+    for (int k = 0; ; k++) {
+        int i = (reader->pool_slot + k) % meta->max_readers;
+        faidx_reader_t *expected = NULL;
+        if (__atomic_compare_exchange_n(&meta->reader_slots[i], &expected, reader, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (__atomic_load_n(&meta->n_waiting, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&meta->mutex);
+        pthread_cond_signal(&meta->reader_cond);
+        pthread_mutex_unlock(&meta->mutex);
+    }
+    
+    /* Drop the reference taken while it was out; the last one closes the idle readers */
+    faidx_meta_destroy(meta);
+}
+
+/* Helper: Clamp a region to the bounds of record val */
+static void faidx_clamp_position(const faidx1_t *val, int end_adjust,
+                                 hts_pos_t *p_beg_i, hts_pos_t *p_end_i) {
+    if (*p_end_i < *p_beg_i) *p_beg_i = *p_end_i;
+    
+    if (*p_beg_i < 0) *p_beg_i = 0;
+    else if ((hts_pos_t)val->len <= *p_beg_i) *p_beg_i = val->len;
+    
+    if (*p_end_i < 0) *p_end_i = 0;
+    else if ((hts_pos_t)val->len <= *p_end_i) *p_end_i = val->len - end_adjust;
+}
+
+/* Helper: Adjust position to sequence boundaries */
+static int faidx_adjust_position(const faidx_meta_t *meta, int end_adjust,
+                              const faidx1_t **val_out, const char *c_name,
+                              hts_pos_t *p_beg_i, hts_pos_t *p_end_i,
+                              hts_pos_t *len) {
+    const faidx1_t *val;
+    
+    /* Adjust position */
+    int id = faidx_meta_find(meta, c_name);
+    
+    if (id < 0) {
+        if (len) *len = -2;
+        return 1;
+    }
+    
+    val = &meta->seq[id];
+    
+    if (val_out) *val_out = val;
+    faidx_clamp_position(val, end_adjust, p_beg_i, p_end_i);
+    return 0;
+}
+
+/* Helper: Index of the .gzi block holding an uncompressed offset */
+static int64_t faidx_reader_find_block(faidx_reader_t *reader, uint64_t uoffset) {
+    const faidx_meta_t *meta = reader->meta;
+    
+    /* Nearby fetches usually land in the last block or the one after it */
+    int64_t lo = reader->gzi_hint, hi = meta->n_gzi - 1;
+    if (meta->gzi[lo].uaddr > uoffset) {
+        lo = 0;
+    } else if (lo + 1 <= hi && meta->gzi[lo + 1].uaddr <= uoffset) {
+        lo++;
+        if (lo + 1 <= hi && meta->gzi[lo + 1].uaddr <= uoffset) lo++;
+    }
+    if (lo + 1 <= hi && meta->gzi[lo + 1].uaddr > uoffset) hi = lo;
+    
+    /* Otherwise binary search the shared .gzi for the block holding uoffset */
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo + 1) / 2;
+        if (meta->gzi[mid].uaddr <= uoffset) lo = mid;
+        else hi = mid - 1;
+    }
+    
+    if (uoffset - meta->gzi[lo].uaddr >= BGZF_MAX_BLOCK_SIZE) return -1;
+    reader->gzi_hint = lo;
+    return lo;
+}
+
+/* Helper: Move a cache slot to the most recently used end of the LRU list */
+static void faidx_cache_touch(faidx_reader_t *reader, int slot) {
+    faidx_cache_slot_t *c = reader->cache;
+    
+    if (reader->lru_head == slot) return;
+    
+    /* Unlink */
+    if (c[slot].prev >= 0) c[c[slot].prev].next = c[slot].next;
+    if (c[slot].next >= 0) c[c[slot].next].prev = c[slot].prev;
+    if (reader->lru_tail == slot) reader->lru_tail = c[slot].prev;
+    
+    /* Push to the front */
+    c[slot].prev = -1;
+    c[slot].next = reader->lru_head;
+    if (reader->lru_head >= 0) c[reader->lru_head].prev = slot;
+    reader->lru_head = slot;
+    if (reader->lru_tail < 0) reader->lru_tail = slot;
+}
+
+/* Helper: Inflate the block at caddr into reader->blk, returning its length */
+static int faidx_reader_load_block(faidx_reader_t *reader, int64_t caddr) {
+    hFILE *hf = reader->bgzf->fp;
+    uint8_t *cdata;
+    size_t bsize;
+    uint64_t t0;
+    int n;
+    
+    /* Nothing to do if it already holds it */
+    if (reader->blk_caddr == caddr) {
+        FAIDX_STAT_ADD(reader, cache_hits, 1);
+        return reader->blk_len;
+    }
+    reader->blk_caddr = -1;
+    FAIDX_STAT_ADD(reader, cache_misses, 1);
+    
+    if (!reader->blk) {
+        reader->blk = (uint8_t*)malloc(BGZF_MAX_BLOCK_SIZE);
+        if (!reader->blk) return -1;
+    }
+    if (ks_resize(&reader->cbuf, FAIDX_BGZF_MAX) < 0) return -1;
+    cdata = (uint8_t*)reader->cbuf.s;
+    
+    /* The header gives the block's size; read the rest and decode it with the chosen backend */
+    t0 = faidx_stat_ns();
+    FAIDX_STAT_ADD(reader, seeks, 1);
+    if (hseek(hf, (off_t)caddr, SEEK_SET) < 0) return -1;
+    if (hread(hf, cdata, FAIDX_BGZF_HDR) != FAIDX_BGZF_HDR) return -1;
+    bsize = faidx_bgzf_block_size(cdata);
+    if (!bsize) return -1;
+    if (hread(hf, cdata + FAIDX_BGZF_HDR, bsize - FAIDX_BGZF_HDR) != (ssize_t)(bsize - FAIDX_BGZF_HDR)) {
+        return -1;
+    }
+    FAIDX_STAT_ADD(reader, bytes_read, bsize);
+    FAIDX_STAT_ADD(reader, io_ns, faidx_stat_ns() - t0);
+    
+    t0 = faidx_stat_ns();
+    n = faidx_bgzf_inflate(&reader->inflater, cdata, bsize, reader->blk, BGZF_MAX_BLOCK_SIZE);
+    FAIDX_STAT_ADD(reader, inflate_ns, faidx_stat_ns() - t0);
+    if (n <= 0) return -1;
+    FAIDX_STAT_ADD(reader, blocks_inflated, 1);
+    
+    reader->blk_len = n;
+    reader->blk_caddr = caddr;
+    return n;
+}
+
+/*
+ * Helper: Block at caddr via the meta's shared cache, inflating it there if needed.
+ * If *ref is set on return the data belongs to it and must be released after use.
+ */
+static const uint8_t *faidx_reader_shared_block(faidx_reader_t *reader, int64_t caddr,
+                                              int *len, faidx_shared_block_t **ref) {
+    faidx_shared_cache_t *cache = reader->meta->shared_cache;
+    faidx_shared_block_t *blk = NULL;
+    int fill = 0, n;
+    
+    *ref = NULL;
+    if (cache) blk = faidx_shared_cache_get(cache, caddr, &fill);
+    
+    if (!blk || fill) {
+        n = faidx_reader_load_block(reader, caddr);
+        if (blk) {
+            if (n >= 0) memcpy(blk->data, reader->blk, n);
+            faidx_shared_cache_done(cache, blk, n);
+            if (n < 0) {
+                faidx_shared_block_release(blk);
+                return NULL;
+            }
+        } else {
+            if (n < 0) return NULL;
+            *len = n;
+            return reader->blk;
+        }
+    }
+    
+    if (!fill) FAIDX_STAT_ADD(reader, cache_hits, 1);
+    *ref = blk;
+    *len = blk->len;
+    return blk->data;
+}
+
+/* Helper: Decompressed contents of the block at caddr, from the cache or inflated into it */
+static const uint8_t *faidx_reader_get_block(faidx_reader_t *reader, int64_t caddr, int *len) {
+    khint_t k = kh_get(faigz_blk, reader->cache_map, caddr);
+    faidx_shared_block_t *ref;
+    const uint8_t *src;
+    int slot, absent, n;
+    
+    if (k != kh_end(reader->cache_map)) {
+        slot = kh_val(reader->cache_map, k);
+        faidx_cache_touch(reader, slot);
+        reader->cache_hits++;
+        FAIDX_STAT_ADD(reader, cache_hits, 1);
+        *len = reader->cache[slot].len;
+        return reader->cache[slot].data;
+    }
+    reader->cache_misses++;
+    
+    src = faidx_reader_shared_block(reader, caddr, &n, &ref);
+    if (!src) return NULL;
+    
+    /* Take a fresh slot while there is room, otherwise evict the oldest */
+    if (reader->cache_used < reader->cache_size) {
+        slot = reader->cache_used;
+        reader->cache[slot].data = (uint8_t*)malloc(BGZF_MAX_BLOCK_SIZE);
+        if (!reader->cache[slot].data) goto fail;
+        reader->cache[slot].prev = reader->cache[slot].next = -1;
+        reader->cache_used++;
+    } else {
+        slot = reader->lru_tail;
+        k = kh_get(faigz_blk, reader->cache_map, reader->cache[slot].caddr);
+        if (k != kh_end(reader->cache_map)) kh_del(faigz_blk, reader->cache_map, k);
+    }
+    
+    k = kh_put(faigz_blk, reader->cache_map, caddr, &absent);
+    if (absent < 0) goto fail;
+    kh_val(reader->cache_map, k) = slot;
+    
+    memcpy(reader->cache[slot].data, src, n);
+    if (ref) faidx_shared_block_release(ref);
+    reader->cache[slot].caddr = caddr;
+    reader->cache[slot].len = n;
+    faidx_cache_touch(reader, slot);
+    
+    *len = reader->cache[slot].len;
+    return reader->cache[slot].data;
+    
+fail:
+    if (ref) faidx_shared_block_release(ref);
+    return NULL;
+}
+
+/* Fewest blocks worth handing to the thread pool, and most inflated per round */
+#define FAIDX_MT_MIN_BLOCKS 4
+#define FAIDX_MT_WINDOW_BLOCKS 256
+
+/* Helper: Inflate one whole BGZF block (header to footer) into dst, returning its length */
+static int faidx_inflate_block(const uint8_t *src, size_t slen, uint8_t *dst, size_t dlen) {
+    faidx_inflater_t inf;
+    int n;
+    
+    memset(&inf, 0, sizeof(inf));
+    n = faidx_bgzf_inflate(&inf, src, slen, dst, dlen);
+    faidx_inflater_free(&inf);
+    return n;
+}
+
+// A run of blocks inflated in parallel
+typedef struct {
+    const uint8_t *cdata;        // Compressed bytes starting at blk[0].caddr
+    const faidx_gzi_entry_t *blk; // n_blocks + 1 consecutive index entries
+    uint64_t ustart, uend;       // Uncompressed range wanted
+    char *dst;                   // Receives [ustart, uend)
+    uint8_t *edge;               // Scratch for the first and last block
+    int n_blocks;
+    int failed;
+} faidx_mt_window_t;
+
+static void faidx_mt_inflate(void *arg, int k) {
+    faidx_mt_window_t *w = (faidx_mt_window_t*)arg;
+    const faidx_gzi_entry_t *b = &w->blk[k];
+    const uint8_t *src = w->cdata + (b[0].caddr - w->blk[0].caddr);
+    size_t clen = b[1].caddr - b[0].caddr, ulen = b[1].uaddr - b[0].uaddr;
     
-    /* Get basic information from faidx */
-    meta->n = faidx_nseq(fai);
-    meta->m = meta->n;  /* We'll allocate exactly what we need */
-    meta->format = format;
-    meta->ref_count = 1;
-    meta->is_bgzf = is_bgzf;
+    if (b[0].uaddr >= w->ustart && b[1].uaddr <= w->uend) {
+        /* Wholly wanted: inflate in place */
+        uint8_t *out = (uint8_t*)w->dst + (b[0].uaddr - w->ustart);
+        if (faidx_inflate_block(src, clen, out, ulen) != (int)ulen) {
+            __atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
     
-    /* Copy sequence names */
-    meta->name = (char**)malloc(meta->m * sizeof(char*));
-    if (!meta->name) goto fail;
+    /* Partially wanted: inflate aside and copy the overlap */
+    uint8_t *tmp = w->edge + (k == 0 ? 0 : BGZF_MAX_BLOCK_SIZE);
+    if (faidx_inflate_block(src, clen, tmp, BGZF_MAX_BLOCK_SIZE) != (int)ulen) {
+        __atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint64_t from = b[0].uaddr > w->ustart ? b[0].uaddr : w->ustart;
+    uint64_t to = b[1].uaddr < w->uend ? b[1].uaddr : w->uend;
+    memcpy(w->dst + (from - w->ustart), tmp + (from - b[0].uaddr), to - from);
+}
+
+/*
+ * Helper: Read as much of a long span as the .gzi bounds allow using the meta's
+ * thread pool, advancing *uoffset, *span and *dst past what was read.
+ */
+static int faidx_reader_read_mt(faidx_reader_t *reader, uint64_t *uoffset, size_t *span, char **dst) {
+    const faidx_meta_t *meta = reader->meta;
+    BGZF *fp = reader->bgzf;
     
-    /* Create hash table */
-    meta->hash = kh_init(str);
-    if (!meta->hash) goto fail;
+    int64_t i0 = faidx_reader_find_block(reader, *uoffset);
+    int64_t i1 = faidx_reader_find_block(reader, *uoffset + *span - 1);
+    if (i0 < 0 || i1 < 0) return -1;
     
-    /* Populate names and hash table with sequence info */
-    for (int i = 0; i < meta->n; i++) {
-        const char *seq_name = faidx_iseq(fai, i);
-        meta->name[i] = kstrdup(seq_name);
-        if (!meta->name[i]) goto fail;
+    /* The block after the last one we inflate must be indexed so its size is known */
+    if (i1 > meta->n_gzi - 2) i1 = meta->n_gzi - 2;
+    if (i1 - i0 + 1 < FAIDX_MT_MIN_BLOCKS) return 0;
+    
+    if (!reader->edge) {
+        reader->edge = (uint8_t*)malloc(2 * BGZF_MAX_BLOCK_SIZE);
+        if (!reader->edge) return -1;
+    }
+    
+    uint64_t uend = *uoffset + *span;
+    for (int64_t a = i0; a <= i1; a += FAIDX_MT_WINDOW_BLOCKS) {
+        int64_t b = a + FAIDX_MT_WINDOW_BLOCKS - 1 < i1 ? a + FAIDX_MT_WINDOW_BLOCKS - 1 : i1;
+        size_t clen = meta->gzi[b + 1].caddr - meta->gzi[a].caddr;
+        faidx_mt_window_t w;
+        uint64_t t0 = faidx_stat_ns();
+        
+        /* One read for the window's compressed bytes */
+        if (ks_resize(&reader->cbuf, clen) < 0) return -1;
+        FAIDX_STAT_ADD(reader, seeks, 1);
+        if (hseek(fp->fp, (off_t)meta->gzi[a].caddr, SEEK_SET) < 0) return -1;
+        if (hread(fp->fp, reader->cbuf.s, clen) != (ssize_t)clen) return -1;
+        FAIDX_STAT_ADD(reader, bytes_read, clen);
+        FAIDX_STAT_ADD(reader, io_ns, faidx_stat_ns() - t0);
         
-        faidx1_t val;
-        val.id = i;
-        val.len = faidx_seq_len(fai, seq_name);
+        w.cdata = (const uint8_t*)reader->cbuf.s;
+        w.blk = &meta->gzi[a];
+        w.ustart = *uoffset;
+        w.uend = meta->gzi[b + 1].uaddr < uend ? meta->gzi[b + 1].uaddr : uend;
+        w.dst = *dst;
+        w.edge = reader->edge;
+        w.n_blocks = (int)(b - a + 1);
+        w.failed = 0;
         
-        /* Get line length - this information is not directly accessible from API 
-           Use reasonable defaults if needed */
-        val.line_len = 60 + 1;  /* Default line length + newline */
-        val.line_blen = 60;     /* Default bases per line */
+        t0 = faidx_stat_ns();
+        faidx_tpool_run(meta->pool, faidx_mt_inflate, &w, w.n_blocks);
+        FAIDX_STAT_ADD(reader, inflate_ns, faidx_stat_ns() - t0);
+        if (w.failed) return -1;
+        FAIDX_STAT_ADD(reader, blocks_inflated, w.n_blocks);
         
-        /* Estimated offsets - not accurate but we don't need them since we use faidx API */
-        val.seq_offset = 0;
-        val.qual_offset = 0;
+        size_t done = (size_t)(w.uend - w.ustart);
+        *uoffset += done;
+        *span -= done;
+        *dst += done;
+    }
+    
+    return 0;
+}
+
+/* Helper: Copy span uncompressed bytes starting at uoffset into dst */
+static int faidx_reader_read(faidx_reader_t *reader, uint64_t uoffset, size_t span, char *dst) {
+    const faidx_meta_t *meta = reader->meta;
+    
+    if (meta->map) {
+        if (uoffset > meta->map_size || span > meta->map_size - uoffset) return -1;
+        memcpy(dst, meta->map + uoffset, span);
+        return 0;
+    }
+    
+    /* Long reads skip the caches and inflate on the thread pool */
+    if (meta->pool && span > BGZF_MAX_BLOCK_SIZE) {
+        if (faidx_reader_read_mt(reader, &uoffset, &span, &dst) < 0) return -1;
+        if (span == 0) return 0;
+    }
+    
+    /* Uncompressed files that couldn't be mapped are read through htslib */
+    if (!meta->is_bgzf) {
+        uint64_t t0 = faidx_stat_ns();
+        FAIDX_STAT_ADD(reader, seeks, 1);
+        if (bgzf_useek(reader->bgzf, (off_t)uoffset, SEEK_SET) < 0) return -1;
+        if (bgzf_read(reader->bgzf, dst, span) != (ssize_t)span) return -1;
+        FAIDX_STAT_ADD(reader, bytes_read, span);
+        FAIDX_STAT_ADD(reader, io_ns, faidx_stat_ns() - t0);
+        return 0;
+    }
+    
+    /* Walk consecutive blocks, reusing any that are still cached */
+    int64_t i = faidx_reader_find_block(reader, uoffset);
+    if (i < 0) return -1;
+    size_t within = uoffset - meta->gzi[i].uaddr;
+    while (span > 0) {
+        faidx_shared_block_t *ref = NULL;
+        const uint8_t *data;
+        int len;
         
-        /* Build our own lookup table */
-        int absent;
-        khint_t k = kh_put(str, meta->hash, meta->name[i], &absent);
-        if (absent) {
-            kh_val(meta->hash, k) = val;
+        if (i >= meta->n_gzi) return -1;
+        if (reader->cache_size > 0) {
+            data = faidx_reader_get_block(reader, (int64_t)meta->gzi[i].caddr, &len);
+        } else {
+            data = faidx_reader_shared_block(reader, (int64_t)meta->gzi[i].caddr, &len, &ref);
         }
+        if (!data || within >= (size_t)len) {
+            if (ref) faidx_shared_block_release(ref);
+            return -1;
+        }
+        
+        size_t n = (size_t)len - within < span ? (size_t)len - within : span;
+        memcpy(dst, data + within, n);
+        if (ref) faidx_shared_block_release(ref);
+        dst += n;
+        span -= n;
+        within = 0;
+        i++;
     }
+    return 0;
+}
+
+/* Helper: Uncompressed file offset of pos within a record whose data starts at offset */
+static inline uint64_t faidx_pos_offset(const faidx1_t *val, uint64_t offset, hts_pos_t pos) {
+    return offset + (uint64_t)pos / val->line_blen * val->line_len + (uint64_t)pos % val->line_blen;
+}
+
+/* Helper: Copy n bases starting at base beg from src, the raw file bytes beginning at beg */
+static void faidx_copy_bases(char *dst, const char *src, hts_pos_t n, hts_pos_t beg,
+                             const faidx1_t *val, int mode) {
+    faidx_simd_copy_lines(dst, src, n, (uint64_t)beg, val->line_blen, val->line_len, mode);
+}
+
+/* Helper: Raw file bytes from base beg to base end - 1 of a record starting at offset */
+static const char *faidx_reader_raw(faidx_reader_t *reader, const faidx1_t *val,
+                                    uint64_t offset, hts_pos_t beg, hts_pos_t end) {
+    uint64_t first = faidx_pos_offset(val, offset, beg);
+    uint64_t last = faidx_pos_offset(val, offset, end - 1);
+    size_t span = (size_t)(last - first + 1);
     
-    /* Store file paths */
-    meta->fasta_path = kstrdup(filename);
-    meta->fai_path = kstrdup(fai_kstr.s);
-    meta->gzi_path = kstrdup(gzi_kstr.s);
-    if (!meta->fasta_path || !meta->fai_path || !meta->gzi_path) goto fail;
+    /* A mapped file is used in place; otherwise read the raw span first */
+    if (reader->meta->map) {
+        if (last >= reader->meta->map_size) return NULL;
+        return reader->meta->map + first;
+    }
+    if (ks_resize(&reader->buf, span) < 0) return NULL;
+    if (faidx_reader_read(reader, first, span, reader->buf.s) < 0) return NULL;
+    reader->buf.l = span;
+    return reader->buf.s;
+}
+
+/* Helper: Read [beg, end) of a record starting at offset into out, stripping line terminators */
+static hts_pos_t faidx_reader_retrieve(faidx_reader_t *reader, const faidx1_t *val,
+                                     uint64_t offset, hts_pos_t beg, hts_pos_t end,
+                                     int mode, kstring_t *out) {
+    hts_pos_t n = end - beg;
+    const char *src;
+    char *s;
     
-    /* Clean up */
-    free(fai_kstr.s);
-    free(gzi_kstr.s);
-    fai_destroy(fai);
+    if (val->line_blen == 0 || val->line_len < val->line_blen) return -1;
     
-    return meta;
+    /* Everything below is 64-bit; only refuse sizes the allocator can't represent */
+    if ((uint64_t)n >= SIZE_MAX - 2) return -1;
+    if (n < 0) n = 0;
     
-fail:
-    if (meta) {
-        if (meta->hash) kh_destroy(str, meta->hash);
-        if (meta->name) {
-            for (int i = 0; i < meta->n; i++) {
-                if (meta->name[i]) free(meta->name[i]);
-            }
-            free(meta->name);
+    if (ks_resize(out, (size_t)n + 1) < 0) return -1;
+    s = out->s;
+    out->l = 0;
+    s[0] = '\0';
+    if (n == 0) return 0;
+    
+    /* Sequence covered by the companion file is decoded from it directly */
+    if (reader->meta->pack.base && offset == val->seq_offset) {
+        uint64_t t0 = faidx_stat_copy_begin(reader);
+        faidx_pack_decode(&reader->meta->pack, (int)(val - reader->meta->seq), (uint64_t)beg,
+                          (size_t)n, s, mode);
+        faidx_stat_copy_end(reader, t0);
+    } else {
+        src = faidx_reader_raw(reader, val, offset, beg, end);
+        if (!src) return -1;
+        uint64_t t0 = faidx_stat_copy_begin(reader);
+        faidx_copy_bases(s, src, n, beg, val, mode);
+        faidx_stat_copy_end(reader, t0);
+    }
+    s[n] = '\0';
+    out->l = (size_t)n;
+    FAIDX_STAT_FETCH(reader, n);
+    return n;
+}
+
+/* Set the soft-mask transform for sequence fetches */
+int faidx_reader_set_seq_mode(faidx_reader_t *reader, enum faidx_seq_mode mode) {
+    if (!reader || (mode != FAIDX_SEQ_AS_IS && mode != FAIDX_SEQ_UPPER && mode != FAIDX_SEQ_MASK_N)) {
+        return -1;
+    }
+    reader->seq_mode = mode;
+    return 0;
+}
+
+/* Fetch sequence into a caller-owned buffer */
+hts_pos_t faidx_reader_fetch_seq_into(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    const faidx1_t *val;
+    hts_pos_t len = -1;
+    
+    if (!reader || !c_name || !out) return -1;
+    
+    /* Adjust position; this is the only name lookup on the fetch path */
+    if (faidx_adjust_position(reader->meta, 1, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+    
+    /* Read straight from our handle using the shared record table */
+    return faidx_reader_retrieve(reader, val, val->seq_offset, p_beg_i, p_end_i + 1,
+                                 reader->seq_mode, out);
+}
+
+/* Fetch sequence by id into a caller-owned buffer */
+hts_pos_t faidx_reader_fetch_seq_id_into(faidx_reader_t *reader, int tid,
+                                       hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    const faidx1_t *val;
+    
+    if (!reader || !out) return -1;
+    if (tid < 0 || tid >= reader->meta->n) return -2;
+    
+    /* No hashing: the id indexes the record table directly */
+    val = &reader->meta->seq[tid];
+    faidx_clamp_position(val, 1, &p_beg_i, &p_end_i);
+    return faidx_reader_retrieve(reader, val, val->seq_offset, p_beg_i, p_end_i + 1,
+                                 reader->seq_mode, out);
+}
+
+/* Fetch sequence as a view into the mapping, or into the reader's buffer */
+hts_pos_t faidx_reader_fetch_seq_view(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, const char **seq) {
+    const faidx_meta_t *meta;
+    const faidx1_t *val;
+    hts_pos_t len = -1;
+    
+    if (!reader || !c_name || !seq) return -1;
+    meta = reader->meta;
+    
+    if (faidx_adjust_position(meta, 1, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+    
+    /* Zero copy when no line terminator falls inside the region and nothing is transformed */
+    hts_pos_t n = p_end_i + 1 - p_beg_i;
+    if (meta->map && reader->seq_mode == FAIDX_SEQ_AS_IS && n > 0 && val->line_blen > 0 &&
+        (uint64_t)p_beg_i / val->line_blen == (uint64_t)(p_end_i) / val->line_blen) {
+        uint64_t first = faidx_pos_offset(val, val->seq_offset, p_beg_i);
+        if (first + (uint64_t)n > meta->map_size) return -1;
+        *seq = meta->map + first;
+        FAIDX_STAT_FETCH(reader, n);
+        return n;
+    }
+    
+    len = faidx_reader_retrieve(reader, val, val->seq_offset, p_beg_i, p_end_i + 1,
+                                reader->seq_mode, &reader->view);
+    if (len >= 0) *seq = reader->view.s;
+    return len;
+}
+
+/* Fetch sequence packed to 2 or 4 bits per base */
+hts_pos_t faidx_reader_fetch_packed(faidx_reader_t *reader, const char *c_name,
+                                  hts_pos_t p_beg_i, hts_pos_t p_end_i, int type,
+                                  kstring_t *out, kstring_t *mask) {
+    const faidx1_t *val;
+    const char *src;
+    hts_pos_t len = -1, n;
+    size_t bytes;
+    uint64_t t0;
+    
+    if (!reader || !c_name || !out) return -1;
+    if (type != FAIDX_PACK_2BIT && type != FAIDX_PACK_4BIT) return -1;
+    
+    if (faidx_adjust_position(reader->meta, 1, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+    if (val->line_blen == 0 || val->line_len < val->line_blen) return -1;
+    
+    n = p_end_i + 1 - p_beg_i;
+    if (n < 0) n = 0;
+    bytes = type == FAIDX_PACK_2BIT ? ((size_t)n + 3) / 4 : ((size_t)n + 1) / 2;
+    if (ks_resize(out, bytes + 1) < 0) return -1;
+    if (mask && ks_resize(mask, ((size_t)n + 7) / 8 + 1) < 0) return -1;
+    out->l = 0;
+    if (mask) mask->l = 0;
+    if (n == 0) return 0;
+    
+    /* 2-bit codes come straight from the companion file; 4-bit ones are packed from its bases */
+    if (reader->meta->pack.base && type == FAIDX_PACK_2BIT) {
+        t0 = faidx_stat_copy_begin(reader);
+        faidx_pack_codes(&reader->meta->pack, (int)(val - reader->meta->seq), (uint64_t)p_beg_i,
+                         (size_t)n, (uint8_t*)out->s, mask ? (uint8_t*)mask->s : NULL,
+                         reader->seq_mode);
+    } else if (reader->meta->pack.base) {
+        char tile[FAIDX_PACK_TILE];
+        t0 = faidx_stat_copy_begin(reader);
+        for (hts_pos_t i = 0; i < n; i += FAIDX_PACK_TILE) {
+            size_t k = n - i < FAIDX_PACK_TILE ? (size_t)(n - i) : FAIDX_PACK_TILE;
+            faidx_pack_decode(&reader->meta->pack, (int)(val - reader->meta->seq),
+                              (uint64_t)(p_beg_i + i), k, tile, FAIDX_SEQ_AS_IS);
+            faidx_simd_pack((uint8_t*)out->s + i / 2, mask ? (uint8_t*)mask->s + i / 8 : NULL,
+                            tile, k, type, reader->seq_mode);
         }
-        free(meta->fasta_path);
-        free(meta->fai_path);
-        free(meta->gzi_path);
-        pthread_mutex_destroy(&meta->mutex);
-        free(meta);
+    } else {
+        /* Strip and pack in one pass over the raw bytes */
+        src = faidx_reader_raw(reader, val, val->seq_offset, p_beg_i, p_end_i + 1);
+        if (!src) return -1;
+        t0 = faidx_stat_copy_begin(reader);
+        faidx_simd_pack_lines((uint8_t*)out->s, mask ? (uint8_t*)mask->s : NULL, src, n,
+                              (uint64_t)p_beg_i, val->line_blen, val->line_len, type,
+                              reader->seq_mode);
     }
-    free(fai_kstr.s);
-    free(gzi_kstr.s);
-    if (fai) fai_destroy(fai);
-    return NULL;
+    faidx_stat_copy_end(reader, t0);
+    out->l = bytes;
+    if (mask) mask->l = ((size_t)n + 7) / 8;
+    FAIDX_STAT_FETCH(reader, bytes);
+    return n;
 }
 
-/* Reference counting for metadata */
-faidx_meta_t *faidx_meta_ref(faidx_meta_t *meta) {
-    if (!meta) return NULL;
+/* Fetch quality string into a caller-owned buffer */
+hts_pos_t faidx_reader_fetch_qual_into(faidx_reader_t *reader, const char *c_name,
+                                     hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    const faidx1_t *val;
+    hts_pos_t len = -1;
     
-    pthread_mutex_lock(&meta->mutex);
-    meta->ref_count++;
-    pthread_mutex_unlock(&meta->mutex);
+    if (!reader || !c_name || !out) return -1;
+    if (reader->meta->format != FAI_FASTQ) return -2;
     
-    return meta;
+    /* Adjust position */
+    if (faidx_adjust_position(reader->meta, 1, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+    
+    /* Quality lines share the sequence's line layout */
+    return faidx_reader_retrieve(reader, val, val->qual_offset, p_beg_i, p_end_i + 1,
+                                 FAIDX_SEQ_AS_IS, out);
 }
 
-/* Destroy metadata */
-void faidx_meta_destroy(faidx_meta_t *meta) {
-    if (!meta) return;
+/* Largest merged read in a batch */
+#define FAIDX_BATCH_MAX_SPAN (16 << 20)
+
+// One region of a batch, in file order
+typedef struct {
+    uint64_t first, last;        // File offsets of its first and last base
+    hts_pos_t beg, n;            // First base and length
+    const faidx1_t *val;
+    size_t idx;                  // Position in the caller's array
+} faidx_batch_item_t;
+
+static int faidx_batch_cmp(const void *a, const void *b) {
+    const faidx_batch_item_t *x = (const faidx_batch_item_t*)a, *y = (const faidx_batch_item_t*)b;
+    if (x->first != y->first) return x->first < y->first ? -1 : 1;
+    return x->idx < y->idx ? -1 : (x->idx > y->idx);
+}
+
+/* Fetch many regions, reading each stretch of the file once */
+int64_t faidx_reader_fetch_batch(faidx_reader_t *reader, const faidx_region_t *regions,
+                                 size_t n, kstring_t *out, hts_pos_t *lens) {
+    faidx_batch_item_t *items;
+    size_t n_items = 0, i, j;
+    int64_t n_ok = 0;
     
-    pthread_mutex_lock(&meta->mutex);
-    meta->ref_count--;
-    int should_free = (meta->ref_count <= 0);
-    pthread_mutex_unlock(&meta->mutex);
+    if (!reader || (n && (!regions || !out))) return -1;
+    if (n == 0) return 0;
     
-    if (should_free) {
-        /* Free all resources */
-        if (meta->hash) {
-            kh_destroy(str, meta->hash);
+    items = (faidx_batch_item_t*)malloc(n * sizeof(faidx_batch_item_t));
+    if (!items) return -1;
+    
+    /* Resolve names and clamp coordinates up front */
+    for (i = 0; i < n; i++) {
+        const faidx1_t *val;
+        hts_pos_t beg = regions[i].beg, end = regions[i].end, res = -1;
+        
+        out[i].l = 0;
+        if (!regions[i].name ||
+            faidx_adjust_position(reader->meta, 1, &val, regions[i].name, &beg, &end, &res)) {
+            if (lens) lens[i] = regions[i].name ? res : -1;
+            continue;
         }
         
-        if (meta->name) {
-            for (int i = 0; i < meta->n; i++) {
-                free(meta->name[i]);
-            }
-            free(meta->name);
+        hts_pos_t len = end + 1 - beg;
+        if (len < 0) len = 0;
+        if (val->line_blen == 0 || (uint64_t)len >= SIZE_MAX - 2 ||
+            ks_resize(&out[i], (size_t)len + 1) < 0) {
+            if (lens) lens[i] = -1;
+            continue;
         }
+        out[i].s[0] = '\0';
         
-        free(meta->fasta_path);
-        free(meta->fai_path);
-        free(meta->gzi_path);
+        if (len == 0) {
+            if (lens) lens[i] = 0;
+            n_ok++;
+            continue;
+        }
         
-        pthread_mutex_destroy(&meta->mutex);
-        free(meta);
+        items[n_items].first = faidx_pos_offset(val, val->seq_offset, beg);
+        items[n_items].last = faidx_pos_offset(val, val->seq_offset, beg + len - 1);
+        items[n_items].beg = beg;
+        items[n_items].n = len;
+        items[n_items].val = val;
+        items[n_items].idx = i;
+        n_items++;
+    }
+    
+    qsort(items, n_items, sizeof(faidx_batch_item_t), faidx_batch_cmp);
+    
+    /* Merge overlapping and adjacent spans, read each group once and scatter it */
+    for (i = 0; i < n_items; i = j) {
+        uint64_t g_first = items[i].first, g_last = items[i].last;
+        
+        for (j = i + 1; j < n_items; j++) {
+            if (items[j].first > g_last + 1) break;
+            uint64_t last = items[j].last > g_last ? items[j].last : g_last;
+            if (last - g_first + 1 > FAIDX_BATCH_MAX_SPAN) break;
+            g_last = last;
+        }
+        
+        /* The companion file needs no reading, just decoding */
+        const faidx_pack_t *pk = reader->meta->pack.base ? &reader->meta->pack : NULL;
+        size_t span = (size_t)(g_last - g_first + 1);
+        int ok = pk || (ks_resize(&reader->buf, span) == 0 &&
+                        faidx_reader_read(reader, g_first, span, reader->buf.s) == 0);
+        if (ok && !pk) reader->buf.l = span;
+        
+        uint64_t t0 = faidx_stat_copy_begin(reader);
+        for (size_t k = i; k < j; k++) {
+            faidx_batch_item_t *it = &items[k];
+            kstring_t *o = &out[it->idx];
+            
+            if (!ok) {
+                if (lens) lens[it->idx] = -1;
+                continue;
+            }
+            if (pk) {
+                faidx_pack_decode(pk, (int)(it->val - reader->meta->seq), (uint64_t)it->beg,
+                                  (size_t)it->n, o->s, reader->seq_mode);
+            } else {
+                faidx_copy_bases(o->s, reader->buf.s + (it->first - g_first), it->n, it->beg,
+                                 it->val, reader->seq_mode);
+            }
+            o->s[it->n] = '\0';
+            o->l = (size_t)it->n;
+            if (lens) lens[it->idx] = it->n;
+            FAIDX_STAT_FETCH(reader, it->n);
+            n_ok++;
+        }
+        faidx_stat_copy_end(reader, t0);
     }
+    
+    free(items);
+    return n_ok;
 }
 
-/* Create a reader */
-faidx_reader_t *faidx_reader_create(faidx_meta_t *meta) {
-    if (!meta) return NULL;
-    
-    faidx_reader_t *reader = (faidx_reader_t*)calloc(1, sizeof(faidx_reader_t));
-    if (!reader) return NULL;
+/* Stride of the bytes touched to fault in a mapping without posix_madvise */
+#define FAIDX_PREFETCH_PAGE 4096
+
+static int faidx_span_cmp(const void *a, const void *b) {
+    const faidx_span_t *x = (const faidx_span_t*)a, *y = (const faidx_span_t*)b;
+    return x->first < y->first ? -1 : (x->first > y->first);
+}
+
+/* Helper: File ranges holding the bases of regions, sorted and merged; returns how many or -1 */
+static int64_t faidx_meta_spans(const faidx_meta_t *meta, const faidx_region_t *regions,
+                                size_t n, faidx_span_t **out) {
+    faidx_span_t *spans;
+    size_t m = 0, k = 0, i;
     
-    /* Reference the metadata */
-    reader->meta = faidx_meta_ref(meta);
+    *out = NULL;
+    if (n == 0) return 0;
+    spans = (faidx_span_t*)malloc(n * sizeof(faidx_span_t));
+    if (!spans) return -1;
     
-    /* Open the file using fai_load3_format which handles BGZF automatically */
-    reader->fai = fai_load3_format(meta->fasta_path, meta->fai_path, meta->gzi_path, 0, meta->format);
+    for (i = 0; i < n; i++) {
+        const faidx1_t *val;
+        hts_pos_t beg = regions[i].beg, end = regions[i].end, res;
+        
+        if (!regions[i].name ||
+            faidx_adjust_position(meta, 1, &val, regions[i].name, &beg, &end, &res)) {
+            continue;
+        }
+        if (end < beg || val->line_blen == 0) continue;
+        spans[m].first = faidx_pos_offset(val, val->seq_offset, beg);
+        spans[m].last = faidx_pos_offset(val, val->seq_offset, end);
+        m++;
+    }
     
-    if (!reader->fai) {
-        faidx_meta_destroy(reader->meta);
-        free(reader);
-        return NULL;
+    qsort(spans, m, sizeof(faidx_span_t), faidx_span_cmp);
+    for (i = 0; i < m; i++) {
+        if (k > 0 && spans[i].first <= spans[k - 1].last + 1) {
+            if (spans[i].last > spans[k - 1].last) spans[k - 1].last = spans[i].last;
+        } else {
+            spans[k++] = spans[i];
+        }
     }
     
-    return reader;
+    if (k == 0) {
+        free(spans);
+        return 0;
+    }
+    *out = spans;
+    return (int64_t)k;
 }
 
-/* Destroy a reader */
-void faidx_reader_destroy(faidx_reader_t *reader) {
-    if (!reader) return;
+/* Helper: Warm block i of the .gzi where later reads of it will look */
+static int faidx_reader_warm_block(faidx_reader_t *reader, int64_t i) {
+    const faidx_meta_t *meta = reader->meta;
+    int64_t caddr = (int64_t)meta->gzi[i].caddr;
+    int len;
     
-    if (reader->fai) {
-        fai_destroy(reader->fai);
+    if (reader->cache_size > 0) return faidx_reader_get_block(reader, caddr, &len) ? 0 : -1;
+    if (meta->shared_cache) {
+        faidx_shared_block_t *ref;
+        const uint8_t *data = faidx_reader_shared_block(reader, caddr, &len, &ref);
+        if (ref) faidx_shared_block_release(ref);
+        return data ? 0 : -1;
     }
     
-    faidx_meta_destroy(reader->meta);
-    free(reader);
+    /* With no cache to hold it and no readahead hint, reading the compressed
+       bytes leaves them in the page cache */
+    hFILE *hf = reader->bgzf->fp;
+    uint8_t *cdata;
+    size_t bsize;
+    
+    uint64_t t0 = faidx_stat_ns();
+    if (ks_resize(&reader->cbuf, FAIDX_BGZF_MAX) < 0) return -1;
+    cdata = (uint8_t*)reader->cbuf.s;
+    FAIDX_STAT_ADD(reader, seeks, 1);
+    if (hseek(hf, (off_t)caddr, SEEK_SET) < 0) return -1;
+    if (hread(hf, cdata, FAIDX_BGZF_HDR) != FAIDX_BGZF_HDR) return -1;
+    bsize = faidx_bgzf_block_size(cdata);
+    if (!bsize) return -1;
+    if (hread(hf, cdata + FAIDX_BGZF_HDR, bsize - FAIDX_BGZF_HDR) != (ssize_t)(bsize - FAIDX_BGZF_HDR)) {
+        return -1;
+    }
+    FAIDX_STAT_ADD(reader, bytes_read, bsize);
+    FAIDX_STAT_ADD(reader, io_ns, faidx_stat_ns() - t0);
+    return 0;
 }
 
-/* Helper: Adjust position to sequence boundaries */
-static int faidx_adjust_position(const faidx_meta_t *meta, int end_adjust,
-                              faidx1_t *val_out, const char *c_name,
-                              hts_pos_t *p_beg_i, hts_pos_t *p_end_i,
-                              hts_pos_t *len) {
-    khiter_t iter;
-    faidx1_t *val;
+/* Helper: Ask the kernel to read blocks i0..i1 of the .gzi ahead; 0 if the hint was given */
+static int faidx_meta_advise(const faidx_meta_t *meta, int64_t i0, int64_t i1) {
+#ifdef POSIX_FADV_WILLNEED
+    uint64_t off = meta->gzi[i0].caddr;
+    uint64_t len = i1 + 1 < meta->n_gzi ? meta->gzi[i1 + 1].caddr - off : 0; // 0 runs to the end
     
-    /* Adjust position */
-    iter = kh_get(str, meta->hash, c_name);
-    
-    if (iter == kh_end(meta->hash)) {
-        if (len) *len = -2;
-        return 1;
-    }
+    if (meta->advise_fd < 0) return -1;
+    return posix_fadvise(meta->advise_fd, (off_t)off, (off_t)len, POSIX_FADV_WILLNEED) == 0 ? 0 : -1;
+#else
+    (void)meta;
+    (void)i0;
+    (void)i1;
+    return -1;
+#endif
+}
+
+/* Helper: Warm the blocks or pages of sorted, disjoint spans, returning the blocks warmed */
+static int64_t faidx_reader_warm(faidx_reader_t *reader, const faidx_span_t *spans, size_t n) {
+    const faidx_meta_t *meta = reader->meta;
+    int64_t last = -1, n_warm = 0, limit = -1;
     
-    val = &kh_val(meta->hash, iter);
+    /* The companion file is decoded straight from its mapping */
+    if (meta->pack.base) return 0;
     
-    if (val_out) *val_out = *val;
+    /* A mapping faults in a page at a time; ask for the pages now, or touch each one */
+    if (meta->map) {
+#ifdef POSIX_MADV_WILLNEED
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        if (page == 0 || (page & (page - 1))) page = FAIDX_PREFETCH_PAGE;
+        for (size_t s = 0; s < n; s++) {
+            if (spans[s].first >= meta->map_size) continue;
+            uint64_t first = spans[s].first & ~(page - 1);
+            uint64_t last = spans[s].last < meta->map_size ? spans[s].last : meta->map_size - 1;
+            posix_madvise((void*)(meta->map + first), (size_t)(last + 1 - first), POSIX_MADV_WILLNEED);
+        }
+#else
+        volatile char sink = 0;
+        for (size_t s = 0; s < n; s++) {
+            for (uint64_t off = spans[s].first; off <= spans[s].last && off < meta->map_size;
+                 off += FAIDX_PREFETCH_PAGE) {
+                sink ^= meta->map[off];
+            }
+        }
+        (void)sink;
+#endif
+        return 0;
+    }
+    if (!meta->is_bgzf) return 0;
     
-    if (*p_end_i < *p_beg_i) *p_beg_i = *p_end_i;
+    /* Blocks past what the caches hold would only evict the nearer ones */
+    int cached = reader->cache_size > 0 || meta->shared_cache != NULL;
+    if (meta->shared_cache) {
+        size_t bytes = 0;
+        for (int i = 0; i < meta->shared_cache->n_shards; i++) {
+            bytes += meta->shared_cache->shards[i].max_bytes;
+        }
+        limit = (int64_t)(bytes / FAIDX_SHARED_BLOCK_BYTES);
+    }
+    if (reader->cache_size > 0 && reader->cache_size > limit) limit = reader->cache_size;
     
-    if (*p_beg_i < 0) *p_beg_i = 0;
-    else if ((hts_pos_t)val->len <= *p_beg_i) *p_beg_i = val->len;
+    for (size_t s = 0; s < n; s++) {
+        int64_t i0 = faidx_reader_find_block(reader, spans[s].first);
+        int64_t i1 = faidx_reader_find_block(reader, spans[s].last);
+        if (i0 < 0 || i1 < 0) return -1;
+        
+        /* Neighbouring spans can share a block */
+        if (i0 <= last) i0 = last + 1;
+        if (i0 > i1) continue;
+        if (limit >= 0 && n_warm >= limit) return n_warm;
+        int64_t end = limit >= 0 && i1 - i0 >= limit - n_warm ? i0 + (limit - n_warm) - 1 : i1;
+        
+        /* The hint alone warms the page cache; blocks are inflated only to fill a cache */
+        int hinted = faidx_meta_advise(meta, i0, end) == 0;
+        if (!hinted || cached) {
+            for (int64_t i = i0; i <= end; i++) {
+                if (faidx_reader_warm_block(reader, i) < 0) return -1;
+            }
+        }
+        n_warm += end - i0 + 1;
+        last = i1;
+    }
+    return n_warm;
+}
+
+/* Warm regions ahead of their fetches */
+int64_t faidx_reader_prefetch(faidx_reader_t *reader, const faidx_region_t *regions, size_t n) {
+    faidx_span_t *spans;
+    int64_t n_spans, n_warm;
     
-    if (*p_end_i < 0) *p_end_i = 0;
-    else if ((hts_pos_t)val->len <= *p_end_i) *p_end_i = val->len - end_adjust;
+    if (!reader || (n && !regions)) return -1;
     
-    return 0;
+    n_spans = faidx_meta_spans(reader->meta, regions, n, &spans);
+    if (n_spans <= 0) return n_spans;
+    n_warm = faidx_reader_warm(reader, spans, (size_t)n_spans);
+    free(spans);
+    return n_warm;
 }
 
 /* Fetch sequence */
 char *faidx_reader_fetch_seq(faidx_reader_t *reader, const char *c_name,
                           hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
-    faidx1_t val;
-    int len_int = 0;
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_seq_into(reader, c_name, p_beg_i, p_end_i, &ks);
     
-    /* Adjust position */
-    if (faidx_adjust_position(reader->meta, 1, &val, c_name, &p_beg_i, &p_end_i, len)) {
+    if (len) *len = n;
+    if (n < 0) {
+        free(ks.s);
         return NULL;
     }
+    return ks.s;
+}
+
+/* Fetch sequence by id */
+char *faidx_reader_fetch_seq_id(faidx_reader_t *reader, int tid,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_seq_id_into(reader, tid, p_beg_i, p_end_i, &ks);
     
-    /* Use the standard faidx API to fetch the sequence */
-    char *result = faidx_fetch_seq(reader->fai, c_name, (int)p_beg_i, (int)p_end_i, &len_int);
-    
-    if (len) *len = len_int;
-    return result;
+    if (len) *len = n;
+    if (n < 0) {
+        free(ks.s);
+        return NULL;
+    }
+    return ks.s;
 }
 
 /* Fetch quality string */
 char *faidx_reader_fetch_qual(faidx_reader_t *reader, const char *c_name,
                             hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
-    faidx1_t val;
-    int len_int = 0;
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_qual_into(reader, c_name, p_beg_i, p_end_i, &ks);
     
-    if (reader->meta->format != FAI_FASTQ) {
-        if (len) *len = -2;
+    if (len) *len = n;
+    if (n < 0) {
+        free(ks.s);
         return NULL;
     }
+    return ks.s;
+}
+
+/* Create a sequential iterator */
+faidx_iter_t *faidx_reader_iter(faidx_reader_t *reader, int tid, hts_pos_t chunk) {
+    if (!reader || chunk < 0 || tid < -1 || tid >= reader->meta->n) return NULL;
     
-    /* Adjust position */
-    if (faidx_adjust_position(reader->meta, 1, &val, c_name, &p_beg_i, &p_end_i, len)) {
+    faidx_iter_t *iter = (faidx_iter_t*)calloc(1, sizeof(faidx_iter_t));
+    if (!iter) return NULL;
+    
+    iter->reader = reader;
+    iter->tid = tid < 0 ? 0 : tid;
+    iter->end_tid = tid < 0 ? reader->meta->n : tid + 1;
+    iter->chunk = chunk ? chunk : FAIDX_ITER_CHUNK;
+    return iter;
+}
+
+/* Next chunk of a sequential iterator */
+hts_pos_t faidx_iter_next(faidx_iter_t *iter, int *tid, hts_pos_t *pos, const char **seq) {
+    const faidx1_t *val;
+    hts_pos_t beg, end, n;
+    
+    if (!iter) return -1;
+    
+    /* Move on past finished and empty sequences */
+    while (iter->tid < iter->end_tid &&
+           (uint64_t)iter->pos >= iter->reader->meta->seq[iter->tid].len) {
+        iter->tid++;
+        iter->pos = 0;
+    }
+    if (iter->tid >= iter->end_tid) return 0;
+    
+    /*
+     * Consecutive chunks read adjacent spans, so the block they share is
+     * still in the reader and the file is only ever read forwards.
+     */
+    val = &iter->reader->meta->seq[iter->tid];
+    beg = iter->pos;
+    end = val->len - (uint64_t)beg > (uint64_t)iter->chunk ? beg + iter->chunk : (hts_pos_t)val->len;
+    n = faidx_reader_retrieve(iter->reader, val, val->seq_offset, beg, end,
+                              iter->reader->seq_mode, &iter->out);
+    if (n < 0) return -1;
+    
+    iter->pos = end;
+    if (tid) *tid = iter->tid;
+    if (pos) *pos = beg;
+    if (seq) *seq = iter->out.s;
+    return n;
+}
+
+/* Destroy a sequential iterator */
+void faidx_iter_destroy(faidx_iter_t *iter) {
+    if (!iter) return;
+    free(iter->out.s);
+    free(iter);
+}
+
+/* Worker of an asynchronous queue: fetch with its own reader until shut down and drained */
+static void *faidx_async_worker(void *arg) {
+    faidx_async_t *q = (faidx_async_t*)arg;
+    faidx_reader_t *reader = faidx_reader_create(q->meta);
+    
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        faidx_async_req_t *req = q->head;
+        if (!req) {
+            if (q->shutdown) break;
+            pthread_cond_wait(&q->work, &q->lock);
+            continue;
+        }
+        q->head = req->next;
+        if (!q->head) q->tail = NULL;
+        pthread_mutex_unlock(&q->lock);
+        
+        /* Prefetches have no result to deliver */
+        if (req->spans) {
+            if (reader) faidx_reader_warm(reader, req->spans, req->n_spans);
+            free(req->spans);
+            free(req);
+            pthread_mutex_lock(&q->lock);
+            continue;
+        }
+        
+        /* A reader that failed to open fails its fetches rather than the queue */
+        if (req->tid < 0) {
+            req->res.len = -2;
+        } else {
+            req->res.seq = faidx_reader_fetch_seq_id(reader, req->tid, req->beg, req->end,
+                                                     &req->res.len);
+            if (!reader) req->res.len = -1;
+        }
+        if (req->cb) {
+            req->cb(&req->res);
+            free(req);
+            req = NULL;
+        }
+        
+        pthread_mutex_lock(&q->lock);
+        if (req) {
+            req->next = NULL;
+            if (q->done_tail) q->done_tail->next = req;
+            else q->done_head = req;
+            q->done_tail = req;
+            pthread_cond_broadcast(&q->done);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    
+    faidx_reader_destroy(reader);
+    return NULL;
+}
+
+/* Create an asynchronous fetch queue */
+faidx_async_t *faidx_async_create(faidx_meta_t *meta, int n_threads) {
+    if (!meta || n_threads < 1) return NULL;
+    
+    faidx_async_t *q = (faidx_async_t*)calloc(1, sizeof(faidx_async_t));
+    if (!q) return NULL;
+    q->threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (!q->threads || pthread_mutex_init(&q->lock, NULL) != 0) {
+        free(q->threads);
+        free(q);
         return NULL;
     }
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->done, NULL);
+    q->meta = faidx_meta_ref(meta);
+    
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&q->threads[i], NULL, faidx_async_worker, q) != 0) {
+            faidx_async_destroy(q);
+            return NULL;
+        }
+        q->n_threads = i + 1;
+    }
+    return q;
+}
+
+/* Queue a region */
+int64_t faidx_async_submit(faidx_async_t *q, const char *c_name, hts_pos_t p_beg_i,
+                           hts_pos_t p_end_i, faidx_async_cb cb, void *arg) {
+    faidx_async_req_t *req;
+    uint64_t id;
+    
+    if (!q || !c_name) return -1;
+    req = (faidx_async_req_t*)calloc(1, sizeof(faidx_async_req_t));
+    if (!req) return -1;
+    
+    req->tid = faidx_meta_find(q->meta, c_name);
+    req->beg = p_beg_i;
+    req->end = p_end_i;
+    req->cb = cb;
+    req->res.arg = arg;
+    
+    pthread_mutex_lock(&q->lock);
+    id = req->res.id = q->next_id++;
+    if (!cb) q->n_polled++;
+    if (q->tail) q->tail->next = req;
+    else q->head = req;
+    q->tail = req;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    
+    return (int64_t)id;
+}
+
+/* Queue a background prefetch */
+int faidx_async_prefetch(faidx_async_t *q, const faidx_region_t *regions, size_t n) {
+    faidx_async_req_t *req;
+    int64_t n_spans;
+    
+    if (!q || (n && !regions)) return -1;
+    req = (faidx_async_req_t*)calloc(1, sizeof(faidx_async_req_t));
+    if (!req) return -1;
+    
+    n_spans = faidx_meta_spans(q->meta, regions, n, &req->spans);
+    if (n_spans <= 0) {
+        free(req);
+        return n_spans < 0 ? -1 : 0;
+    }
+    req->n_spans = (size_t)n_spans;
+    
+    pthread_mutex_lock(&q->lock);
+    if (q->tail) q->tail->next = req;
+    else q->head = req;
+    q->tail = req;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/* Reap completed fetches */
+int faidx_async_poll(faidx_async_t *q, faidx_async_result_t *res, int max, int wait) {
+    int n = 0;
+    
+    if (!q || !res || max <= 0) return 0;
+    
+    pthread_mutex_lock(&q->lock);
+    while (wait && !q->done_head && q->n_polled > 0) pthread_cond_wait(&q->done, &q->lock);
+    while (n < max && q->done_head) {
+        faidx_async_req_t *req = q->done_head;
+        q->done_head = req->next;
+        if (!q->done_head) q->done_tail = NULL;
+        q->n_polled--;
+        res[n++] = req->res;
+        free(req);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+/* Finish outstanding fetches and destroy the queue */
+void faidx_async_destroy(faidx_async_t *q) {
+    if (!q) return;
     
-    /* Use the standard faidx API to fetch the quality */
-    char *result = faidx_fetch_qual(reader->fai, c_name, (int)p_beg_i, (int)p_end_i, &len_int);
+    pthread_mutex_lock(&q->lock);
+    q->shutdown = 1;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    for (int i = 0; i < q->n_threads; i++) pthread_join(q->threads[i], NULL);
     
-    if (len) *len = len_int;
-    return result;
+    /* Nothing is left queued once the workers are gone; drop what was never polled */
+    while (q->done_head) {
+        faidx_async_req_t *req = q->done_head;
+        q->done_head = req->next;
+        free(req->res.seq);
+        free(req);
+    }
+    
+    pthread_cond_destroy(&q->work);
+    pthread_cond_destroy(&q->done);
+    pthread_mutex_destroy(&q->lock);
+    free(q->threads);
+    faidx_meta_destroy(q->meta);
+    free(q);
 }
 
 /* Get number of sequences */
@@ -491,25 +3179,30 @@ int faidx_meta_nseq(const faidx_meta_t *meta) {
 
 /* Get sequence name */
 const char *faidx_meta_iseq(const faidx_meta_t *meta, int i) {
-    return (meta && i >= 0 && i < meta->n) ? meta->name[i] : NULL;
+    return (meta && i >= 0 && i < meta->n) ? meta->names + meta->name_off[i] : NULL;
 }
 
 /* Get sequence length */
 hts_pos_t faidx_meta_seq_len(const faidx_meta_t *meta, const char *seq) {
     if (!meta || !seq) return -1;
     
-    khint_t k = kh_get(str, meta->hash, seq);
-    if (k == kh_end(meta->hash)) return -1;
+    int id = faidx_meta_find(meta, seq);
+    if (id < 0) return -1;
     
-    return kh_val(meta->hash, k).len;
+    return meta->seq[id].len;
+}
+
+/* Get sequence length by id */
+hts_pos_t faidx_meta_seq_len_id(const faidx_meta_t *meta, int tid) {
+    if (!meta || tid < 0 || tid >= meta->n) return -1;
+    return meta->seq[tid].len;
 }
 
 /* Check if sequence exists */
 int faidx_meta_has_seq(const faidx_meta_t *meta, const char *seq) {
     if (!meta || !seq) return 0;
     
-    khint_t k = kh_get(str, meta->hash, seq);
-    return (k != kh_end(meta->hash));
+    return faidx_meta_find(meta, seq) >= 0;
 }
 
 /* Parse a region string */
@@ -0,0 +1,295 @@
+#ifndef FAIGZ_HPP
+#define FAIGZ_HPP
+
+/*
+ * C++17 wrapper over faigz.h. Meta shares one faidx_meta_t by reference
+ * count, Reader owns a faidx_reader_t and its fetch buffer, and both free
+ * themselves. Fetches return std::string_view into the reader's buffer (or
+ * into the file mapping for Reader::view), valid until the next fetch on
+ * the same reader, so repeated fetches allocate nothing. parallel_fetch
+ * spreads a list of regions over threads, each with its own reader.
+ *
+ * Define REENTRANT_FAIDX_IMPLEMENTATION in exactly one translation unit
+ * before including this header, as for faigz.h.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "faigz.h"
+
+namespace faigz {
+
+// A region to fetch: 0-based, end inclusive as for faidx_reader_fetch_seq
+struct Region {
+    std::string name;
+    hts_pos_t beg = 0, end = 0;
+};
+
+// Shared index metadata; copies share the same faidx_meta_t
+class Meta {
+public:
+    Meta() noexcept = default;
+
+    /**
+     * Load the index of a FASTA/FASTQ file
+     *
+     * @param path FASTA/FASTQ file
+     * @param flags FAI_* flags for faidx_meta_load
+     * @param format FAI_FASTA or FAI_FASTQ
+     * @param cache_bytes Shared block cache budget, 0 for none
+     * @throws std::runtime_error if the index can't be loaded
+     */
+    explicit Meta(const std::string &path, int flags = FAI_CREATE,
+                  enum fai_format_options format = FAI_FASTA, size_t cache_bytes = 0)
+        : meta_(faidx_meta_load_cached(path.c_str(), format, flags, cache_bytes)) {
+        if (!meta_) throw std::runtime_error("faigz: failed to load the index of " + path);
+    }
+
+    Meta(const Meta &o) noexcept : meta_(o.meta_ ? faidx_meta_ref(o.meta_) : nullptr) {}
+    Meta(Meta &&o) noexcept : meta_(std::exchange(o.meta_, nullptr)) {}
+    Meta &operator=(Meta o) noexcept {
+        std::swap(meta_, o.meta_);
+        return *this;
+    }
+    ~Meta() {
+        if (meta_) faidx_meta_destroy(meta_);
+    }
+
+    faidx_meta_t *get() const noexcept { return meta_; }
+    explicit operator bool() const noexcept { return meta_ != nullptr; }
+
+    int size() const noexcept { return faidx_meta_nseq(meta_); }
+    const char *name(int tid) const noexcept { return faidx_meta_iseq(meta_, tid); }
+    hts_pos_t length(int tid) const noexcept { return faidx_meta_seq_len_id(meta_, tid); }
+    hts_pos_t length(const std::string &name) const noexcept {
+        return faidx_meta_seq_len(meta_, name.c_str());
+    }
+    bool contains(const std::string &name) const noexcept {
+        return faidx_meta_has_seq(meta_, name.c_str()) != 0;
+    }
+
+    /* Parse "name:beg-end" (1-based, inclusive) into a Region; nullopt if it doesn't parse */
+    std::optional<Region> parse(const std::string &s) const {
+        int tid;
+        hts_pos_t beg, end;
+        if (!faidx_meta_parse_region(meta_, s.c_str(), &tid, &beg, &end, 0)) return std::nullopt;
+        // A bare name (end HTS_POS_MAX) covers the whole sequence
+        hts_pos_t len = length(tid);
+        if (end > len) end = len;
+        return Region{name(tid), beg, end - 1};
+    }
+
+    /* Inflate long fetches on n_threads shared threads; false on failure */
+    bool set_threads(int n_threads) noexcept { return faidx_meta_set_threads(meta_, n_threads) == 0; }
+
+    faidx_stats_t stats() const noexcept {
+        faidx_stats_t s;
+        faidx_meta_stats(meta_, &s);
+        return s;
+    }
+
+private:
+    faidx_meta_t *meta_ = nullptr;
+};
+
+// A reader for one thread at a time; movable, not copyable
+class Reader {
+public:
+    Reader() noexcept = default;
+
+    /**
+     * Create a reader on shared metadata
+     *
+     * @param meta Metadata; the reader keeps its own reference
+     * @param cache_blocks Decompressed BGZF blocks to keep, 0 for none
+     * @throws std::runtime_error if the reader can't be created
+     */
+    explicit Reader(const Meta &meta, int cache_blocks = 0)
+        : reader_(faidx_reader_create_cached(meta.get(), cache_blocks)) {
+        if (!reader_) throw std::runtime_error("faigz: failed to create a reader");
+    }
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    Reader(Reader &&o) noexcept : reader_(std::exchange(o.reader_, nullptr)), buf_(o.buf_) {
+        o.buf_ = kstring_t{0, 0, nullptr};
+    }
+    Reader &operator=(Reader &&o) noexcept {
+        std::swap(reader_, o.reader_);
+        std::swap(buf_, o.buf_);
+        return *this;
+    }
+    ~Reader() {
+        if (reader_) faidx_reader_destroy(reader_);
+        free(buf_.s);
+    }
+
+    faidx_reader_t *get() const noexcept { return reader_; }
+    explicit operator bool() const noexcept { return reader_ != nullptr; }
+
+    bool set_seq_mode(enum faidx_seq_mode mode) noexcept {
+        return faidx_reader_set_seq_mode(reader_, mode) == 0;
+    }
+
+    /**
+     * Fetch bases [beg, end] into the reader's buffer
+     *
+     * @return The bases, valid until the next fetch on this reader, or
+     *         nullopt if the region can't be fetched
+     */
+    std::optional<std::string_view> fetch(const std::string &name, hts_pos_t beg, hts_pos_t end) {
+        return result(faidx_reader_fetch_seq_into(reader_, name.c_str(), beg, end, &buf_));
+    }
+    std::optional<std::string_view> fetch(int tid, hts_pos_t beg, hts_pos_t end) {
+        return result(faidx_reader_fetch_seq_id_into(reader_, tid, beg, end, &buf_));
+    }
+    std::optional<std::string_view> fetch(const Region &r) { return fetch(r.name, r.beg, r.end); }
+
+    /* Qualities of a FASTQ record, as for fetch */
+    std::optional<std::string_view> qual(const std::string &name, hts_pos_t beg, hts_pos_t end) {
+        return result(faidx_reader_fetch_qual_into(reader_, name.c_str(), beg, end, &buf_));
+    }
+
+    /**
+     * Fetch without copying where possible: single-line regions of mapped
+     * uncompressed files point into the mapping and stay valid as long as
+     * the metadata; anything else is valid until the next fetch.
+     */
+    std::optional<std::string_view> view(const std::string &name, hts_pos_t beg, hts_pos_t end) {
+        const char *seq;
+        hts_pos_t n = faidx_reader_fetch_seq_view(reader_, name.c_str(), beg, end, &seq);
+        if (n < 0) return std::nullopt;
+        return std::string_view(seq, (size_t)n);
+    }
+
+    /**
+     * Fetch into a caller's string, reusing its capacity
+     *
+     * Filled from view, so a single-line region of a mapped file is copied
+     * once, straight from the mapping; other regions are decoded into the
+     * reader's view buffer first.
+     *
+     * @return The length, -1 on error or -2 if the sequence is absent
+     */
+    hts_pos_t fetch_into(std::string &out, const std::string &name, hts_pos_t beg, hts_pos_t end) {
+        const char *seq = nullptr;
+        hts_pos_t n = faidx_reader_fetch_seq_view(reader_, name.c_str(), beg, end, &seq);
+        if (n >= 0) out.assign(seq ? seq : "", (size_t)n);
+        else out.clear();
+        return n;
+    }
+
+    faidx_stats_t stats() const noexcept {
+        faidx_stats_t s;
+        faidx_reader_stats(reader_, &s);
+        return s;
+    }
+
+private:
+    std::optional<std::string_view> result(hts_pos_t n) const {
+        if (n < 0) return std::nullopt;
+        return std::string_view(buf_.s ? buf_.s : "", (size_t)n);
+    }
+
+    faidx_reader_t *reader_ = nullptr;
+    kstring_t buf_ = {0, 0, nullptr};
+};
+
+/**
+ * Fetch regions on n_threads threads, each with its own reader
+ *
+ * Regions are handed out in runs of batch, and each run is fetched with
+ * faidx_reader_fetch_batch, so nearby regions share their reads. cb is
+ * called on the worker threads, in no particular order, as
+ * cb(index, bases, len) with len -1 on error or -2 for an absent sequence
+ * (and empty bases); the bases are only valid during the call. An
+ * exception from cb stops the workers and is rethrown here.
+ *
+ * @param meta Metadata
+ * @param regions Regions to fetch
+ * @param n_threads Threads to use, 0 for one per CPU
+ * @param cb Callback for each region
+ * @param cache_blocks Decompressed BGZF blocks each reader keeps
+ * @param batch Regions per batch
+ * @return Number of regions fetched successfully
+ */
+template <typename Callback>
+size_t parallel_fetch(const Meta &meta, const std::vector<Region> &regions, int n_threads,
+                      Callback &&cb, int cache_blocks = 0, size_t batch = 256) {
+    if (n_threads <= 0) n_threads = (int)std::thread::hardware_concurrency();
+    if (n_threads <= 0) n_threads = 1;
+    if (batch == 0) batch = 1;
+    if ((size_t)n_threads > (regions.size() + batch - 1) / batch) {
+        n_threads = (int)((regions.size() + batch - 1) / batch);
+    }
+    if (n_threads == 0) return 0;
+
+    std::atomic<size_t> next(0), n_ok(0);
+    std::atomic<bool> stop(false);
+    std::exception_ptr error;
+    std::mutex error_lock;
+
+    auto work = [&]() {
+        std::vector<faidx_region_t> regs(batch);
+        std::vector<kstring_t> out(batch, kstring_t{0, 0, nullptr});
+        std::vector<hts_pos_t> lens(batch);
+        try {
+            Reader reader(meta, cache_blocks);
+            while (!stop.load(std::memory_order_relaxed)) {
+                size_t first = next.fetch_add(batch, std::memory_order_relaxed);
+                if (first >= regions.size()) break;
+                size_t n = std::min(batch, regions.size() - first);
+
+                for (size_t i = 0; i < n; i++) {
+                    const Region &r = regions[first + i];
+                    regs[i] = faidx_region_t{r.name.c_str(), r.beg, r.end};
+                }
+                if (faidx_reader_fetch_batch(reader.get(), regs.data(), n, out.data(), lens.data()) < 0) {
+                    for (size_t i = 0; i < n; i++) lens[i] = -1;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    if (lens[i] >= 0) {
+                        n_ok.fetch_add(1, std::memory_order_relaxed);
+                        cb(first + i, std::string_view(out[i].s ? out[i].s : "", (size_t)lens[i]), lens[i]);
+                    } else {
+                        cb(first + i, std::string_view(), lens[i]);
+                    }
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> g(error_lock);
+            if (!error) error = std::current_exception();
+            stop.store(true, std::memory_order_relaxed);
+        }
+        for (auto &ks : out) free(ks.s);
+    };
+
+    std::vector<std::thread> threads;
+    try {
+        for (int t = 1; t < n_threads; t++) threads.emplace_back(work);
+    } catch (...) {
+        stop.store(true);
+        for (auto &t : threads) t.join();
+        throw;
+    }
+    work();
+    for (auto &t : threads) t.join();
+
+    if (error) std::rethrow_exception(error);
+    return n_ok.load();
+}
+
+} // namespace faigz
+
+#endif /* FAIGZ_HPP */
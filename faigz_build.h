@@ -0,0 +1,582 @@
+#ifndef FAIGZ_BUILD_H
+#define FAIGZ_BUILD_H
+
+/*
+ * Parallel .fai/.gzi builder for FASTA, shared by faigz.h and
+ * faigz_minimal.c. The input is read in chunks of whole BGZF blocks (or
+ * plain byte ranges), and a pool of threads inflates and scans them. A
+ * chunk is summarised without knowing where in a line it starts: the bytes
+ * up to its first newline, the headers and runs of lines after that, and
+ * the unterminated line at its end. Stitching the summaries together in
+ * file order is cheap, so only the inflating and scanning is parallel.
+ * Everything is static inline, like faigz_index.h.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "faigz_inflate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAIDX_BUILD_BLOCKS 16        // BGZF blocks per chunk
+#define FAIDX_BUILD_CHUNK (1 << 20)  // Bytes per chunk of an uncompressed file
+#define FAIDX_BUILD_MAX_THREADS 32
+
+/* Shape of a record's sequence lines; every line but the last must match the first */
+typedef struct {
+    uint64_t skip;               // Bytes of blank lines before the first line
+    uint64_t n_lines, bases;
+    uint64_t first_blen, first_len; // Bases and bytes of the first line
+    uint64_t last_blen, last_len;
+    int bad;                     // A line before the last differs from the first
+    int blank;                   // Blank lines follow the last line, so no more may
+} faidx_build_run_t;
+
+/* Append the lines of b to a */
+static inline void faidx_build_run_add(faidx_build_run_t *a, const faidx_build_run_t *b) {
+    if (!a->n_lines) {
+        uint64_t skip = a->skip + b->skip;
+        *a = *b;
+        a->skip = skip;
+        return;
+    }
+    if (b->skip) a->blank = 1;
+    if (!b->n_lines) return;
+    
+    // a's last line and, unless b is a single line, b's first are now in the middle
+    int bad = a->bad || b->bad || a->blank;
+    if (a->last_blen != a->first_blen || a->last_len != a->first_len) bad = 1;
+    if (b->n_lines > 1 && (b->first_blen != a->first_blen || b->first_len != a->first_len)) bad = 1;
+    
+    a->n_lines += b->n_lines;
+    a->bases += b->bases;
+    a->last_blen = b->last_blen;
+    a->last_len = b->last_len;
+    a->bad = bad;
+    a->blank = b->blank;
+}
+
+/* Append one line of len bytes holding blen bases; blank lines have none */
+static inline void faidx_build_run_line(faidx_build_run_t *run, uint64_t blen, uint64_t len) {
+    faidx_build_run_t line;
+    
+    memset(&line, 0, sizeof(line));
+    if (blen == 0) {
+        line.skip = len;
+    } else {
+        line.n_lines = 1;
+        line.bases = line.first_blen = line.last_blen = blen;
+        line.first_len = line.last_len = len;
+    }
+    faidx_build_run_add(run, &line);
+}
+
+/* Bases in n bytes of a line, which may end in its terminator */
+static inline uint64_t faidx_build_bases(const char *s, size_t n) {
+    if (n && s[n - 1] == '\n') n--;
+    if (n && s[n - 1] == '\r') n--;
+    return n;
+}
+
+/* Length of the leading run of s without whitespace, as a header's name is */
+static inline size_t faidx_build_word(const char *s, size_t n) {
+    size_t i = 0;
+    while (i < n && s[i] != ' ' && s[i] != '\t' && s[i] != '\n' && s[i] != '\r' &&
+           s[i] != '\v' && s[i] != '\f') {
+        i++;
+    }
+    return i;
+}
+
+// A header line found inside a chunk and the lines after it there
+typedef struct {
+    const char *name;            // Points into the chunk's data
+    size_t name_len;
+    uint64_t seq_off;            // Uncompressed offset just past the header line
+    faidx_build_run_t run;
+} faidx_build_rec_t;
+
+typedef struct {
+    unsigned char *cdata;        // Compressed blocks (BGZF only)
+    size_t clen;
+    char *data;                  // Uncompressed bytes
+    size_t len;
+    uint64_t uoff;               // Uncompressed offset of data[0]
+    faidx_inflater_t inflater;
+    int err;
+    
+    // Summary from faidx_build_scan
+    size_t head_len;             // Bytes to the first newline inclusive, or all of them
+    int head_nl;                 // The head ends in a newline
+    uint64_t head_bases;
+    size_t head_word;            // Leading bytes before any whitespace
+    faidx_build_run_t lead;      // Lines after the head and before the first header
+    faidx_build_rec_t *rec;
+    size_t n_rec, m_rec;
+    size_t tail_off, tail_len;   // The unterminated line at the end, if any
+    uint64_t tail_bases;
+    size_t tail_word;
+} faidx_build_chunk_t;
+
+/* Inflate the chunk's blocks into data */
+static inline int faidx_build_inflate(faidx_build_chunk_t *c) {
+    size_t pos = 0, out = 0;
+    
+    // The reader has already checked every header
+    while (pos < c->clen) {
+        const unsigned char *block = c->cdata + pos;
+        size_t bsize = faidx_bgzf_block_size(block);
+        int n = faidx_bgzf_inflate(&c->inflater, block, bsize, (uint8_t*)c->data + out,
+                                   c->len - out);
+        if (n < 0) return -1;
+        out += (size_t)n;
+        pos += bsize;
+    }
+    return out == c->len ? 0 : -1;
+}
+
+/* Summarise the chunk's lines */
+static inline int faidx_build_scan(faidx_build_chunk_t *c) {
+    const char *s = c->data;
+    const char *nl = (const char*)memchr(s, '\n', c->len);
+    faidx_build_run_t *run = &c->lead;
+    size_t pos;
+    
+    c->head_len = nl ? (size_t)(nl - s) + 1 : c->len;
+    c->head_nl = nl != NULL;
+    c->head_bases = faidx_build_bases(s, c->head_len);
+    c->head_word = faidx_build_word(s, c->head_len);
+    memset(&c->lead, 0, sizeof(c->lead));
+    c->n_rec = 0;
+    c->tail_len = 0;
+    
+    for (pos = c->head_len; pos < c->len; ) {
+        nl = (const char*)memchr(s + pos, '\n', c->len - pos);
+        if (!nl) {
+            c->tail_off = pos;
+            c->tail_len = c->len - pos;
+            c->tail_bases = faidx_build_bases(s + pos, c->tail_len);
+            c->tail_word = faidx_build_word(s + pos, c->tail_len);
+            break;
+        }
+    
+        size_t end = (size_t)(nl - s) + 1;
+        if (s[pos] == '>') {
+            if (c->n_rec == c->m_rec) {
+                size_t m = c->m_rec ? c->m_rec * 2 : 64;
+                faidx_build_rec_t *rec = (faidx_build_rec_t*)realloc(c->rec, m * sizeof(*rec));
+                if (!rec) return -1;
+                c->rec = rec;
+                c->m_rec = m;
+            }
+            faidx_build_rec_t *r = &c->rec[c->n_rec++];
+            r->name = s + pos + 1;
+            r->name_len = faidx_build_word(r->name, end - pos - 1);
+            r->seq_off = c->uoff + end;
+            memset(&r->run, 0, sizeof(r->run));
+            run = &r->run;
+        } else {
+            faidx_build_run_line(run, faidx_build_bases(s + pos, end - pos), end - pos);
+        }
+        pos = end;
+    }
+    return 0;
+}
+
+typedef struct {
+    char *s;
+    size_t l, m;
+} faidx_build_buf_t;
+
+static inline int faidx_build_buf_add(faidx_build_buf_t *buf, const char *s, size_t n) {
+    if (buf->l + n + 1 > buf->m) {
+        size_t m = (buf->l + n + 1) * 2;
+        char *p = (char*)realloc(buf->s, m);
+        if (!p) return -1;
+        buf->s = p;
+        buf->m = m;
+    }
+    memcpy(buf->s + buf->l, s, n);
+    buf->l += n;
+    buf->s[buf->l] = '\0';
+    return 0;
+}
+
+typedef struct {
+    int bgzf;
+    uint64_t caddr, uaddr;       // Where the next chunk starts
+    uint64_t *gzi;               // Compressed and uncompressed offset pairs
+    size_t n_gzi, m_gzi;
+    
+    // This round's chunks, handed out to the threads by index
+    faidx_build_chunk_t *chunks;
+    int n_chunks, m_chunks;
+    int next;
+    
+    // Threads other than the caller's, woken once per round
+    pthread_t *threads;
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    unsigned round;
+    int pending, shutdown;
+    
+    // The line carried from one chunk into the next
+    int line_open, line_header, line_word_done;
+    uint64_t line_start, line_bytes, line_bases;
+    faidx_build_buf_t line_name;
+    
+    // The record being stitched together
+    int have_rec;
+    faidx_build_buf_t rec_name;
+    uint64_t rec_seq_off;
+    faidx_build_run_t rec_run;
+    FILE *fai;
+} faidx_build_t;
+
+/* Inflate and scan chunks until none are left this round */
+static inline void faidx_build_work(faidx_build_t *b) {
+    for (;;) {
+        int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->n_chunks) break;
+    
+        faidx_build_chunk_t *c = &b->chunks[i];
+        c->err = (b->bgzf && faidx_build_inflate(c) < 0) || faidx_build_scan(c) < 0;
+    }
+}
+
+static inline void *faidx_build_worker(void *arg) {
+    faidx_build_t *b = (faidx_build_t*)arg;
+    unsigned seen = 0;
+    
+    pthread_mutex_lock(&b->lock);
+    for (;;) {
+        while (b->round == seen && !b->shutdown) pthread_cond_wait(&b->work, &b->lock);
+        if (b->shutdown) break;
+        seen = b->round;
+        pthread_mutex_unlock(&b->lock);
+    
+        faidx_build_work(b);
+    
+        pthread_mutex_lock(&b->lock);
+        if (--b->pending == 0) pthread_cond_signal(&b->done);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+/* Process this round's chunks on every thread, the caller's included */
+static inline void faidx_build_round(faidx_build_t *b) {
+    pthread_mutex_lock(&b->lock);
+    __atomic_store_n(&b->next, 0, __ATOMIC_RELAXED);
+    b->pending = b->n_threads;
+    b->round++;
+    pthread_cond_broadcast(&b->work);
+    pthread_mutex_unlock(&b->lock);
+    
+    faidx_build_work(b);
+    
+    pthread_mutex_lock(&b->lock);
+    while (b->pending > 0) pthread_cond_wait(&b->done, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Read the next chunk of input; 1 if there was one, 0 at the end, -1 on error */
+static inline int faidx_build_read(faidx_build_t *b, FILE *fp, faidx_build_chunk_t *c) {
+    c->uoff = b->uaddr;
+    c->len = c->clen = 0;
+    
+    if (!b->bgzf) {
+        if (!c->data && !(c->data = (char*)malloc(FAIDX_BUILD_CHUNK))) return -1;
+        c->len = fread(c->data, 1, FAIDX_BUILD_CHUNK, fp);
+        if (c->len < FAIDX_BUILD_CHUNK && ferror(fp)) return -1;
+        b->uaddr += c->len;
+        return c->len > 0;
+    }
+    
+    if (!c->cdata) {
+        c->cdata = (unsigned char*)malloc((size_t)FAIDX_BUILD_BLOCKS * FAIDX_BGZF_MAX);
+        c->data = (char*)malloc((size_t)FAIDX_BUILD_BLOCKS * FAIDX_BGZF_MAX);
+        if (!c->cdata || !c->data) return -1;
+    }
+    for (int i = 0; i < FAIDX_BUILD_BLOCKS; i++) {
+        unsigned char *block = c->cdata + c->clen;
+        size_t got = fread(block, 1, FAIDX_BGZF_HDR, fp);
+        if (got == 0 && !ferror(fp)) break;
+        if (got != FAIDX_BGZF_HDR) return -1;
+    
+        size_t bsize = faidx_bgzf_block_size(block);
+        if (!bsize || fread(block + FAIDX_BGZF_HDR, 1, bsize - FAIDX_BGZF_HDR, fp) !=
+                      bsize - FAIDX_BGZF_HDR) {
+            return -1;
+        }
+        uint32_t isize = faidx_bgzf_le32(block + bsize - 4);
+        if (isize > FAIDX_BGZF_MAX) return -1;
+    
+        // Like htslib, the .gzi leaves out the first block and empty ones such as the EOF marker
+        if (isize > 0 && b->caddr > 0) {
+            if (b->n_gzi + 2 > b->m_gzi) {
+                size_t m = b->m_gzi ? b->m_gzi * 2 : 4096;
+                uint64_t *gzi = (uint64_t*)realloc(b->gzi, m * sizeof(uint64_t));
+                if (!gzi) return -1;
+                b->gzi = gzi;
+                b->m_gzi = m;
+            }
+            b->gzi[b->n_gzi++] = b->caddr;
+            b->gzi[b->n_gzi++] = b->uaddr;
+        }
+        c->clen += bsize;
+        c->len += isize;
+        b->caddr += bsize;
+        b->uaddr += isize;
+    }
+    return c->clen > 0;
+}
+
+/* Write the record in progress to the .fai */
+static inline int faidx_build_emit(faidx_build_t *b) {
+    const faidx_build_run_t *r = &b->rec_run;
+    
+    if (!b->have_rec) return 0;
+    b->have_rec = 0;
+    if (r->bad || r->last_blen > r->first_blen) return -1;
+    return fprintf(b->fai, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+                   b->rec_name.s, r->bases, b->rec_seq_off + r->skip,
+                   r->first_blen, r->first_len) < 0 ? -1 : 0;
+}
+
+/* Finish the current record and start the one whose header ends at seq_off */
+static inline int faidx_build_start(faidx_build_t *b, const char *name, size_t len,
+                                    uint64_t seq_off) {
+    if (faidx_build_emit(b) < 0) return -1;
+    b->rec_name.l = 0;
+    if (faidx_build_buf_add(&b->rec_name, name, len) < 0) return -1;
+    b->rec_seq_off = seq_off;
+    memset(&b->rec_run, 0, sizeof(b->rec_run));
+    b->have_rec = 1;
+    return 0;
+}
+
+/* Add len bytes at uoff to the carried line, opening it if there is none */
+static inline int faidx_build_piece(faidx_build_t *b, const char *s, size_t len,
+                                    uint64_t bases, size_t word, uint64_t uoff) {
+    if (!len) return 0;
+    if (!b->line_open) {
+        b->line_open = 1;
+        b->line_start = uoff;
+        b->line_bytes = b->line_bases = 0;
+        b->line_header = s[0] == '>';
+        b->line_word_done = 0;
+        b->line_name.l = 0;
+    
+        // The '>' opening a header isn't part of its name
+        if (b->line_header) {
+            b->line_bytes = 1;
+            s++;
+            len--;
+            word--;
+        }
+    }
+    b->line_bytes += len;
+    b->line_bases += bases;
+    if (b->line_header && !b->line_word_done) {
+        if (faidx_build_buf_add(&b->line_name, s, word) < 0) return -1;
+        b->line_word_done = word < len;
+    }
+    return 0;
+}
+
+/* The carried line has ended */
+static inline int faidx_build_end_line(faidx_build_t *b) {
+    b->line_open = 0;
+    if (b->line_header) {
+        return faidx_build_start(b, b->line_name.s ? b->line_name.s : "", b->line_name.l,
+                                 b->line_start + b->line_bytes);
+    }
+    if (b->have_rec) faidx_build_run_line(&b->rec_run, b->line_bases, b->line_bytes);
+    return 0;
+}
+
+/* Join a chunk's summary onto everything before it */
+static inline int faidx_build_stitch(faidx_build_t *b, const faidx_build_chunk_t *c) {
+    if (faidx_build_piece(b, c->data, c->head_len, c->head_bases, c->head_word, c->uoff) < 0) {
+        return -1;
+    }
+    if (!c->head_nl) return 0;
+    if (faidx_build_end_line(b) < 0) return -1;
+    
+    // Lines before any header are ignored, as htslib does
+    if (b->have_rec) faidx_build_run_add(&b->rec_run, &c->lead);
+    for (size_t i = 0; i < c->n_rec; i++) {
+        if (faidx_build_start(b, c->rec[i].name, c->rec[i].name_len, c->rec[i].seq_off) < 0) {
+            return -1;
+        }
+        b->rec_run = c->rec[i].run;
+    }
+    return faidx_build_piece(b, c->data + c->tail_off, c->tail_len, c->tail_bases,
+                             c->tail_word, c->uoff + c->tail_off);
+}
+
+static inline int faidx_build_write_gzi(const faidx_build_t *b, const char *gzi_path) {
+    unsigned char buf[8];
+    uint64_t n = b->n_gzi / 2;
+    FILE *fp = fopen(gzi_path, "wb");
+    int ok;
+    
+    if (!fp) return -1;
+    for (int i = 0; i < 8; i++) buf[i] = (unsigned char)(n >> (8 * i));
+    ok = fwrite(buf, 1, 8, fp) == 8;
+    for (size_t j = 0; ok && j < b->n_gzi; j++) {
+        for (int i = 0; i < 8; i++) buf[i] = (unsigned char)(b->gzi[j] >> (8 * i));
+        ok = fwrite(buf, 1, 8, fp) == 8;
+    }
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* path with ".tmp.<pid>" appended, to build an index under; NULL if out of memory */
+static inline char *faidx_build_tmp_path(const char *path) {
+    size_t n = strlen(path) + 32;
+    char *tmp = (char*)malloc(n);
+    
+    if (tmp) snprintf(tmp, n, "%s.tmp.%ld", path, (long)getpid());
+    return tmp;
+}
+
+/*
+ * Finish a build under temporary names: if ret is 0, rename them over the
+ * real paths, the .gzi first so a new .fai is never seen without it;
+ * otherwise, or if a rename fails, remove them. gzi_tmp is NULL when no
+ * .gzi was built. Returns 0 if the index is in place and -1 if not.
+ */
+static inline int faidx_build_commit(int ret, const char *fai_tmp, const char *fai_path,
+                                     const char *gzi_tmp, const char *gzi_path) {
+    if (ret == 0 && gzi_tmp && rename(gzi_tmp, gzi_path) != 0) ret = -1;
+    if (ret == 0 && rename(fai_tmp, fai_path) != 0) ret = -1;
+    if (ret < 0) {
+        remove(fai_tmp);
+        if (gzi_tmp) remove(gzi_tmp);
+    }
+    return ret;
+}
+
+/* Threads to index with by default: one per online CPU, within reason */
+static inline int faidx_build_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > FAIDX_BUILD_MAX_THREADS ? FAIDX_BUILD_MAX_THREADS : (int)n;
+}
+
+/*
+ * Write the .fai for the FASTA file fn, and its .gzi when it is BGZF
+ * compressed, using n_threads threads. Returns 0 on success and -1 on
+ * failure (including gzip files that aren't BGZF, and sequences whose
+ * lines vary in length). Both are written under temporary names and only
+ * renamed into place once complete, so a failed build leaves any index
+ * already there alone and concurrent loads never see a partial one.
+ */
+static inline int faidx_build_index(const char *fn, const char *fai_path, const char *gzi_path,
+                                    int n_threads) {
+    faidx_build_t b;
+    unsigned char magic[FAIDX_BGZF_HDR];
+    size_t got;
+    int ret = -1, more = 1, sync_ok = 0;
+    char *fai_tmp = NULL, *gzi_tmp = NULL;
+    FILE *fp = fopen(fn, "rb");
+    
+    if (!fp) return -1;
+    memset(&b, 0, sizeof(b));
+    got = fread(magic, 1, sizeof(magic), fp);
+    b.bgzf = got == sizeof(magic) && faidx_bgzf_block_size(magic) > 0;
+    if ((got >= 2 && magic[0] == 31 && magic[1] == 139 && !b.bgzf) || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > FAIDX_BUILD_MAX_THREADS) n_threads = FAIDX_BUILD_MAX_THREADS;
+    b.m_chunks = 2 * n_threads;
+    b.chunks = (faidx_build_chunk_t*)calloc((size_t)b.m_chunks, sizeof(faidx_build_chunk_t));
+    b.threads = (pthread_t*)malloc((size_t)n_threads * sizeof(pthread_t));
+    fai_tmp = faidx_build_tmp_path(fai_path);
+    gzi_tmp = faidx_build_tmp_path(gzi_path);
+    b.fai = fai_tmp && gzi_tmp ? fopen(fai_tmp, "w") : NULL;
+    if (!b.chunks || !b.threads || !b.fai) goto out;
+    if (pthread_mutex_init(&b.lock, NULL) != 0) goto out;
+    pthread_cond_init(&b.work, NULL);
+    pthread_cond_init(&b.done, NULL);
+    sync_ok = 1;
+    
+    // Threads that fail to start just leave more of the work to the others
+    while (b.n_threads < n_threads - 1 &&
+           pthread_create(&b.threads[b.n_threads], NULL, faidx_build_worker, &b) == 0) {
+        b.n_threads++;
+    }
+    
+    while (more) {
+        for (b.n_chunks = 0; b.n_chunks < b.m_chunks; b.n_chunks++) {
+            int r = faidx_build_read(&b, fp, &b.chunks[b.n_chunks]);
+            if (r < 0) goto out;
+            if (r == 0) {
+                more = 0;
+                break;
+            }
+        }
+        if (!b.n_chunks) break;
+    
+        faidx_build_round(&b);
+        for (int i = 0; i < b.n_chunks; i++) {
+            if (b.chunks[i].err || faidx_build_stitch(&b, &b.chunks[i]) < 0) goto out;
+        }
+    }
+    
+    // The file may not end in a newline
+    if (b.line_open && faidx_build_end_line(&b) < 0) goto out;
+    if (faidx_build_emit(&b) < 0) goto out;
+    if (b.bgzf && faidx_build_write_gzi(&b, gzi_tmp) < 0) goto out;
+    ret = 0;
+    
+out:
+    if (sync_ok) {
+        pthread_mutex_lock(&b.lock);
+        b.shutdown = 1;
+        pthread_cond_broadcast(&b.work);
+        pthread_mutex_unlock(&b.lock);
+        for (int i = 0; i < b.n_threads; i++) pthread_join(b.threads[i], NULL);
+        pthread_cond_destroy(&b.work);
+        pthread_cond_destroy(&b.done);
+        pthread_mutex_destroy(&b.lock);
+    }
+    for (int i = 0; b.chunks && i < b.m_chunks; i++) {
+        faidx_inflater_free(&b.chunks[i].inflater);
+        free(b.chunks[i].cdata);
+        free(b.chunks[i].data);
+        free(b.chunks[i].rec);
+    }
+    if (b.fai) {
+        if (fclose(b.fai) != 0) ret = -1;
+        ret = faidx_build_commit(ret, fai_tmp, fai_path, b.bgzf ? gzi_tmp : NULL, gzi_path);
+    }
+    fclose(fp);
+    free(fai_tmp);
+    free(gzi_tmp);
+    free(b.chunks);
+    free(b.threads);
+    free(b.gzi);
+    free(b.line_name.s);
+    free(b.rec_name.s);
+    return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_BUILD_H */
@@ -0,0 +1,496 @@
+/*
+ * faigz: extract regions from an indexed FASTA/FASTQ file, with the same
+ * output as samtools faidx, on many threads.
+ *
+ * Regions are parsed as they are read and cut into batches of at most
+ * -B regions or CLI_BATCH_BASES bases, and a longer FASTA region is split
+ * into pieces of whole output lines, so whole chromosomes spread over the
+ * threads and memory stays bounded. Each batch goes to a worker thread
+ * with its own reader on the shared metadata, which fetches the regions
+ * with faidx_reader_fetch_batch (merged reads in file order) and formats
+ * the records into a chunk of faigz_writer.h. The main thread hands the
+ * chunks to the writer in input order, holding back batches that finish
+ * early, so the output is the same whatever the number of threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define REENTRANT_FAIDX_IMPLEMENTATION
+#include "faigz.h"
+#include "faigz_writer.h"
+
+#define CLI_BATCH 4096               // Regions per batch by default
+#define CLI_BATCH_BASES (8 << 20)    // Bases per batch, and the longest piece of a region
+#define CLI_WINDOW 4                 // Batches in flight per worker
+
+// Where a piece of a split region falls in its record
+#define CLI_CONT 1                   // Continues the record, so no header
+#define CLI_MORE 2                   // More of the record follows
+
+// A batch of regions; the region strings follow one another in names
+typedef struct cli_job_t {
+    uint64_t id;
+    kstring_t names;
+    size_t *offs, n, m;
+    faidx_region_t *regs;            // Parsed regions, name NULL where one doesn't parse
+    hts_pos_t *ends;                 // Ends as parsed (exclusive, HTS_POS_MAX for none)
+    unsigned char *parts;            // CLI_CONT and CLI_MORE for pieces of a split region
+    uint64_t bases;                  // Bases the regions cover
+    faidx_wchunk_t *out;             // Formatted records
+    kstring_t msgs;                  // samtools-style warnings, printed in order
+    int failed;                      // A region could not be fetched and we stop there
+    int done;
+    struct cli_job_t *next;
+} cli_job_t;
+
+typedef struct {
+    faidx_meta_t *meta;
+    faidx_writer_t *writer;
+    int fastq;
+    int keep_going;                  // -c: carry on past regions that aren't in the index
+    size_t width;
+    hts_pos_t piece;                 // Bases per piece of a split region, a multiple of width
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    cli_job_t *head, *tail;
+    int shutdown;
+    int error;                       // A worker failed to start or ran out of memory
+} cli_t;
+
+static void usage(FILE *fp) {
+    fprintf(fp,
+        "Usage: faigz [options] <file.fa|file.fa.gz> [region1 [...]]\n"
+        "Options:\n"
+        "  -r FILE   File of regions, one per line\n"
+        "  -o FILE   Write output to FILE [stdout]\n"
+        "  -n INT    Length of the output lines, 0 for one line per record [60]\n"
+        "  -c        Continue after a region that isn't in the index\n"
+        "  -f        Read FASTQ and write FASTQ records\n"
+        "  -@ INT    Number of reader threads [one per CPU]\n"
+        "  -B INT    Regions per batch, closed early at %d Mbases [%d]\n"
+        "  -m INT    Shared BGZF block cache size in MB [0]\n"
+        "  -h        Show this help message\n"
+        "\n"
+        "Regions are NAME, NAME:BEG or NAME:BEG-END, 1-based and inclusive as\n"
+        "for samtools faidx. With no regions the index is built if missing.\n",
+        CLI_BATCH_BASES >> 20, CLI_BATCH);
+}
+
+static void job_free(cli_job_t *job) {
+    if (!job) return;
+    if (job->out) {
+        free(job->out->s);
+        free(job->out);
+    }
+    free(job->names.s);
+    free(job->offs);
+    free(job->regs);
+    free(job->ends);
+    free(job->parts);
+    free(job->msgs.s);
+    free(job);
+}
+
+/* Add region string s as [beg, end) of name, covering len bases; name NULL if it didn't parse */
+static int job_add(cli_job_t *job, const char *s, size_t l, const char *name, hts_pos_t beg,
+                   hts_pos_t end, hts_pos_t len, int part) {
+    if (job->n == job->m) {
+        size_t m = job->m ? job->m * 2 : 256;
+        size_t *offs = (size_t*)realloc(job->offs, m * sizeof(size_t));
+        if (!offs) return -1;
+        job->offs = offs;
+        faidx_region_t *regs = (faidx_region_t*)realloc(job->regs, m * sizeof(faidx_region_t));
+        if (!regs) return -1;
+        job->regs = regs;
+        hts_pos_t *ends = (hts_pos_t*)realloc(job->ends, m * sizeof(hts_pos_t));
+        if (!ends) return -1;
+        job->ends = ends;
+        unsigned char *parts = (unsigned char*)realloc(job->parts, m);
+        if (!parts) return -1;
+        job->parts = parts;
+        job->m = m;
+    }
+    job->offs[job->n] = job->names.l;
+    job->regs[job->n].name = name;
+    job->regs[job->n].beg = name ? beg : 0;
+    job->regs[job->n].end = name ? end - 1 : 0;
+    job->ends[job->n] = name ? end : 0;
+    job->parts[job->n] = (unsigned char)part;
+    job->n++;
+    if (len > 0) job->bases += (uint64_t)len;
+    return kputsn(s, l, &job->names) < 0 || kputc('\0', &job->names) < 0 ? -1 : 0;
+}
+
+/*
+ * Format one record the way samtools faidx does: the header whatever
+ * happens, then the sequence (and "+" and the qualities for FASTQ), with
+ * the same warnings. A piece of a split region (part) leaves out the
+ * header if it continues a record, and the newline ending a single-line
+ * record if more of it follows. Returns 0 to go on, 1 to stop here and
+ * -1 on error.
+ */
+static int format_record(cli_t *cli, cli_job_t *job, faidx_wbuf_t *b, const char *name,
+                         const kstring_t *seq, hts_pos_t len, const kstring_t *qual,
+                         hts_pos_t qlen, hts_pos_t beg, hts_pos_t end, int part) {
+    if (!(part & CLI_CONT) &&
+        (faidx_wbuf_put(b, cli->fastq ? "@" : ">", 1) < 0 || faidx_wbuf_put(b, name, strlen(name)) < 0 ||
+         faidx_wbuf_put(b, "\n", 1) < 0)) {
+        return -1;
+    }
+
+    for (int pass = 0; pass < 1 + cli->fastq; pass++) {
+        hts_pos_t n = pass ? qlen : len;
+        const kstring_t *s = pass ? qual : seq;
+
+        if (pass && faidx_wbuf_put(b, "+\n", 2) < 0) return -1;
+        if (n < 0) {
+            ksprintf(&job->msgs, "[faidx] Failed to fetch sequence in %s\n", name);
+            return cli->keep_going && n == -2 ? 0 : 1;
+        }
+        if (n == 0) {
+            ksprintf(&job->msgs, "[faidx] Zero length sequence: %s\n", name);
+        } else if (end < HTS_POS_MAX && n != end - beg) {
+            ksprintf(&job->msgs, "[faidx] Truncated sequence: %s\n", name);
+        }
+        if ((part & CLI_MORE) && !cli->width) {
+            if (faidx_wbuf_put(b, s->s, (size_t)n) < 0) return -1;
+        } else if (faidx_wbuf_lines(b, s->s, (size_t)n, cli->width) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Fetch and format a batch on a worker's reader */
+static int run_job(cli_t *cli, faidx_reader_t *reader, cli_job_t *job) {
+    const faidx_region_t *regs = job->regs;
+    hts_pos_t *lens = (hts_pos_t*)malloc(job->n * sizeof(hts_pos_t));
+    kstring_t *seqs = (kstring_t*)calloc(job->n, sizeof(kstring_t));
+    kstring_t qual = {0, 0, NULL};
+    faidx_wbuf_t b;
+    int ret = -1;
+    size_t i;
+
+    faidx_wbuf_init(&b, cli->writer);
+    if (!lens || !seqs) goto out;
+
+    // FASTA regions are fetched together; FASTQ needs the qualities alongside
+    if (!cli->fastq) {
+        if (faidx_reader_fetch_batch(reader, regs, job->n, seqs, lens) < 0) goto out;
+    } else {
+        for (i = 0; i < job->n; i++) {
+            lens[i] = regs[i].name ? faidx_reader_fetch_seq_into(reader, regs[i].name, regs[i].beg,
+                                                                 regs[i].end, &seqs[i]) : -2;
+        }
+    }
+
+    for (i = 0; i < job->n; i++) {
+        const char *s = job->names.s + job->offs[i];
+        hts_pos_t len = regs[i].name ? lens[i] : -2, qlen = 0;
+
+        if (cli->fastq && len >= 0) {
+            qlen = faidx_reader_fetch_qual_into(reader, regs[i].name, regs[i].beg, regs[i].end, &qual);
+        }
+        int r = format_record(cli, job, &b, s, &seqs[i], len, &qual, qlen, regs[i].beg, job->ends[i],
+                              job->parts[i]);
+        if (r < 0) goto out;
+        if (r > 0) {
+            job->failed = 1;
+            break;
+        }
+    }
+    ret = 0;
+
+out:
+    job->out = faidx_wbuf_take(&b);
+    if (seqs) {
+        for (i = 0; i < job->n; i++) free(seqs[i].s);
+    }
+    free(seqs);
+    free(qual.s);
+    free(lens);
+    return ret;
+}
+
+static void *worker(void *arg) {
+    cli_t *cli = (cli_t*)arg;
+    faidx_reader_t *reader = faidx_reader_create(cli->meta);
+
+    pthread_mutex_lock(&cli->lock);
+    if (!reader) {
+        cli->error = 1;
+        pthread_cond_broadcast(&cli->done);
+    }
+    for (;;) {
+        while (!cli->head && !cli->shutdown) pthread_cond_wait(&cli->work, &cli->lock);
+        if (!cli->head) break;
+        cli_job_t *job = cli->head;
+        cli->head = job->next;
+        if (!cli->head) cli->tail = NULL;
+        int skip = cli->error;
+        pthread_mutex_unlock(&cli->lock);
+
+        int err = skip || !reader || run_job(cli, reader, job) < 0;
+
+        pthread_mutex_lock(&cli->lock);
+        if (err) cli->error = 1;
+        job->done = 1;
+        pthread_cond_broadcast(&cli->done);
+    }
+    pthread_mutex_unlock(&cli->lock);
+    faidx_reader_destroy(reader);
+    return NULL;
+}
+
+// Where regions come from: the region file first, then the command line
+typedef struct {
+    FILE *fp;
+    kstring_t line;
+    char **argv;
+    int argc, next;
+
+    // A long region being split into pieces; split.l is 0 when there is none
+    kstring_t split;                 // Its region string
+    const char *name;
+    hts_pos_t first, beg;            // Start of the region and of its next piece
+    hts_pos_t stop, end;             // End of its bases, and its end as parsed
+} cli_input_t;
+
+/* Read a whole line of the region file into in->line; -1 at the end */
+static int read_line(cli_input_t *in) {
+    in->line.l = 0;
+    for (;;) {
+        if (ks_resize(&in->line, in->line.l + 256) < 0) return -1;
+        if (!fgets(in->line.s + in->line.l, (int)(in->line.m - in->line.l), in->fp)) {
+            return in->line.l ? 0 : -1;
+        }
+        in->line.l += strlen(in->line.s + in->line.l);
+        if (in->line.l && in->line.s[in->line.l - 1] == '\n') return 0;
+    }
+}
+
+/*
+ * Parse region s and add it to job, or start splitting it if it is a FASTA
+ * region longer than a piece. One that doesn't parse is added as absent,
+ * as for fai_fetch.
+ */
+static int add_region(cli_t *cli, cli_input_t *in, cli_job_t *job, const char *s, size_t l) {
+    int tid;
+    hts_pos_t beg, end;
+
+    if (!faidx_meta_parse_region(cli->meta, s, &tid, &beg, &end, 0)) {
+        return job_add(job, s, l, NULL, 0, 0, 0, 0);
+    }
+    const char *name = faidx_meta_iseq(cli->meta, tid);
+    hts_pos_t seq_len = faidx_meta_seq_len_id(cli->meta, tid);
+    hts_pos_t stop = end < seq_len ? end : seq_len;
+
+    if (cli->fastq || stop - beg <= cli->piece) return job_add(job, s, l, name, beg, end, stop - beg, 0);
+    in->split.l = 0;
+    if (kputsn(s, l, &in->split) < 0) return -1;
+    in->name = name;
+    in->first = in->beg = beg;
+    in->stop = stop;
+    in->end = end;
+    return 0;
+}
+
+/* Add the next piece of the region being split */
+static int add_piece(cli_t *cli, cli_input_t *in, cli_job_t *job) {
+    hts_pos_t beg = in->beg, end = beg + cli->piece;
+    int part = beg > in->first ? CLI_CONT : 0;
+
+    if (end < in->stop) {
+        part |= CLI_MORE;
+    } else {
+        // The last piece keeps the end as parsed, so truncation is reported as usual
+        end = in->end;
+    }
+    in->beg = end;
+    if (job_add(job, in->split.s, in->split.l, in->name, beg, end,
+                (end < in->stop ? end : in->stop) - beg, part) < 0) {
+        return -1;
+    }
+    if (!(part & CLI_MORE)) in->split.l = 0;
+    return 0;
+}
+
+/* Next batch of at most batch regions or CLI_BATCH_BASES bases; NULL at the end or on error (err set) */
+static cli_job_t *read_job(cli_t *cli, cli_input_t *in, size_t batch, int *err) {
+    cli_job_t *job = (cli_job_t*)calloc(1, sizeof(cli_job_t));
+
+    if (!job) goto fail;
+    while (job->n < batch && job->bases < CLI_BATCH_BASES) {
+        if (in->split.l) {
+            if (add_piece(cli, in, job) < 0) goto fail;
+        } else if (in->fp) {
+            if (read_line(in) < 0) {
+                if (ferror(in->fp)) goto fail;
+                fclose(in->fp);
+                in->fp = NULL;
+                continue;
+            }
+            size_t l = in->line.l;
+            while (l && (in->line.s[l - 1] == '\r' || in->line.s[l - 1] == '\n')) l--;
+            in->line.s[l] = '\0';
+            if (l && add_region(cli, in, job, in->line.s, l) < 0) goto fail;
+        } else if (in->next < in->argc) {
+            const char *s = in->argv[in->next++];
+            if (add_region(cli, in, job, s, strlen(s)) < 0) goto fail;
+        } else {
+            break;
+        }
+    }
+    if (job->n) return job;
+    job_free(job);
+    return NULL;
+
+fail:
+    job_free(job);
+    *err = 1;
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    cli_t cli;
+    cli_input_t in;
+    const char *region_file = NULL, *out_file = "-";
+    int n_threads = faidx_build_threads(), batch = CLI_BATCH, width = 60, cache_mb = 0, c, ret = 1;
+
+    memset(&cli, 0, sizeof(cli));
+    memset(&in, 0, sizeof(in));
+    while ((c = getopt(argc, argv, "r:o:n:cf@:B:m:h")) != -1) {
+        switch (c) {
+            case 'r': region_file = optarg; break;
+            case 'o': out_file = optarg; break;
+            case 'n': width = atoi(optarg); break;
+            case 'c': cli.keep_going = 1; break;
+            case 'f': cli.fastq = 1; break;
+            case '@': n_threads = atoi(optarg); break;
+            case 'B': batch = atoi(optarg); break;
+            case 'm': cache_mb = atoi(optarg); break;
+            case 'h': usage(stdout); return 0;
+            default: usage(stderr); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(stderr);
+        return 1;
+    }
+    if (width < 0 || cache_mb < 0 || n_threads < 1 || batch < 1) {
+        fprintf(stderr, "[faigz] Line length and cache size must be >= 0, and threads and batch size >= 1\n");
+        return 1;
+    }
+    cli.width = (size_t)width;
+    cli.piece = width ? CLI_BATCH_BASES / width * width : CLI_BATCH_BASES;
+    if (!cli.piece) cli.piece = width;
+
+    cli.meta = faidx_meta_load_cached(argv[optind], cli.fastq ? FAI_FASTQ : FAI_FASTA, FAI_CREATE,
+                                      (size_t)cache_mb << 20);
+    if (!cli.meta) {
+        fprintf(stderr, "[faigz] Could not load fai index of %s\n", argv[optind]);
+        return 1;
+    }
+    in.argv = argv;
+    in.next = optind + 1;
+    in.argc = argc;
+    if (!region_file && in.next == argc) {
+        faidx_meta_destroy(cli.meta);
+        return 0;
+    }
+    if (region_file && !(in.fp = fopen(region_file, "r"))) {
+        fprintf(stderr, "[faigz] Failed to open \"%s\" for reading: %s\n", region_file, strerror(errno));
+        faidx_meta_destroy(cli.meta);
+        return 1;
+    }
+    if (!(cli.writer = faidx_writer_open(out_file, 1))) {
+        fprintf(stderr, "[faigz] Failed to open \"%s\" for writing: %s\n", out_file, strerror(errno));
+        if (in.fp) fclose(in.fp);
+        faidx_meta_destroy(cli.meta);
+        return 1;
+    }
+
+    pthread_t *threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    size_t window = (size_t)n_threads * CLI_WINDOW;
+    cli_job_t **ring = (cli_job_t**)calloc(window, sizeof(cli_job_t*));
+    uint64_t n_read = 0, n_emitted = 0;
+    int started = 0, eof = 0, stop = 0, err = 0;
+
+    pthread_mutex_init(&cli.lock, NULL);
+    pthread_cond_init(&cli.work, NULL);
+    pthread_cond_init(&cli.done, NULL);
+    if (!threads || !ring) goto cleanup;
+    for (; started < n_threads; started++) {
+        if (pthread_create(&threads[started], NULL, worker, &cli) != 0) break;
+    }
+    if (!started) goto cleanup;
+
+    /*
+     * Keep the window of batches full and emit them as the oldest finishes.
+     * After a failure no more are read, and the ones in flight are dropped.
+     */
+    while (!eof || n_emitted < n_read) {
+        while (!eof && n_read - n_emitted < window) {
+            cli_job_t *job = read_job(&cli, &in, (size_t)batch, &err);
+            if (!job) {
+                eof = 1;
+                break;
+            }
+            job->id = n_read;
+            ring[n_read++ % window] = job;
+            pthread_mutex_lock(&cli.lock);
+            if (cli.tail) cli.tail->next = job;
+            else cli.head = job;
+            cli.tail = job;
+            pthread_cond_signal(&cli.work);
+            pthread_mutex_unlock(&cli.lock);
+        }
+        if (n_emitted == n_read) break;
+
+        cli_job_t *job = ring[n_emitted % window];
+        pthread_mutex_lock(&cli.lock);
+        while (!job->done) pthread_cond_wait(&cli.done, &cli.lock);
+        if (cli.error) stop = err = 1;
+        pthread_mutex_unlock(&cli.lock);
+
+        if (!stop) {
+            if (job->msgs.l) fputs(job->msgs.s, stderr);
+            if (job->out && faidx_writer_submit(cli.writer, job->out) < 0) err = 1;
+            job->out = NULL;
+            if (job->failed || err) stop = 1;
+        }
+        if (stop) eof = 1;
+        job_free(job);
+        ring[n_emitted++ % window] = NULL;
+    }
+    ret = stop || err;
+
+cleanup:
+    pthread_mutex_lock(&cli.lock);
+    cli.shutdown = 1;
+    pthread_cond_broadcast(&cli.work);
+    pthread_mutex_unlock(&cli.lock);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    if (faidx_writer_close(cli.writer) < 0) {
+        fprintf(stderr, "[faigz] Error writing output: %s\n", strerror(errno));
+        ret = 1;
+    } else if (err) {
+        fprintf(stderr, "[faigz] Failed to extract regions\n");
+    }
+    free(threads);
+    free(ring);
+    if (in.fp) fclose(in.fp);
+    free(in.line.s);
+    free(in.split.s);
+    pthread_mutex_destroy(&cli.lock);
+    pthread_cond_destroy(&cli.work);
+    pthread_cond_destroy(&cli.done);
+    faidx_meta_destroy(cli.meta);
+    return ret;
+}
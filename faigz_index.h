@@ -0,0 +1,575 @@
+#ifndef FAIGZ_INDEX_H
+#define FAIGZ_INDEX_H
+
+/*
+ * Flat name table and binary index snapshot shared by faigz.h and
+ * faigz_minimal.c. The table maps names to record ids without owning any
+ * strings: slots hold a name's hash and id, and names are resolved through
+ * the caller's arena and offsets. Because nothing in it is a pointer, the
+ * same layout can be written to a .fai.bin snapshot and used straight from
+ * a read-only mapping. Everything here is static inline.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Load flags: use and maintain a <fai>.bin snapshot, or one in POSIX shared
+// memory shared by every process on the host (faigz extensions to the FAI_* flags)
+#define FAI_SNAPSHOT 0x100
+#define FAI_SHM 0x200
+
+// One slot of the name table
+typedef struct {
+    uint32_t hash;               // Hash of the sequence name
+    int32_t id;                  // Record id, -1 if the slot is empty
+} faidx_name_slot_t;
+
+/* FNV-1a with a final avalanche, so the low bits used for the slot are well mixed */
+static inline uint32_t faidx_name_hash(const char *key) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)key; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Allocate an empty table for up to n names, kept at most half full */
+static inline faidx_name_slot_t *faidx_name_table_alloc(size_t n, uint32_t *mask) {
+    size_t size = 16;
+    faidx_name_slot_t *slots;
+    
+    while (size < 2 * n) {
+        if (size > ((size_t)UINT32_MAX >> 1)) return NULL;
+        size <<= 1;
+    }
+    slots = (faidx_name_slot_t*)malloc(size * sizeof(faidx_name_slot_t));
+    if (!slots) return NULL;
+    // Empty slots are fully set, so snapshots of the table hold no uninitialised bytes
+    for (size_t i = 0; i < size; i++) {
+        slots[i].hash = 0;
+        slots[i].id = -1;
+    }
+    *mask = (uint32_t)(size - 1);
+    return slots;
+}
+
+/* Find the id of key, or -1 */
+static inline int faidx_name_find(const faidx_name_slot_t *slots, uint32_t mask,
+                                  const char *names, const uint64_t *name_off,
+                                  const char *key) {
+    uint32_t hv = faidx_name_hash(key);
+    
+    for (uint32_t k = hv & mask; slots[k].id >= 0; k = (k + 1) & mask) {
+        if (slots[k].hash == hv && strcmp(names + name_off[slots[k].id], key) == 0) {
+            return slots[k].id;
+        }
+    }
+    return -1;
+}
+
+/* Insert record id under its name; returns 1 if added, 0 if the name is already present */
+static inline int faidx_name_insert(faidx_name_slot_t *slots, uint32_t mask,
+                                    const char *names, const uint64_t *name_off,
+                                    const char *key, int id) {
+    uint32_t hv = faidx_name_hash(key);
+    uint32_t k = hv & mask;
+    
+    for (; slots[k].id >= 0; k = (k + 1) & mask) {
+        if (slots[k].hash == hv && strcmp(names + name_off[slots[k].id], key) == 0) return 0;
+    }
+    slots[k].hash = hv;
+    slots[k].id = id;
+    return 1;
+}
+
+/*
+ * Snapshot layout: this header, then 8-byte aligned sections at the
+ * offsets it records. It is native-endian and tied to the writer's record
+ * size, and it is considered stale once the .fai or .gzi it was built from
+ * changes size or modification time.
+ */
+#define FAIDX_SNAPSHOT_MAGIC "FAIGZIX"
+#define FAIDX_SNAPSHOT_VERSION 1
+#define FAIDX_SNAPSHOT_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];               // FAIDX_SNAPSHOT_MAGIC, NUL-padded
+    uint32_t version;            // FAIDX_SNAPSHOT_VERSION
+    uint32_t byte_order;         // FAIDX_SNAPSHOT_BYTE_ORDER as written
+    uint32_t rec_size;           // Size of one record
+    uint32_t format;             // Format the records were loaded as
+    uint64_t fai_size, fai_mtime; // Source .fai when written
+    uint64_t gzi_size, gzi_mtime; // Source .gzi when written, zeros if none
+    uint64_t n;                  // Number of records
+    uint64_t names_len;          // Bytes of the name arena
+    uint64_t mask;               // Name table slots - 1
+    uint64_t n_gzi;              // Number of 16-byte block index entries
+    uint64_t off_names, off_name_off, off_seq, off_slots, off_gzi;
+} faidx_snapshot_hdr_t;
+
+// A mapped snapshot; the pointers refer into the mapping
+typedef struct {
+    void *base;
+    size_t size;
+    const faidx_snapshot_hdr_t *hdr;
+    const char *names;
+    const uint64_t *name_off;
+    const void *seq;
+    const faidx_name_slot_t *slots;
+    const void *gzi;
+} faidx_snapshot_t;
+
+/* Helper: size and mtime (in ns where available) of path, zeros if it doesn't exist */
+static inline void faidx_snapshot_stat(const char *path, uint64_t *size, uint64_t *mtime) {
+    struct stat st;
+    
+    *size = *mtime = 0;
+    if (path && stat(path, &st) == 0) {
+        *size = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+        *mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000u + (uint64_t)st.st_mtimespec.tv_nsec;
+#elif defined(st_mtime)   /* glibc and musl alias it to st_mtim.tv_sec when st_mtim exists */
+        *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+#else
+        *mtime = (uint64_t)st.st_mtime;
+#endif
+    }
+}
+
+// What a snapshot is built from; seq is n records of rec_size bytes, gzi n_gzi 16-byte entries
+typedef struct {
+    const char *fai_path;        // Source .fai, whose size and mtime are recorded
+    const char *gzi_path;        // Source .gzi, NULL for uncompressed files
+    uint32_t format;
+    const char *names;
+    uint64_t names_len;
+    const uint64_t *name_off;
+    const void *seq;
+    uint32_t rec_size;
+    uint64_t n;
+    const faidx_name_slot_t *slots;
+    uint32_t mask;
+    const void *gzi;
+    uint64_t n_gzi;
+} faidx_snapshot_src_t;
+
+/* Helper: write all of len bytes to fd */
+static inline int faidx_snapshot_write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char*)data;
+    
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Helper: write len bytes then pad to a multiple of 8 */
+static inline int faidx_snapshot_put(int fd, const void *data, size_t len) {
+    static const char zeros[8] = {0};
+    size_t pad = (8 - len % 8) % 8;
+    
+    if (len && faidx_snapshot_write_all(fd, data, len) < 0) return -1;
+    if (pad && faidx_snapshot_write_all(fd, zeros, pad) < 0) return -1;
+    return 0;
+}
+
+/* Write a snapshot of src at the current position of fd */
+static inline int faidx_snapshot_emit(int fd, const faidx_snapshot_src_t *src) {
+    faidx_snapshot_hdr_t hdr;
+    
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FAIDX_SNAPSHOT_MAGIC, sizeof(FAIDX_SNAPSHOT_MAGIC));
+    hdr.version = FAIDX_SNAPSHOT_VERSION;
+    hdr.byte_order = FAIDX_SNAPSHOT_BYTE_ORDER;
+    hdr.rec_size = src->rec_size;
+    hdr.format = src->format;
+    faidx_snapshot_stat(src->fai_path, &hdr.fai_size, &hdr.fai_mtime);
+    if (src->n_gzi) faidx_snapshot_stat(src->gzi_path, &hdr.gzi_size, &hdr.gzi_mtime);
+    hdr.n = src->n;
+    hdr.names_len = src->names_len;
+    hdr.mask = src->mask;
+    hdr.n_gzi = src->n_gzi;
+    
+    /* Sections follow the header in this order, each padded to 8 bytes */
+    hdr.off_names = sizeof(hdr);
+    hdr.off_name_off = hdr.off_names + (src->names_len + 7) / 8 * 8;
+    hdr.off_seq = hdr.off_name_off + src->n * sizeof(uint64_t);
+    hdr.off_slots = hdr.off_seq + (src->n * src->rec_size + 7) / 8 * 8;
+    hdr.off_gzi = hdr.off_slots + ((uint64_t)src->mask + 1) * sizeof(faidx_name_slot_t);
+    
+    if (faidx_snapshot_put(fd, &hdr, sizeof(hdr)) < 0 ||
+        faidx_snapshot_put(fd, src->names, src->names_len) < 0 ||
+        faidx_snapshot_put(fd, src->name_off, src->n * sizeof(uint64_t)) < 0 ||
+        faidx_snapshot_put(fd, src->seq, src->n * src->rec_size) < 0 ||
+        faidx_snapshot_put(fd, src->slots, ((size_t)src->mask + 1) * sizeof(faidx_name_slot_t)) < 0 ||
+        faidx_snapshot_put(fd, src->gzi, src->n_gzi * 16) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Write a snapshot to path, atomically replacing any existing one */
+static inline int faidx_snapshot_write(const char *path, const faidx_snapshot_src_t *src) {
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp = (char*)malloc(tmp_len);
+    int fd, ret = -1;
+    
+    if (!tmp) return -1;
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+    
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) goto out;
+    if (faidx_snapshot_emit(fd, src) < 0) {
+        close(fd);
+        remove(tmp);
+        goto out;
+    }
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        goto out;
+    }
+    ret = 0;
+    
+out:
+    free(tmp);
+    return ret;
+}
+
+/* Helper: whether [off, off + len) is an aligned section inside a size-byte file */
+static inline int faidx_snapshot_section_ok(uint64_t off, uint64_t count, uint64_t elem,
+                                            uint64_t size) {
+    if (off % 8 || off > size) return 0;
+    if (elem && count > (size - off) / elem) return 0;
+    return 1;
+}
+
+/*
+ * Leading fields of a record, laid out as faidx1_t in faigz.h and
+ * faigz_minimal.h, and of a block index entry; used to vet a snapshot.
+ */
+typedef struct {
+    uint32_t line_len, line_blen;
+    uint64_t len, seq_offset, qual_offset;
+} faidx_snapshot_rec_t;
+
+typedef struct {
+    uint64_t caddr, uaddr;
+} faidx_snapshot_gzi_t;
+
+/* Helper: whether the bytes of a len-base record starting at offset stay below INT64_MAX */
+static inline int faidx_snapshot_extent_ok(const faidx_snapshot_rec_t *r, uint64_t offset) {
+    const uint64_t max = (uint64_t)INT64_MAX;
+    uint64_t span;
+    
+    if (r->len == 0) return offset <= max;
+    if ((r->len - 1) / r->line_blen > (max - r->line_blen) / r->line_len) return 0;
+    span = (r->len - 1) / r->line_blen * r->line_len + r->line_blen;
+    return offset <= max - span;
+}
+
+/*
+ * Helper: whether the sections hold what lookups and fetches rely on: names
+ * inside the arena, slot ids in [-1, n) with at least one empty slot so
+ * probes end, records with a line layout the seek math can use and extents
+ * that don't overflow, and a block index sorted by both offsets. Reads past
+ * the end of the data file are refused by the fetches themselves.
+ */
+static inline int faidx_snapshot_contents_ok(const faidx_snapshot_hdr_t *hdr, const char *base) {
+    const uint64_t *name_off = (const uint64_t*)(base + hdr->off_name_off);
+    const faidx_name_slot_t *slots = (const faidx_name_slot_t*)(base + hdr->off_slots);
+    const faidx_snapshot_gzi_t *gzi = (const faidx_snapshot_gzi_t*)(base + hdr->off_gzi);
+    int has_empty = 0;
+    
+    for (uint64_t i = 0; i < hdr->n; i++) {
+        if (name_off[i] >= hdr->names_len) return 0;
+    }
+    for (uint64_t k = 0; k <= hdr->mask; k++) {
+        if (slots[k].id == -1) has_empty = 1;
+        else if (slots[k].id < 0 || (uint64_t)slots[k].id >= hdr->n) return 0;
+    }
+    if (!has_empty) return 0;
+    
+    if (hdr->rec_size >= sizeof(faidx_snapshot_rec_t)) {
+        for (uint64_t i = 0; i < hdr->n; i++) {
+            faidx_snapshot_rec_t r;
+            memcpy(&r, base + hdr->off_seq + i * hdr->rec_size, sizeof(r));
+            if (r.line_len < r.line_blen || (r.len > 0 && r.line_blen == 0)) return 0;
+            if (!faidx_snapshot_extent_ok(&r, r.seq_offset) ||
+                !faidx_snapshot_extent_ok(&r, r.qual_offset)) {
+                return 0;
+            }
+        }
+    }
+    for (uint64_t i = 1; i < hdr->n_gzi; i++) {
+        if (gzi[i].caddr < gzi[i - 1].caddr || gzi[i].uaddr < gzi[i - 1].uaddr) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Check the size bytes of a snapshot at data and point snap's sections into
+ * it. Fails, leaving snap untouched, if it is malformed (down to what its
+ * sections hold, see faidx_snapshot_contents_ok), written for another
+ * layout or format, or older than the .fai/.gzi it was built from (pass
+ * gzi_path NULL for uncompressed files). snap->base and size are not set.
+ */
+static inline int faidx_snapshot_parse(const void *data, uint64_t size, const char *fai_path,
+                                       const char *gzi_path, uint32_t format, uint32_t rec_size,
+                                       faidx_snapshot_t *snap) {
+    const faidx_snapshot_hdr_t *hdr = (const faidx_snapshot_hdr_t*)data;
+    const char *base = (const char*)data;
+    uint64_t fai_size, fai_mtime, gzi_size, gzi_mtime;
+    
+    if (size < sizeof(faidx_snapshot_hdr_t)) return -1;
+    faidx_snapshot_stat(fai_path, &fai_size, &fai_mtime);
+    faidx_snapshot_stat(gzi_path, &gzi_size, &gzi_mtime);
+    
+    int ok = memcmp(hdr->magic, FAIDX_SNAPSHOT_MAGIC, sizeof(FAIDX_SNAPSHOT_MAGIC)) == 0 &&
+             hdr->version == FAIDX_SNAPSHOT_VERSION &&
+             hdr->byte_order == FAIDX_SNAPSHOT_BYTE_ORDER &&
+             hdr->rec_size == rec_size && hdr->format == format &&
+             hdr->fai_size == fai_size && hdr->fai_mtime == fai_mtime &&
+             (gzi_path ? hdr->n_gzi > 0 && hdr->gzi_size == gzi_size && hdr->gzi_mtime == gzi_mtime
+                       : hdr->n_gzi == 0) &&
+             hdr->n <= INT32_MAX && hdr->mask < UINT32_MAX && hdr->mask + 1 >= 2 * hdr->n &&
+             ((hdr->mask + 1) & hdr->mask) == 0 &&
+             faidx_snapshot_section_ok(hdr->off_names, hdr->names_len, 1, size) &&
+             faidx_snapshot_section_ok(hdr->off_name_off, hdr->n, sizeof(uint64_t), size) &&
+             faidx_snapshot_section_ok(hdr->off_seq, hdr->n, rec_size, size) &&
+             faidx_snapshot_section_ok(hdr->off_slots, hdr->mask + 1, sizeof(faidx_name_slot_t), size) &&
+             faidx_snapshot_section_ok(hdr->off_gzi, hdr->n_gzi, 16, size);
+    
+    /* Lookups strcmp into the arena, so it must end in a terminator */
+    if (ok && hdr->n > 0) {
+        ok = hdr->names_len > 0 && base[hdr->off_names + hdr->names_len - 1] == '\0';
+    }
+    if (!ok || !faidx_snapshot_contents_ok(hdr, base)) return -1;
+    
+    snap->hdr = hdr;
+    snap->names = base + hdr->off_names;
+    snap->name_off = (const uint64_t*)(base + hdr->off_name_off);
+    snap->seq = base + hdr->off_seq;
+    snap->slots = (const faidx_name_slot_t*)(base + hdr->off_slots);
+    snap->gzi = base + hdr->off_gzi;
+    return 0;
+}
+
+/* Map a snapshot file read-only; fails as faidx_snapshot_parse does, or if it's missing */
+static inline int faidx_snapshot_map(const char *path, const char *fai_path, const char *gzi_path,
+                                     uint32_t format, uint32_t rec_size, faidx_snapshot_t *snap) {
+    struct stat st;
+    void *base;
+    int fd = open(path, O_RDONLY);
+    
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(faidx_snapshot_hdr_t) ||
+        (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    
+    if (faidx_snapshot_parse(base, (uint64_t)st.st_size, fai_path, gzi_path, format, rec_size,
+                             snap) < 0) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+    snap->base = base;
+    snap->size = (size_t)st.st_size;
+    return 0;
+}
+
+/*
+ * POSIX shared memory segments hold the same snapshot behind a small header
+ * with a cross-process attach count, so every process on a host shares one
+ * physical copy. Segments are per user (mode 0600) and named after the
+ * .fai's device, inode, size and mtime and the .gzi's size and mtime, so a
+ * rebuilt index gets a fresh segment while processes still attached to the
+ * old one keep using it. The last process to detach removes the segment.
+ * A complete one left behind by a crashed process stays in /dev/shm until
+ * removed; a half-built one is removed by the next process to wait on it.
+ */
+#define FAIDX_SHM_DATA 64        // Offset of the snapshot in a segment
+#define FAIDX_SHM_WAIT_SECS 2    // How long to wait for another process to finish building one
+#define FAIDX_SHM_ABSENT (-2)    // faidx_shm_attach: no segment by that name
+
+typedef struct {
+    uint32_t ready;              // Set (release) once the snapshot after the header is complete
+    uint32_t pad;
+    int64_t attached;            // Metas attached; once 0 the segment is being removed
+} faidx_shm_hdr_t;
+
+/* Name of the segment for a .fai/.gzi pair, or -1 if the .fai can't be stat'ed */
+static inline int faidx_shm_name(const char *fai_path, const char *gzi_path, char *buf, size_t len) {
+    uint64_t v[4];
+    uint64_t h = 14695981039346656037ull;
+    struct stat st;
+    
+    if (stat(fai_path, &st) != 0) return -1;
+    faidx_snapshot_stat(fai_path, &v[0], &v[1]);
+    faidx_snapshot_stat(gzi_path, &v[2], &v[3]);
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b += 8) h = (h ^ ((v[i] >> b) & 0xff)) * 1099511628211ull;
+    }
+    snprintf(buf, len, "/faigz-%lx-%llx-%llx-%016llx", (unsigned long)getuid(),
+             (unsigned long long)st.st_dev, (unsigned long long)st.st_ino, (unsigned long long)h);
+    return 0;
+}
+
+/*
+ * Attach to an existing segment, waiting briefly for its creator to finish.
+ * Only segments owned by this user and closed to everyone else are used,
+ * since anyone could create one under the predictable name first. One that
+ * is still not ready once the wait is over and was last written before it
+ * began is taken to be left by a crashed creator and removed. Returns 0
+ * with snap covering the whole segment, FAIDX_SHM_ABSENT if there is no
+ * such segment (or the stale one was removed), or -1 if it can't be used.
+ */
+static inline int faidx_shm_attach(const char *name, const char *fai_path, const char *gzi_path,
+                                   uint32_t format, uint32_t rec_size, faidx_snapshot_t *snap) {
+    faidx_shm_hdr_t *sh = NULL;
+    void *base = MAP_FAILED;
+    size_t size = 0;
+    struct stat st;
+    time_t start = time(NULL), deadline = start + FAIDX_SHM_WAIT_SECS;
+    int delay_ms = 1, stale = 0;
+    int fd = shm_open(name, O_RDWR, 0);
+    
+    if (fd < 0) return errno == ENOENT ? FAIDX_SHM_ABSENT : -1;
+    if (fstat(fd, &st) != 0 || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    /* Map whatever has been written so far and remap once it is marked ready */
+    for (;;) {
+        if (fstat(fd, &st) != 0) break;
+        if ((uint64_t)st.st_size >= FAIDX_SHM_DATA + sizeof(faidx_snapshot_hdr_t) &&
+            (uint64_t)st.st_size <= SIZE_MAX) {
+            base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) break;
+            size = (size_t)st.st_size;
+            sh = (faidx_shm_hdr_t*)base;
+            if (__atomic_load_n(&sh->ready, __ATOMIC_ACQUIRE)) {
+                if (fstat(fd, &st) == 0 && (size_t)st.st_size == size) break;
+            }
+            munmap(base, size);
+            base = MAP_FAILED;
+        }
+        if (time(NULL) > deadline) {
+            stale = st.st_mtime < start;
+            break;
+        }
+        /* Back off up to 50 ms between looks rather than spin */
+        poll(NULL, 0, delay_ms);
+        if (delay_ms < 50) delay_ms *= 2;
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        if (stale && shm_unlink(name) == 0) return FAIDX_SHM_ABSENT;
+        return -1;
+    }
+    
+    /* A count of zero means the last user is removing it; never revive it */
+    int64_t n = __atomic_load_n(&sh->attached, __ATOMIC_RELAXED);
+    do {
+        if (n <= 0) {
+            munmap(base, size);
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&sh->attached, &n, n + 1, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    
+    if (faidx_snapshot_parse((const char*)base + FAIDX_SHM_DATA, size - FAIDX_SHM_DATA, fai_path,
+                             gzi_path, format, rec_size, snap) < 0) {
+        if (__atomic_sub_fetch(&sh->attached, 1, __ATOMIC_ACQ_REL) == 0) shm_unlink(name);
+        munmap(base, size);
+        return -1;
+    }
+    snap->base = base;
+    snap->size = size;
+    return 0;
+}
+
+/*
+ * Create a segment holding a snapshot of src and attach to it. Fails with
+ * errno EEXIST if another process got there first (attach to that instead).
+ */
+static inline int faidx_shm_create(const char *name, const faidx_snapshot_src_t *src,
+                                   faidx_snapshot_t *snap) {
+    faidx_shm_hdr_t hdr;
+    char pad[FAIDX_SHM_DATA - sizeof(faidx_shm_hdr_t)];
+    struct stat st;
+    void *base;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    
+    if (fd < 0) return -1;
+    memset(&hdr, 0, sizeof(hdr));
+    memset(pad, 0, sizeof(pad));
+    hdr.attached = 1;
+    if (faidx_snapshot_write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+        faidx_snapshot_write_all(fd, pad, sizeof(pad)) < 0 ||
+        faidx_snapshot_emit(fd, src) < 0 || fstat(fd, &st) != 0 ||
+        (uint64_t)st.st_size > SIZE_MAX) {
+        goto fail;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) goto fail;
+    close(fd);
+    
+    if (faidx_snapshot_parse((const char*)base + FAIDX_SHM_DATA, (uint64_t)st.st_size - FAIDX_SHM_DATA,
+                             src->fai_path, src->gzi_path, src->format, src->rec_size, snap) < 0) {
+        munmap(base, (size_t)st.st_size);
+        shm_unlink(name);
+        return -1;
+    }
+    snap->base = base;
+    snap->size = (size_t)st.st_size;
+    __atomic_store_n(&((faidx_shm_hdr_t*)base)->ready, 1, __ATOMIC_RELEASE);
+    return 0;
+    
+fail:
+    close(fd);
+    shm_unlink(name);
+    return -1;
+}
+
+/* Detach from a segment, removing it if this was the last user */
+static inline void faidx_shm_detach(const char *name, faidx_snapshot_t *snap) {
+    faidx_shm_hdr_t *sh = (faidx_shm_hdr_t*)snap->base;
+    
+    if (__atomic_sub_fetch(&sh->attached, 1, __ATOMIC_ACQ_REL) == 0) shm_unlink(name);
+    munmap(snap->base, snap->size);
+    snap->base = NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_INDEX_H */
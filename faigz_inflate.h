@@ -0,0 +1,208 @@
+#ifndef FAIGZ_INFLATE_H
+#define FAIGZ_INFLATE_H
+
+/*
+ * Inflate backends for BGZF blocks, shared by faigz.h, faigz_minimal.c and
+ * faigz_build.h. Every block is a complete raw deflate stream of at most
+ * 64KB, so one-shot decoders suit it better than zlib's streaming API.
+ * zlib is always built in; -DFAIGZ_USE_LIBDEFLATE or -DFAIGZ_USE_ISAL
+ * (set by the INFLATE option of the Makefile and FAIGZ_INFLATE in CMake)
+ * adds libdeflate or ISA-L and makes it the default. FAIGZ_INFLATE=zlib,
+ * libdeflate or isal in the environment picks among the built-in backends
+ * at run time. Everything is static inline, like faigz_index.h.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef FAIGZ_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef FAIGZ_USE_ISAL
+#include <isa-l/igzip_lib.h>
+#include <isa-l/crc.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAIDX_BGZF_HDR 18            // Gzip header carrying the BC extra subfield
+#define FAIDX_BGZF_FTR 8             // CRC32 and ISIZE
+#define FAIDX_BGZF_MAX 65536         // Bound on both the compressed and inflated size of a block
+
+enum faidx_inflate_type {
+    FAIDX_INFLATE_ZLIB = 0,
+    FAIDX_INFLATE_LIBDEFLATE = 1,
+    FAIDX_INFLATE_ISAL = 2
+};
+
+// Decoder state for one thread; zeroed is ready to use, set up on first inflate
+typedef struct {
+    int ready;
+    int type;                    // enum faidx_inflate_type, fixed once ready
+    z_stream zs;
+#ifdef FAIGZ_USE_LIBDEFLATE
+    struct libdeflate_decompressor *ld;
+#endif
+#ifdef FAIGZ_USE_ISAL
+    struct inflate_state *isal;  // Large, so kept off the stack
+#endif
+} faidx_inflater_t;
+
+static inline uint32_t faidx_bgzf_le32(const unsigned char *b) {
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+/* Total size of the BGZF block whose header is at hdr, or 0 if it isn't one */
+static inline size_t faidx_bgzf_block_size(const unsigned char *hdr) {
+    if (hdr[0] != 31 || hdr[1] != 139 || hdr[2] != 8 || !(hdr[3] & 4)) return 0;
+    if (hdr[10] != 6 || hdr[11] != 0 || hdr[12] != 'B' || hdr[13] != 'C' ||
+        hdr[14] != 2 || hdr[15] != 0) {
+        return 0;
+    }
+    size_t size = (size_t)(hdr[16] | hdr[17] << 8) + 1;
+    return size >= FAIDX_BGZF_HDR + FAIDX_BGZF_FTR ? size : 0;
+}
+
+/* Backend new inflaters use: the best one built in, unless FAIGZ_INFLATE names another */
+static inline int faidx_inflate_default(void) {
+    static int type = -1;
+    int t = __atomic_load_n(&type, __ATOMIC_RELAXED);
+    
+    if (t < 0) {
+        const char *env = getenv("FAIGZ_INFLATE");
+#if defined(FAIGZ_USE_ISAL)
+        t = FAIDX_INFLATE_ISAL;
+#elif defined(FAIGZ_USE_LIBDEFLATE)
+        t = FAIDX_INFLATE_LIBDEFLATE;
+#else
+        t = FAIDX_INFLATE_ZLIB;
+#endif
+        if (env && strcmp(env, "zlib") == 0) t = FAIDX_INFLATE_ZLIB;
+#ifdef FAIGZ_USE_LIBDEFLATE
+        if (env && strcmp(env, "libdeflate") == 0) t = FAIDX_INFLATE_LIBDEFLATE;
+#endif
+#ifdef FAIGZ_USE_ISAL
+        if (env && strcmp(env, "isal") == 0) t = FAIDX_INFLATE_ISAL;
+#endif
+        __atomic_store_n(&type, t, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+/* Name of the backend in use, for reporting */
+static inline const char *faidx_inflate_backend(void) {
+    switch (faidx_inflate_default()) {
+    case FAIDX_INFLATE_LIBDEFLATE: return "libdeflate";
+    case FAIDX_INFLATE_ISAL: return "isal";
+    default: return "zlib";
+    }
+}
+
+static inline void faidx_inflater_free(faidx_inflater_t *inf) {
+    if (!inf->ready) return;
+#ifdef FAIGZ_USE_LIBDEFLATE
+    if (inf->type == FAIDX_INFLATE_LIBDEFLATE) libdeflate_free_decompressor(inf->ld);
+#endif
+#ifdef FAIGZ_USE_ISAL
+    if (inf->type == FAIDX_INFLATE_ISAL) free(inf->isal);
+#endif
+    if (inf->type == FAIDX_INFLATE_ZLIB) inflateEnd(&inf->zs);
+    inf->ready = 0;
+}
+
+/* Inflate the raw deflate stream src into dst, returning the bytes written or -1 */
+static inline int64_t faidx_inflate_raw(faidx_inflater_t *inf, const void *src, size_t slen,
+                                        void *dst, size_t dlen) {
+    if (!inf->ready) {
+        inf->type = faidx_inflate_default();
+#ifdef FAIGZ_USE_LIBDEFLATE
+        if (inf->type == FAIDX_INFLATE_LIBDEFLATE && !(inf->ld = libdeflate_alloc_decompressor())) {
+            return -1;
+        }
+#endif
+#ifdef FAIGZ_USE_ISAL
+        if (inf->type == FAIDX_INFLATE_ISAL &&
+            !(inf->isal = (struct inflate_state*)malloc(sizeof(struct inflate_state)))) {
+            return -1;
+        }
+#endif
+        if (inf->type == FAIDX_INFLATE_ZLIB) {
+            memset(&inf->zs, 0, sizeof(inf->zs));
+            if (inflateInit2(&inf->zs, -15) != Z_OK) return -1;
+        }
+        inf->ready = 1;
+    }
+    
+#ifdef FAIGZ_USE_LIBDEFLATE
+    if (inf->type == FAIDX_INFLATE_LIBDEFLATE) {
+        size_t out;
+        if (libdeflate_deflate_decompress(inf->ld, src, slen, dst, dlen, &out) != LIBDEFLATE_SUCCESS) {
+            return -1;
+        }
+        return (int64_t)out;
+    }
+#endif
+#ifdef FAIGZ_USE_ISAL
+    if (inf->type == FAIDX_INFLATE_ISAL) {
+        struct inflate_state *st = inf->isal;
+        isal_inflate_init(st);
+        st->next_in = (uint8_t*)src;
+        st->avail_in = (uint32_t)slen;
+        st->next_out = (uint8_t*)dst;
+        st->avail_out = (uint32_t)dlen;
+        st->crc_flag = ISAL_DEFLATE;
+        if (isal_inflate_stateless(st) != ISAL_DECOMP_OK) return -1;
+        return (int64_t)st->total_out;
+    }
+#endif
+    
+    if (inflateReset(&inf->zs) != Z_OK) return -1;
+    inf->zs.next_in = (Bytef*)src;
+    inf->zs.avail_in = (uInt)slen;
+    inf->zs.next_out = (Bytef*)dst;
+    inf->zs.avail_out = (uInt)dlen;
+    if (inflate(&inf->zs, Z_FINISH) != Z_STREAM_END) return -1;
+    return (int64_t)inf->zs.total_out;
+}
+
+/* CRC-32 of inflated bytes, as gzip stores it, with the inflater's backend */
+static inline uint32_t faidx_inflate_crc32(const faidx_inflater_t *inf, const void *buf, size_t len) {
+#ifdef FAIGZ_USE_LIBDEFLATE
+    if (inf->type == FAIDX_INFLATE_LIBDEFLATE) return libdeflate_crc32(0, buf, len);
+#endif
+#ifdef FAIGZ_USE_ISAL
+    if (inf->type == FAIDX_INFLATE_ISAL) return crc32_gzip_refl(0, (const unsigned char*)buf, len);
+#endif
+    (void)inf;
+    return (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)buf, (uInt)len);
+}
+
+/*
+ * Inflate the whole BGZF block of blen bytes at block (header to footer)
+ * into dst, which has room for dlen bytes. Returns the inflated length, or
+ * -1 if the block is malformed or fails its length or CRC check.
+ */
+static inline int faidx_bgzf_inflate(faidx_inflater_t *inf, const uint8_t *block, size_t blen,
+                                     uint8_t *dst, size_t dlen) {
+    if (blen < FAIDX_BGZF_HDR + FAIDX_BGZF_FTR || faidx_bgzf_block_size(block) != blen) return -1;
+    
+    uint32_t crc = faidx_bgzf_le32(block + blen - 8), isize = faidx_bgzf_le32(block + blen - 4);
+    if (isize > dlen) return -1;
+    if (isize == 0) return 0;
+    
+    int64_t n = faidx_inflate_raw(inf, block + FAIDX_BGZF_HDR, blen - FAIDX_BGZF_HDR - FAIDX_BGZF_FTR,
+                                  dst, isize);
+    if (n != (int64_t)isize || faidx_inflate_crc32(inf, dst, isize) != crc) return -1;
+    return (int)isize;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_INFLATE_H */
@@ -1,54 +1,97 @@
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+
 #include "faigz_minimal.h"
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 // Hash table implementation
+
 static simple_hash_t *hash_init(void) {
     simple_hash_t *h = calloc(1, sizeof(simple_hash_t));
     if (!h) return NULL;
-    h->capacity = 16;
-    h->entries = calloc(h->capacity, sizeof(hash_entry_t));
-    if (!h->entries) {
+    h->slots = faidx_name_table_alloc(0, &h->mask);
+    if (!h->slots) {
         free(h);
         return NULL;
     }
     return h;
 }
 
-static void hash_destroy(simple_hash_t *h) {
+// Slots taken from a snapshot belong to its mapping, so only the header is freed
+static void hash_destroy(simple_hash_t *h, int owns_slots) {
     if (!h) return;
-    for (int i = 0; i < h->n_entries; i++) {
-        free(h->entries[i].key);
-    }
-    free(h->entries);
+    if (owns_slots) free(h->slots);
     free(h);
 }
 
-static int hash_put(simple_hash_t *h, const char *key, faidx1_t val) {
-    if (h->n_entries >= h->capacity) {
-        // Simple resize
-        h->capacity *= 2;
-        h->entries = realloc(h->entries, h->capacity * sizeof(hash_entry_t));
-        if (!h->entries) return -1;
+// Double the slot count, reinserting from the cached hashes
+static int hash_grow(simple_hash_t *h) {
+    uint32_t new_mask = h->mask * 2 + 1;
+    faidx_name_slot_t *slots = malloc(((size_t)new_mask + 1) * sizeof(faidx_name_slot_t));
+    if (!slots) return -1;
+    for (uint32_t i = 0; i <= new_mask; i++) {
+        slots[i].hash = 0;
+        slots[i].id = -1;
     }
     
-    h->entries[h->n_entries].key = strdup(key);
-    h->entries[h->n_entries].val = val;
-    h->n_entries++;
+    for (uint32_t i = 0; i <= h->mask; i++) {
+        if (h->slots[i].id < 0) continue;
+        uint32_t k = h->slots[i].hash & new_mask;
+        while (slots[k].id >= 0) k = (k + 1) & new_mask;
+        slots[k] = h->slots[i];
+    }
+    
+    free(h->slots);
+    h->slots = slots;
+    h->mask = new_mask;
     return 0;
 }
 
-static faidx1_t *hash_get(simple_hash_t *h, const char *key) {
-    for (int i = 0; i < h->n_entries; i++) {
-        if (strcmp(h->entries[i].key, key) == 0) {
-            return &h->entries[i].val;
-        }
+// Name of sequence id; offsets stay valid while the arena grows
+static const char *seq_name(const faidx_meta_t *meta, int id) {
+    return meta->names.s + meta->name_off[id];
+}
+
+// Find the id of key, or -1; names are resolved through the arena
+static int hash_get_id(const faidx_meta_t *meta, const char *key) {
+    const simple_hash_t *h = meta->hash;
+    return faidx_name_find(h->slots, h->mask, meta->names.s, meta->name_off, key);
+}
+
+// Insert id under its name; returns 1 if added, 0 if the name was already present
+static int hash_put(faidx_meta_t *meta, int id) {
+    simple_hash_t *h = meta->hash;
+    
+    // Keep the load factor at or below one half
+    if ((uint32_t)(h->n_entries + 1) > (h->mask + 1) / 2 && hash_grow(h) < 0) return -1;
+    
+    if (!faidx_name_insert(h->slots, h->mask, meta->names.s, meta->name_off, seq_name(meta, id), id)) {
+        return 0;
     }
-    return NULL;
+    h->n_entries++;
+    return 1;
+}
+
+static faidx1_t *hash_get(const faidx_meta_t *meta, const char *key) {
+    int id = hash_get_id(meta, key);
+    return id < 0 ? NULL : &meta->seq[id];
 }
 
 // Utility functions
+static int ks_grow(kstring_t *ks, size_t size) {
+    if (ks->m >= size) return 0;
+    size_t new_m = size + (size >> 1);
+    char *s = realloc(ks->s, new_m);
+    if (!s) return -1;
+    ks->s = s;
+    ks->m = new_m;
+    return 0;
+}
+
 static char *str_dup(const char *str) {
     if (!str) return NULL;
     int len = strlen(str) + 1;
@@ -71,85 +114,6 @@ static int is_bgzf_file(const char *filename) {
     return is_bgzf;
 }
 
-static int create_fai_index(const char *fasta_path, const char *fai_path) {
-    FILE *fasta_fp = fopen(fasta_path, "r");
-    if (!fasta_fp) return -1;
-    
-    FILE *fai_fp = fopen(fai_path, "w");
-    if (!fai_fp) {
-        fclose(fasta_fp);
-        return -1;
-    }
-    
-    char line[1024];
-    char seq_name[256] = {0};
-    uint64_t seq_len = 0;
-    uint64_t seq_offset = 0;
-    uint32_t line_blen = 0;
-    uint32_t line_len = 0;
-    int in_sequence = 0;
-    uint64_t current_offset = 0;
-    
-    while (fgets(line, sizeof(line), fasta_fp)) {
-        int line_length = strlen(line);
-        
-        if (line[0] == '>') {
-            // If we were processing a sequence, write its index entry
-            if (in_sequence && seq_name[0]) {
-                fprintf(fai_fp, "%s\t%lu\t%lu\t%u\t%u\n", 
-                       seq_name, seq_len, seq_offset, line_blen, line_len);
-            }
-            
-            // Start new sequence
-            in_sequence = 1;
-            seq_len = 0;
-            seq_offset = current_offset + line_length;
-            line_blen = 0;
-            line_len = 0;
-            
-            // Extract sequence name (everything after '>' until whitespace)
-            char *name_start = line + 1;
-            char *name_end = name_start;
-            while (*name_end && *name_end != ' ' && *name_end != '\t' && *name_end != '\n') {
-                name_end++;
-            }
-            int name_len = name_end - name_start;
-            if (name_len >= sizeof(seq_name)) name_len = sizeof(seq_name) - 1;
-            strncpy(seq_name, name_start, name_len);
-            seq_name[name_len] = '\0';
-            
-        } else if (in_sequence && line[0] != '\n' && line[0] != '\r') {
-            // Count sequence characters (excluding newlines)
-            int bases_in_line = 0;
-            for (int i = 0; i < line_length; i++) {
-                if (line[i] != '\n' && line[i] != '\r') {
-                    bases_in_line++;
-                }
-            }
-            
-            seq_len += bases_in_line;
-            
-            // Set line length info from first line of sequence
-            if (line_blen == 0) {
-                line_blen = bases_in_line;
-                line_len = line_length;
-            }
-        }
-        
-        current_offset += line_length;
-    }
-    
-    // Write final sequence entry
-    if (in_sequence && seq_name[0]) {
-        fprintf(fai_fp, "%s\t%lu\t%lu\t%u\t%u\n", 
-               seq_name, seq_len, seq_offset, line_blen, line_len);
-    }
-    
-    fclose(fasta_fp);
-    fclose(fai_fp);
-    return 0;
-}
-
 static int load_fai_index(faidx_meta_t *meta, const char *fai_path) {
     FILE *fp = fopen(fai_path, "r");
     if (!fp) return -1;
@@ -170,41 +134,291 @@ static int load_fai_index(faidx_meta_t *meta, const char *fai_path) {
         
         // Expand arrays if needed
         if (idx >= meta->m) {
-            meta->m = meta->m ? meta->m * 2 : 16;
-            meta->name = realloc(meta->name, meta->m * sizeof(char*));
-            if (!meta->name) {
+            int new_m = meta->m ? meta->m * 2 : 16;
+            uint64_t *new_off = realloc(meta->name_off, new_m * sizeof(uint64_t));
+            if (new_off) meta->name_off = new_off;
+            faidx1_t *new_seq = realloc(meta->seq, new_m * sizeof(faidx1_t));
+            if (new_seq) meta->seq = new_seq;
+            if (!new_off || !new_seq) {
                 fclose(fp);
                 return -1;
             }
+            meta->m = new_m;
         }
         
-        meta->name[idx] = str_dup(name);
-        if (!meta->name[idx]) {
+        // Names are appended to one arena rather than allocated one by one
+        size_t name_len = strlen(name) + 1;
+        if (ks_grow(&meta->names, meta->names.l + name_len) < 0) {
             fclose(fp);
             return -1;
         }
+        memcpy(meta->names.s + meta->names.l, name, name_len);
+        meta->name_off[idx] = meta->names.l;
+        meta->names.l += name_len;
         
         faidx1_t val;
-        val.id = idx;
         val.len = atoll(len_str);
         val.seq_offset = atoll(offset_str);
         val.line_blen = atoi(line_blen_str);
         val.line_len = atoi(line_len_str);
         val.qual_offset = 0; // For FASTQ, this would be calculated
         
-        if (hash_put(meta->hash, name, val) < 0) {
+        meta->seq[idx] = val;
+        int added = hash_put(meta, idx);
+        if (added < 0) {
             fclose(fp);
             return -1;
         }
+        if (!added) {
+            // Duplicate name: keep the first entry, as htslib does
+            meta->names.l -= name_len;
+            continue;
+        }
         
         idx++;
+        meta->n = idx;
     }
     
-    meta->n = idx;
     fclose(fp);
     return 0;
 }
 
+// BGZF support: blocks are located through the .gzi and inflated with zlib
+
+static uint64_t le_u64(const unsigned char *b) {
+    return (uint64_t)faidx_bgzf_le32(b) | (uint64_t)faidx_bgzf_le32(b + 4) << 32;
+}
+
+// Read exactly len bytes at offset
+static int pread_all(int fd, void *buf, size_t len, uint64_t offset) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int add_gzi_entry(faidx_meta_t *meta, int64_t *m, uint64_t caddr, uint64_t uaddr) {
+    if (meta->n_gzi == *m) {
+        int64_t new_m = *m ? *m * 2 : 1024;
+        gzi_entry_t *gzi = realloc(meta->gzi, (size_t)new_m * sizeof(gzi_entry_t));
+        if (!gzi) return -1;
+        meta->gzi = gzi;
+        *m = new_m;
+    }
+    meta->gzi[meta->n_gzi].caddr = caddr;
+    meta->gzi[meta->n_gzi].uaddr = uaddr;
+    meta->n_gzi++;
+    return 0;
+}
+
+// Index a BGZF file that has no .gzi by walking its block headers and sizes
+static int build_gzi_index(faidx_meta_t *meta) {
+    unsigned char hdr[FAIDX_BGZF_HDR], isize[4];
+    uint64_t caddr = 0, uaddr = 0;
+    int64_t m = 0;
+    int ret = -1;
+    int fd = open(meta->fasta_path, O_RDONLY);
+    
+    if (fd < 0) return -1;
+    while (caddr < meta->file_size) {
+        if (pread_all(fd, hdr, sizeof(hdr), caddr) < 0) goto out;
+        size_t bsize = faidx_bgzf_block_size(hdr);
+        if (!bsize || caddr + bsize > meta->file_size) goto out;
+        if (pread_all(fd, isize, sizeof(isize), caddr + bsize - 4) < 0) goto out;
+        
+        // Empty blocks such as the EOF marker hold nothing to seek to, so like htslib skip them
+        uint32_t n = faidx_bgzf_le32(isize);
+        if ((n > 0 || caddr == 0) && add_gzi_entry(meta, &m, caddr, uaddr) < 0) goto out;
+        uaddr += n;
+        caddr += bsize;
+    }
+    ret = 0;
+    
+out:
+    close(fd);
+    return ret;
+}
+
+// Load the .gzi, or index the blocks in memory if it's missing
+static int load_gzi_index(faidx_meta_t *meta) {
+    unsigned char b[16];
+    uint64_t n;
+    int64_t m = 0;
+    FILE *fp = fopen(meta->gzi_path, "rb");
+    
+    if (!fp) return build_gzi_index(meta);
+    
+    // Each entry describes a block of at least FAIDX_BGZF_HDR + FAIDX_BGZF_FTR bytes
+    if (fread(b, 1, 8, fp) != 8) goto fail;
+    n = le_u64(b);
+    if (n > meta->file_size / (FAIDX_BGZF_HDR + FAIDX_BGZF_FTR)) goto fail;
+    
+    if (add_gzi_entry(meta, &m, 0, 0) < 0) goto fail;
+    for (uint64_t i = 0; i < n; i++) {
+        if (fread(b, 1, 16, fp) != 16) goto fail;
+        if (add_gzi_entry(meta, &m, le_u64(b), le_u64(b + 8)) < 0) goto fail;
+    }
+    fclose(fp);
+    return 0;
+    
+fail:
+    fclose(fp);
+    return -1;
+}
+
+// Index of the block holding uncompressed offset uoffset
+static int64_t find_block(const faidx_meta_t *meta, uint64_t uoffset) {
+    int64_t lo = 0, hi = meta->n_gzi - 1;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo + 1) / 2;
+        if (meta->gzi[mid].uaddr <= uoffset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Inflate the whole block of blen bytes at block into reader->blk, checking its CRC
+static int inflate_block(faidx_reader_t *reader, const unsigned char *block, size_t blen,
+                         uint64_t caddr) {
+    reader->blk_caddr = UINT64_MAX;
+    int n = faidx_bgzf_inflate(&reader->inflater, block, blen, reader->blk, FAIDX_BGZF_MAX);
+    if (n < 0) return -1;
+    
+    reader->blk_len = (size_t)n;
+    reader->blk_caddr = caddr;
+    return 0;
+}
+
+// Get [first, first + span) of the uncompressed stream, inflating only the blocks
+// it touches. src points into the last inflated block when one holds the whole
+// span, and into reader->buf otherwise.
+static int read_bgzf(faidx_reader_t *reader, uint64_t first, size_t span, const char **src) {
+    const faidx_meta_t *meta = reader->meta;
+    int64_t i = find_block(meta, first), k;
+    uint64_t uaddr = meta->gzi[i].uaddr, caddr = meta->gzi[i].caddr;
+    size_t pos = 0, copied = 0;
+    
+    // The block inflated by the previous fetch may already hold it
+    if (reader->blk_caddr == caddr && first - uaddr + span <= reader->blk_len) {
+        *src = (const char*)reader->blk + (first - uaddr);
+        return 0;
+    }
+    
+    // Blocks i to k - 1 cover the span; read their compressed bytes at once
+    for (k = i + 1; k < meta->n_gzi && meta->gzi[k].uaddr < first + span; k++) ;
+    uint64_t cend = k < meta->n_gzi ? meta->gzi[k].caddr : meta->file_size;
+    if (cend <= caddr || cend - caddr >= SIZE_MAX) return -1;
+    size_t clen = (size_t)(cend - caddr);
+    if (ks_grow(&reader->cbuf, clen) < 0) return -1;
+    if (pread_all(reader->fd, reader->cbuf.s, clen, caddr) < 0) return -1;
+    
+    while (copied < span) {
+        const unsigned char *block = (const unsigned char*)reader->cbuf.s + pos;
+        if (pos + FAIDX_BGZF_HDR > clen) return -1;
+        size_t bsize = faidx_bgzf_block_size(block);
+        if (!bsize || pos + bsize > clen) return -1;
+        if (caddr + pos != reader->blk_caddr &&
+            inflate_block(reader, block, bsize, caddr + pos) < 0) {
+            return -1;
+        }
+        
+        uint64_t want = first + copied;
+        if (want < uaddr + reader->blk_len) {
+            size_t off = (size_t)(want - uaddr);
+            size_t n = reader->blk_len - off;
+            
+            // All in one block: no need to assemble it in buf
+            if (copied == 0 && n >= span) {
+                *src = (const char*)reader->blk + off;
+                return 0;
+            }
+            if (n > span - copied) n = span - copied;
+            if (ks_grow(&reader->buf, span) < 0) return -1;
+            memcpy(reader->buf.s + copied, reader->blk + off, n);
+            copied += n;
+        }
+        uaddr += reader->blk_len;
+        pos += bsize;
+    }
+    *src = reader->buf.s;
+    return 0;
+}
+
+// Map an uncompressed file read-only, leaving meta->map NULL on failure
+static void map_file(faidx_meta_t *meta) {
+    struct stat st;
+    int fd = open(meta->fasta_path, O_RDONLY);
+    
+    if (fd < 0) return;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (uint64_t)st.st_size <= SIZE_MAX) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            meta->map = p;
+            meta->map_size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+}
+
+// Path of the snapshot kept next to the .fai, or NULL
+static char *snapshot_path(const faidx_meta_t *meta) {
+    size_t len = strlen(meta->fai_path) + 5;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s.bin", meta->fai_path);
+    return path;
+}
+
+// Take the names, records, name table and block index from a current .fai.bin instead of parsing
+static int load_snapshot(faidx_meta_t *meta) {
+    char *path = snapshot_path(meta);
+    faidx_snapshot_t snap;
+    
+    if (!path) return -1;
+    int ret = faidx_snapshot_map(path, meta->fai_path, meta->is_bgzf ? meta->gzi_path : NULL,
+                                 (uint32_t)meta->format, sizeof(faidx1_t), &snap);
+    free(path);
+    if (ret < 0) return -1;
+    
+    // Everything is only ever read through these, so they can point into the mapping
+    free(meta->hash->slots);
+    meta->snapshot = snap;
+    meta->hash->slots = (faidx_name_slot_t*)snap.slots;
+    meta->hash->mask = (uint32_t)snap.hdr->mask;
+    meta->hash->n_entries = (int)snap.hdr->n;
+    meta->names.s = (char*)snap.names;
+    meta->names.l = meta->names.m = (size_t)snap.hdr->names_len;
+    meta->name_off = (uint64_t*)snap.name_off;
+    meta->seq = (faidx1_t*)snap.seq;
+    meta->n = meta->m = (int)snap.hdr->n;
+    meta->gzi = meta->is_bgzf ? (gzi_entry_t*)snap.gzi : NULL;
+    meta->n_gzi = meta->is_bgzf ? (int64_t)snap.hdr->n_gzi : 0;
+    return 0;
+}
+
+// Save the parsed index for the next load (best effort). Quality offsets
+// aren't parsed here, so only FASTA qualifies.
+static void save_snapshot(const faidx_meta_t *meta) {
+    if (meta->format != FAI_FASTA) return;
+    
+    faidx_snapshot_src_t src = {
+        meta->fai_path, meta->is_bgzf ? meta->gzi_path : NULL, (uint32_t)meta->format,
+        meta->names.s, meta->names.l, meta->name_off, meta->seq, sizeof(faidx1_t),
+        (uint64_t)meta->n, meta->hash->slots, meta->hash->mask, meta->gzi,
+        (uint64_t)meta->n_gzi
+    };
+    char *path = snapshot_path(meta);
+    if (!path) return;
+    faidx_snapshot_write(path, &src);
+    free(path);
+}
+
 // Public API implementation
 faidx_meta_t *faidx_meta_load(const char *filename, fai_format_options format, int flags) {
     if (!filename) return NULL;
@@ -246,34 +460,48 @@ faidx_meta_t *faidx_meta_load(const char *filename, fai_format_options format, i
         return NULL;
     }
     
-    // Try to load the index, or create it if it doesn't exist and FAI_CREATE is set
-    if (load_fai_index(meta, meta->fai_path) < 0) {
-        if (flags & FAI_CREATE) {
-            // Try to create the index
-            if (create_fai_index(meta->fasta_path, meta->fai_path) < 0) {
-                faidx_meta_destroy(meta);
-                return NULL;
-            }
-            // Now try to load the newly created index
-            if (load_fai_index(meta, meta->fai_path) < 0) {
-                faidx_meta_destroy(meta);
-                return NULL;
-            }
-        } else {
+    // The last block of a BGZF file ends where the file does
+    if (meta->is_bgzf) {
+        struct stat st;
+        if (stat(filename, &st) != 0) {
             faidx_meta_destroy(meta);
             return NULL;
         }
+        meta->file_size = (uint64_t)st.st_size;
     }
     
+    // A current snapshot replaces parsing the index altogether
+    if (!(flags & FAI_SNAPSHOT) || load_snapshot(meta) < 0) {
+        // Build the .fai (and .gzi) in parallel if asked to and either is missing
+        if ((flags & FAI_CREATE) && format == FAI_FASTA &&
+            (access(meta->fai_path, F_OK) != 0 ||
+             (meta->is_bgzf && access(meta->gzi_path, F_OK) != 0)) &&
+            faidx_build_index(filename, meta->fai_path, meta->gzi_path, faidx_build_threads()) < 0) {
+            faidx_meta_destroy(meta);
+            return NULL;
+        }
+        if (load_fai_index(meta, meta->fai_path) < 0) {
+            faidx_meta_destroy(meta);
+            return NULL;
+        }
+        if (meta->is_bgzf && load_gzi_index(meta) < 0) {
+            faidx_meta_destroy(meta);
+            return NULL;
+        }
+        if (flags & FAI_SNAPSHOT) save_snapshot(meta);
+    }
+    
+    // Uncompressed files are served from one mapping shared by all readers
+    if (!meta->is_bgzf) map_file(meta);
+    
     return meta;
 }
 
 faidx_meta_t *faidx_meta_ref(faidx_meta_t *meta) {
     if (!meta) return NULL;
     
-    pthread_mutex_lock(&meta->mutex);
-    meta->ref_count++;
-    pthread_mutex_unlock(&meta->mutex);
+    // New references come from existing ones, so no ordering is needed
+    __atomic_add_fetch(&meta->ref_count, 1, __ATOMIC_RELAXED);
     
     return meta;
 }
@@ -281,21 +509,22 @@ faidx_meta_t *faidx_meta_ref(faidx_meta_t *meta) {
 void faidx_meta_destroy(faidx_meta_t *meta) {
     if (!meta) return;
     
-    pthread_mutex_lock(&meta->mutex);
-    meta->ref_count--;
-    int should_free = (meta->ref_count <= 0);
-    pthread_mutex_unlock(&meta->mutex);
+    // Release our uses; whoever drops the last reference acquires everyone else's
+    int should_free = __atomic_sub_fetch(&meta->ref_count, 1, __ATOMIC_ACQ_REL) <= 0;
     
     if (should_free) {
-        if (meta->hash) hash_destroy(meta->hash);
-        
-        if (meta->name) {
-            for (int i = 0; i < meta->n; i++) {
-                free(meta->name[i]);
-            }
-            free(meta->name);
+        if (meta->snapshot.base) {
+            hash_destroy(meta->hash, 0);
+            munmap(meta->snapshot.base, meta->snapshot.size);
+        } else {
+            hash_destroy(meta->hash, 1);
+            free(meta->names.s);
+            free(meta->name_off);
+            free(meta->seq);
+            free(meta->gzi);
         }
         
+        if (meta->map) munmap((void*)meta->map, meta->map_size);
         free(meta->fasta_path);
         free(meta->fai_path);
         free(meta->gzi_path);
@@ -312,20 +541,21 @@ faidx_reader_t *faidx_reader_create(faidx_meta_t *meta) {
     if (!reader) return NULL;
     
     reader->meta = faidx_meta_ref(meta);
+    reader->fd = -1;
+    reader->blk_caddr = UINT64_MAX;
     
-    // Open file
+    // Open file; BGZF blocks are read at known offsets, so they need no stream
     if (meta->is_bgzf) {
-        reader->gzfp = gzopen(meta->fasta_path, "r");
-        if (!reader->gzfp) {
-            faidx_meta_destroy(reader->meta);
-            free(reader);
+        reader->fd = open(meta->fasta_path, O_RDONLY);
+        reader->blk = malloc(FAIDX_BGZF_MAX);
+        if (reader->fd < 0 || !reader->blk) {
+            faidx_reader_destroy(reader);
             return NULL;
         }
-    } else {
+    } else if (!meta->map) {
         reader->fp = fopen(meta->fasta_path, "r");
         if (!reader->fp) {
-            faidx_meta_destroy(reader->meta);
-            free(reader);
+            faidx_reader_destroy(reader);
             return NULL;
         }
     }
@@ -337,78 +567,161 @@ void faidx_reader_destroy(faidx_reader_t *reader) {
     if (!reader) return;
     
     if (reader->fp) fclose(reader->fp);
-    if (reader->gzfp) gzclose(reader->gzfp);
+    if (reader->fd >= 0) close(reader->fd);
+    faidx_inflater_free(&reader->inflater);
+    free(reader->view.s);
+    free(reader->buf.s);
+    free(reader->cbuf.s);
+    free(reader->blk);
     
     faidx_meta_destroy(reader->meta);
     free(reader);
 }
 
-char *faidx_reader_fetch_seq(faidx_reader_t *reader, const char *c_name,
-                           hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
-    if (!reader || !c_name) return NULL;
-    
-    faidx1_t *entry = hash_get(reader->meta->hash, c_name);
-    if (!entry) return NULL;
-    
+// Fetch [p_beg_i, p_end_i) of a resolved record into out
+static hts_pos_t fetch_entry_into(faidx_reader_t *reader, const faidx1_t *entry,
+                                  hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
     // Adjust coordinates
     if (p_beg_i < 0) p_beg_i = 0;
-    if (p_end_i < 0 || p_end_i > entry->len) p_end_i = entry->len;
-    if (p_beg_i >= p_end_i) return NULL;
+    if (p_end_i < 0 || p_end_i > (hts_pos_t)entry->len) p_end_i = entry->len;
+    if (p_beg_i >= p_end_i) return -1;
     
     hts_pos_t seq_len = p_end_i - p_beg_i;
-    char *seq = malloc(seq_len + 1);
-    if (!seq) return NULL;
-    
-    // Simple implementation - seek to position and read
-    // This is a simplified version that doesn't handle all edge cases
-    if (reader->meta->is_bgzf) {
-        gzseek(reader->gzfp, entry->seq_offset, SEEK_SET);
-        // Skip to the right line and position
-        // This is a simplified implementation
-        if (len) *len = 0;
-        free(seq);
-        return NULL; // Not implemented for compressed files in this minimal version
+    if ((uint64_t)seq_len >= SIZE_MAX - 1) return -1;
+    if (ks_grow(out, (size_t)seq_len + 1) < 0) return -1;
+    char *seq = out->s;
+    out->l = 0;
+    
+    if (entry->line_blen == 0 || entry->line_len < entry->line_blen) return -1;
+    
+    // File span from the first base to the last, using the line layout (64-bit offsets)
+    uint64_t first = entry->seq_offset
+                   + (uint64_t)p_beg_i / entry->line_blen * entry->line_len
+                   + (uint64_t)p_beg_i % entry->line_blen;
+    uint64_t last = entry->seq_offset
+                  + (uint64_t)(p_end_i - 1) / entry->line_blen * entry->line_len
+                  + (uint64_t)(p_end_i - 1) % entry->line_blen;
+    size_t span = (size_t)(last - first + 1);
+    const char *src;
+    
+    // Mapped files are stripped in place; otherwise read the span in one go
+    if (reader->meta->map) {
+        if (last >= reader->meta->map_size) return -1;
+        src = reader->meta->map + first;
+    } else if (reader->meta->is_bgzf) {
+        if (read_bgzf(reader, first, span, &src) < 0) return -1;
     } else {
-        fseek(reader->fp, entry->seq_offset, SEEK_SET);
-        
-        // Skip to the correct position
-        hts_pos_t pos = 0;
-        hts_pos_t line_pos = 0;
-        int c;
-        
-        while (pos < p_beg_i && (c = fgetc(reader->fp)) != EOF) {
-            if (c == '\n') {
-                line_pos = 0;
-            } else if (c != '\r') {
-                pos++;
-                line_pos++;
-            }
-        }
-        
-        // Read the sequence
-        hts_pos_t read_len = 0;
-        while (read_len < seq_len && (c = fgetc(reader->fp)) != EOF) {
-            if (c == '\n' || c == '\r') {
-                continue;
-            }
-            if (c == '>' || c == '+') {
-                break; // Hit next sequence
-            }
-            seq[read_len++] = c;
-        }
-        
-        seq[read_len] = '\0';
-        if (len) *len = read_len;
-        return seq;
+        if (!reader->fp || ks_grow(&reader->buf, span) < 0) return -1;
+        if (fseeko(reader->fp, (off_t)first, SEEK_SET) != 0) return -1;
+        if (fread(reader->buf.s, 1, span, reader->fp) != span) return -1;
+        src = reader->buf.s;
+    }
+    
+    faidx_simd_copy_lines(seq, src, seq_len, (uint64_t)p_beg_i,
+                          entry->line_blen, entry->line_len, reader->seq_mode);
+    seq[seq_len] = '\0';
+    out->l = (size_t)seq_len;
+    return seq_len;
+}
+
+hts_pos_t faidx_reader_fetch_seq_into(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    if (!reader || !c_name || !out) return -1;
+    
+    faidx1_t *entry = hash_get(reader->meta, c_name);
+    if (!entry) return -2;
+    return fetch_entry_into(reader, entry, p_beg_i, p_end_i, out);
+}
+
+// Ids index meta->seq directly, skipping the name hash
+hts_pos_t faidx_reader_fetch_seq_id_into(faidx_reader_t *reader, int tid,
+                                       hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    if (!reader || !out) return -1;
+    if (tid < 0 || tid >= reader->meta->n) return -2;
+    return fetch_entry_into(reader, &reader->meta->seq[tid], p_beg_i, p_end_i, out);
+}
+
+int faidx_reader_set_seq_mode(faidx_reader_t *reader, enum faidx_seq_mode mode) {
+    if (!reader || (mode != FAIDX_SEQ_AS_IS && mode != FAIDX_SEQ_UPPER && mode != FAIDX_SEQ_MASK_N)) {
+        return -1;
+    }
+    reader->seq_mode = mode;
+    return 0;
+}
+
+hts_pos_t faidx_reader_fetch_seq_view(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, const char **seq) {
+    if (!reader || !c_name || !seq) return -1;
+    
+    faidx1_t *entry = hash_get(reader->meta, c_name);
+    if (!entry) return -2;
+    
+    if (p_beg_i < 0) p_beg_i = 0;
+    if (p_end_i < 0 || p_end_i > (hts_pos_t)entry->len) p_end_i = entry->len;
+    
+    // Zero copy when no line terminator falls inside the region
+    if (reader->meta->map && reader->seq_mode == FAIDX_SEQ_AS_IS && p_beg_i < p_end_i &&
+        entry->line_blen > 0 &&
+        (uint64_t)p_beg_i / entry->line_blen == (uint64_t)(p_end_i - 1) / entry->line_blen) {
+        uint64_t offset = entry->seq_offset
+                        + (uint64_t)p_beg_i / entry->line_blen * entry->line_len
+                        + (uint64_t)p_beg_i % entry->line_blen;
+        if (offset + (uint64_t)(p_end_i - p_beg_i) > reader->meta->map_size) return -1;
+        *seq = reader->meta->map + offset;
+        return p_end_i - p_beg_i;
+    }
+    
+    hts_pos_t n = faidx_reader_fetch_seq_into(reader, c_name, p_beg_i, p_end_i, &reader->view);
+    if (n >= 0) *seq = reader->view.s;
+    return n;
+}
+
+hts_pos_t faidx_reader_fetch_qual_into(faidx_reader_t *reader, const char *c_name,
+                                     hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out) {
+    (void)c_name; (void)p_beg_i; (void)p_end_i; (void)out;
+    if (!reader || reader->meta->format != FAI_FASTQ) return -2;
+    // Quality string fetching not implemented in this minimal version
+    return -1;
+}
+
+char *faidx_reader_fetch_seq(faidx_reader_t *reader, const char *c_name,
+                           hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_seq_into(reader, c_name, p_beg_i, p_end_i, &ks);
+    
+    if (n < 0) {
+        free(ks.s);
+        return NULL;
     }
+    if (len) *len = n;
+    return ks.s;
+}
+
+char *faidx_reader_fetch_seq_id(faidx_reader_t *reader, int tid,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_seq_id_into(reader, tid, p_beg_i, p_end_i, &ks);
+    
+    if (n < 0) {
+        free(ks.s);
+        return NULL;
+    }
+    if (len) *len = n;
+    return ks.s;
 }
 
 char *faidx_reader_fetch_qual(faidx_reader_t *reader, const char *c_name,
                             hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len) {
-    if (!reader || reader->meta->format != FAI_FASTQ) return NULL;
-    // Quality string fetching not implemented in this minimal version
-    if (len) *len = 0;
-    return NULL;
+    kstring_t ks = {0, 0, NULL};
+    hts_pos_t n = faidx_reader_fetch_qual_into(reader, c_name, p_beg_i, p_end_i, &ks);
+    
+    if (n < 0) {
+        free(ks.s);
+        if (len) *len = 0;
+        return NULL;
+    }
+    if (len) *len = n;
+    return ks.s;
 }
 
 int faidx_meta_nseq(const faidx_meta_t *meta) {
@@ -416,19 +729,24 @@ int faidx_meta_nseq(const faidx_meta_t *meta) {
 }
 
 const char *faidx_meta_iseq(const faidx_meta_t *meta, int i) {
-    return (meta && i >= 0 && i < meta->n) ? meta->name[i] : NULL;
+    return (meta && i >= 0 && i < meta->n) ? seq_name(meta, i) : NULL;
 }
 
 hts_pos_t faidx_meta_seq_len(const faidx_meta_t *meta, const char *seq) {
     if (!meta || !seq) return -1;
     
-    faidx1_t *entry = hash_get(meta->hash, seq);
-    return entry ? entry->len : -1;
+    faidx1_t *entry = hash_get(meta, seq);
+    return entry ? (hts_pos_t)entry->len : -1;
+}
+
+hts_pos_t faidx_meta_seq_len_id(const faidx_meta_t *meta, int tid) {
+    if (!meta || tid < 0 || tid >= meta->n) return -1;
+    return meta->seq[tid].len;
 }
 
 int faidx_meta_has_seq(const faidx_meta_t *meta, const char *seq) {
     if (!meta || !seq) return 0;
     
-    faidx1_t *entry = hash_get(meta->hash, seq);
+    faidx1_t *entry = hash_get(meta, seq);
     return entry != NULL;
 }
\ No newline at end of file
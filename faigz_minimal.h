@@ -9,6 +9,11 @@
 #include <inttypes.h>
 #include <zlib.h>
 
+#include "faigz_simd.h"
+#include "faigz_index.h"
+#include "faigz_inflate.h"
+#include "faigz_build.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,38 +29,49 @@ typedef enum {
     FAI_FASTQ = 2
 } fai_format_options;
 
-// Flags for faidx_meta_load
+// Flags for faidx_meta_load (FAI_SNAPSHOT comes from faigz_index.h)
 #define FAI_CREATE 0x01
 
 // Position type
 typedef int64_t hts_pos_t;
 
-// Index entry structure
+// Growable string buffer, layout-compatible with htslib's kstring_t
+#ifndef KSTRING_T
+#define KSTRING_T kstring_t
+typedef struct kstring_t {
+    size_t l, m;
+    char *s;
+} kstring_t;
+#endif
+
+// Index entry structure; a record's id is its index in meta->seq
 typedef struct {
-    int id;
     uint32_t line_len, line_blen;
     uint64_t len;
     uint64_t seq_offset;
     uint64_t qual_offset;
 } faidx1_t;
 
-// Simple string hash table
+// One entry of the BGZF block index (.gzi)
 typedef struct {
-    char *key;
-    faidx1_t val;
-} hash_entry_t;
+    uint64_t caddr;              // Compressed offset of the block in the file
+    uint64_t uaddr;              // Uncompressed offset of the block's first byte
+} gzi_entry_t;
 
+// Open-addressing name index over faigz_index.h slots, which pack a name's hash with its id
 typedef struct {
-    hash_entry_t *entries;
+    faidx_name_slot_t *slots;
+    uint32_t mask;               // Slot count - 1; the slot count is a power of two
     int n_entries;
-    int capacity;
 } simple_hash_t;
 
 // Shared metadata structure
 struct faidx_meta_t {
     int n, m;                     // Sequence count and allocation size
-    char **name;                  // Array of sequence names
-    simple_hash_t *hash;          // Hash table mapping names to positions
+    kstring_t names;              // Arena of NUL-terminated sequence names
+    uint64_t *name_off;           // Offset of each sequence's name in names
+    faidx1_t *seq;                // Records indexed by sequence id
+    simple_hash_t *hash;          // Hash table mapping names to ids
     fai_format_options format;    // FAI_FASTA or FAI_FASTQ
     
     // Source file paths
@@ -63,19 +79,41 @@ struct faidx_meta_t {
     char *fai_path;              // Path to the .fai index
     char *gzi_path;              // Path to the .gzi index (if using BGZF)
     
-    // Reference count and mutex for thread safety
+    // Reference count (updated atomically) and mutex for thread safety
     int ref_count;
     pthread_mutex_t mutex;
     
     // Flag indicating if the source is BGZF compressed
     int is_bgzf;
+    
+    // BGZF block index; gzi[0] is always {0, 0}
+    gzi_entry_t *gzi;
+    int64_t n_gzi;
+    uint64_t file_size;          // Compressed file size, bounding the last block
+    
+    // Read-only mapping of an uncompressed file, NULL if not mapped
+    const char *map;
+    size_t map_size;
+    
+    // Mapped .fai.bin the names, records and name table point into, base NULL if none
+    faidx_snapshot_t snapshot;
 };
 
 // Reader structure containing thread-specific data
 struct faidx_reader_t {
     faidx_meta_t *meta;          // Shared metadata (not owned)
     FILE *fp;                    // File pointer for reading
-    gzFile gzfp;                 // gzFile pointer for compressed files
+    int fd;                      // Descriptor for BGZF block reads, -1 if not compressed
+    kstring_t view;              // Bases returned by faidx_reader_fetch_seq_view when copied
+    kstring_t buf;               // Raw bytes of the current fetch when not mapped
+    int seq_mode;                // enum faidx_seq_mode applied to fetched sequence
+    
+    // BGZF decoding state
+    faidx_inflater_t inflater;   // Block decoder for the selected backend
+    kstring_t cbuf;              // Compressed bytes of the current fetch
+    unsigned char *blk;          // Last inflated block, kept for the next fetch
+    size_t blk_len;              // Bytes in blk
+    uint64_t blk_caddr;          // Compressed offset of blk, UINT64_MAX if none
 };
 
 // Function declarations
@@ -84,13 +122,25 @@ faidx_meta_t *faidx_meta_ref(faidx_meta_t *meta);
 void faidx_meta_destroy(faidx_meta_t *meta);
 faidx_reader_t *faidx_reader_create(faidx_meta_t *meta);
 void faidx_reader_destroy(faidx_reader_t *reader);
+int faidx_reader_set_seq_mode(faidx_reader_t *reader, enum faidx_seq_mode mode);
 char *faidx_reader_fetch_seq(faidx_reader_t *reader, const char *c_name,
                            hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
 char *faidx_reader_fetch_qual(faidx_reader_t *reader, const char *c_name,
                             hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
+hts_pos_t faidx_reader_fetch_seq_into(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
+char *faidx_reader_fetch_seq_id(faidx_reader_t *reader, int tid,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
+hts_pos_t faidx_reader_fetch_seq_id_into(faidx_reader_t *reader, int tid,
+                                       hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
+hts_pos_t faidx_reader_fetch_seq_view(faidx_reader_t *reader, const char *c_name,
+                                    hts_pos_t p_beg_i, hts_pos_t p_end_i, const char **seq);
+hts_pos_t faidx_reader_fetch_qual_into(faidx_reader_t *reader, const char *c_name,
+                                     hts_pos_t p_beg_i, hts_pos_t p_end_i, kstring_t *out);
 int faidx_meta_nseq(const faidx_meta_t *meta);
 const char *faidx_meta_iseq(const faidx_meta_t *meta, int i);
 hts_pos_t faidx_meta_seq_len(const faidx_meta_t *meta, const char *seq);
+hts_pos_t faidx_meta_seq_len_id(const faidx_meta_t *meta, int tid);
 int faidx_meta_has_seq(const faidx_meta_t *meta, const char *seq);
 
 #ifdef __cplusplus
@@ -0,0 +1,498 @@
+#ifndef FAIGZ_PACK_H
+#define FAIGZ_PACK_H
+
+/*
+ * Packed companion file (<file>.pk2) used by faigz.h. Bases are stored
+ * 2 bits each, A=0 C=1 G=2 T=3 with the first base of a sequence in the
+ * lowest bits. Every other byte is recorded as a run of one character and
+ * stored as code 0; soft-masked (lowercase) bases are recorded as runs as
+ * well, so the file reproduces the FASTA exactly. The name and record
+ * table is an embedded index snapshot, checked against the .fai/.gzi like
+ * a .fai.bin, and the file is stale once the FASTA changes size or mtime.
+ * A fetch is then pointer arithmetic over one read-only mapping, with no
+ * inflate, at a quarter of the size of the plain FASTA. Everything here is
+ * static inline, like faigz_index.h.
+ */
+
+#include "faigz_index.h"
+#include "faigz_simd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Load flag: build <file>.pk2 if it is missing or stale (faigz extension to the FAI_* flags)
+#define FAI_PACK 0x400
+
+#define FAIDX_PACK_MAGIC "FAIGZPK"
+#define FAIDX_PACK_VERSION 1
+#define FAIDX_PACK_HDR 256           // Bytes reserved for the header; the snapshot follows
+
+// A run of bases: one non-ACGT character, or soft-masked bases
+typedef struct {
+    uint64_t beg;                // First base
+    uint32_t len;                // Bases in the run; longer runs are split
+    uint32_t c;                  // Character of an exception run, uppercased if a letter; 0 for masks
+} faidx_pack_run_t;
+
+// Where one sequence lives in the file; run ranges index the file's run arrays
+typedef struct {
+    uint64_t len;                // Bases
+    uint64_t data;               // File offset of its 2-bit codes, 8-byte aligned
+    uint64_t xrun, n_xrun;       // Exception runs
+    uint64_t mrun, n_mrun;       // Soft-mask runs
+} faidx_pack_seq_t;
+
+/*
+ * File layout: this header, the snapshot at off_snapshot, each sequence's
+ * codes padded to 8 bytes, then the sequence table and the two run arrays.
+ * Native-endian, like the snapshot.
+ */
+typedef struct {
+    char magic[8];               // FAIDX_PACK_MAGIC, NUL-padded
+    uint32_t version;            // FAIDX_PACK_VERSION
+    uint32_t byte_order;         // FAIDX_SNAPSHOT_BYTE_ORDER as written
+    uint64_t src_size, src_mtime; // FASTA file when written
+    uint64_t size;               // Size of the whole file
+    uint64_t n;                  // Number of sequences
+    uint64_t off_snapshot, snapshot_size;
+    uint64_t off_seqs;
+    uint64_t off_xruns, n_xruns;
+    uint64_t off_mruns, n_mruns;
+} faidx_pack_hdr_t;
+
+// A mapped companion file; the pointers refer into the mapping
+typedef struct {
+    void *base;                  // NULL if none
+    size_t size;
+    const faidx_pack_hdr_t *hdr;
+    faidx_snapshot_t snap;       // Embedded name and record table (base not set)
+    const faidx_pack_seq_t *seqs;
+    const faidx_pack_run_t *xruns, *mruns;
+} faidx_pack_t;
+
+/*
+ * Map a companion file, checking that it is complete and was written from
+ * the current FASTA and .fai/.gzi (gzi_path NULL for uncompressed files).
+ * Returns 0 with pk filled in, or -1 leaving pk untouched.
+ */
+static inline int faidx_pack_map(const char *path, const char *fasta_path, const char *fai_path,
+                                 const char *gzi_path, uint32_t format, uint32_t rec_size,
+                                 faidx_pack_t *pk) {
+    const faidx_pack_hdr_t *hdr;
+    faidx_pack_t p;
+    uint64_t src_size, src_mtime;
+    struct stat st;
+    void *base;
+    int fd = open(path, O_RDONLY);
+    
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < FAIDX_PACK_HDR ||
+        (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    
+    hdr = (const faidx_pack_hdr_t*)base;
+    faidx_snapshot_stat(fasta_path, &src_size, &src_mtime);
+    int ok = memcmp(hdr->magic, FAIDX_PACK_MAGIC, sizeof(FAIDX_PACK_MAGIC)) == 0 &&
+             hdr->version == FAIDX_PACK_VERSION &&
+             hdr->byte_order == FAIDX_SNAPSHOT_BYTE_ORDER &&
+             hdr->src_size == src_size && hdr->src_mtime == src_mtime &&
+             hdr->size == (uint64_t)st.st_size &&
+             faidx_snapshot_section_ok(hdr->off_snapshot, hdr->snapshot_size, 1, hdr->size) &&
+             faidx_snapshot_section_ok(hdr->off_seqs, hdr->n, sizeof(faidx_pack_seq_t), hdr->size) &&
+             faidx_snapshot_section_ok(hdr->off_xruns, hdr->n_xruns, sizeof(faidx_pack_run_t), hdr->size) &&
+             faidx_snapshot_section_ok(hdr->off_mruns, hdr->n_mruns, sizeof(faidx_pack_run_t), hdr->size) &&
+             faidx_snapshot_parse((const char*)base + hdr->off_snapshot, hdr->snapshot_size, fai_path,
+                                  gzi_path, format, rec_size, &p.snap) == 0 &&
+             p.snap.hdr->n == hdr->n;
+    
+    /* Every sequence's codes and runs must lie inside the file */
+    if (ok) {
+        p.seqs = (const faidx_pack_seq_t*)((const char*)base + hdr->off_seqs);
+        for (uint64_t i = 0; ok && i < hdr->n; i++) {
+            const faidx_pack_seq_t *s = &p.seqs[i];
+            ok = s->data % 8 == 0 && s->data <= hdr->size && (s->len + 3) / 4 <= hdr->size - s->data &&
+                 s->xrun <= hdr->n_xruns && s->n_xrun <= hdr->n_xruns - s->xrun &&
+                 s->mrun <= hdr->n_mruns && s->n_mrun <= hdr->n_mruns - s->mrun;
+        }
+    }
+    if (!ok) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+    
+    p.base = base;
+    p.size = (size_t)st.st_size;
+    p.hdr = hdr;
+    p.xruns = (const faidx_pack_run_t*)((const char*)base + hdr->off_xruns);
+    p.mruns = (const faidx_pack_run_t*)((const char*)base + hdr->off_mruns);
+    *pk = p;
+    return 0;
+}
+
+static inline void faidx_pack_unmap(faidx_pack_t *pk) {
+    if (pk->base) munmap(pk->base, pk->size);
+    pk->base = NULL;
+}
+
+/* Helper: First of n runs that ends after pos */
+static inline uint64_t faidx_pack_first_run(const faidx_pack_run_t *runs, uint64_t n, uint64_t pos) {
+    uint64_t lo = 0, hi = n;
+    
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (runs[mid].beg + runs[mid].len <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Helper: Set (value 1) or clear (value 0) bits [from, to) of buf, lowest bits first */
+static inline void faidx_pack_fill_bits(uint8_t *buf, uint64_t from, uint64_t to, int value) {
+    while (from < to && from % 8) {
+        if (value) buf[from / 8] |= (uint8_t)(1u << from % 8);
+        else buf[from / 8] &= (uint8_t)~(1u << from % 8);
+        from++;
+    }
+    if (to - from >= 8) {
+        memset(buf + from / 8, value ? 0xff : 0, (size_t)((to - from) / 8));
+        from += (to - from) / 8 * 8;
+    }
+    for (; from < to; from++) {
+        if (value) buf[from / 8] |= (uint8_t)(1u << from % 8);
+        else buf[from / 8] &= (uint8_t)~(1u << from % 8);
+    }
+}
+
+/*
+ * Write n bases of sequence tid starting at beg to dst as ASCII, with
+ * soft-masked bases transformed according to mode as for the FASTA path.
+ */
+static inline void faidx_pack_decode(const faidx_pack_t *pk, int tid, uint64_t beg, size_t n,
+                                     char *dst, int mode) {
+    static const char acgt[4] = {'A', 'C', 'G', 'T'};
+    const faidx_pack_seq_t *s = &pk->seqs[tid];
+    const uint8_t *codes = (const uint8_t*)pk->base + s->data;
+    uint64_t end = beg + n, pos = beg;
+    const faidx_pack_run_t *runs;
+    uint64_t r, n_runs;
+    
+    /* Bases up to a byte boundary, four per byte, then the rest */
+    for (; pos < end && pos % 4; pos++) *dst++ = acgt[codes[pos / 4] >> 2 * (pos % 4) & 3];
+    for (; pos + 4 <= end; pos += 4) {
+        unsigned b = codes[pos / 4];
+        dst[0] = acgt[b & 3];
+        dst[1] = acgt[b >> 2 & 3];
+        dst[2] = acgt[b >> 4 & 3];
+        dst[3] = acgt[b >> 6];
+        dst += 4;
+    }
+    for (; pos < end; pos++) *dst++ = acgt[codes[pos / 4] >> 2 * (pos % 4) & 3];
+    dst -= n;
+    
+    /* Overlay the characters that aren't ACGT, then the soft mask */
+    runs = pk->xruns + s->xrun;
+    n_runs = s->n_xrun;
+    for (r = faidx_pack_first_run(runs, n_runs, beg); r < n_runs && runs[r].beg < end; r++) {
+        uint64_t a = runs[r].beg > beg ? runs[r].beg : beg;
+        uint64_t b = runs[r].beg + runs[r].len < end ? runs[r].beg + runs[r].len : end;
+        memset(dst + (a - beg), (int)runs[r].c, (size_t)(b - a));
+    }
+    if (mode == FAIDX_SEQ_UPPER) return;
+    
+    runs = pk->mruns + s->mrun;
+    n_runs = s->n_mrun;
+    for (r = faidx_pack_first_run(runs, n_runs, beg); r < n_runs && runs[r].beg < end; r++) {
+        uint64_t a = runs[r].beg > beg ? runs[r].beg : beg;
+        uint64_t b = runs[r].beg + runs[r].len < end ? runs[r].beg + runs[r].len : end;
+        if (mode == FAIDX_SEQ_MASK_N) {
+            memset(dst + (a - beg), 'N', (size_t)(b - a));
+        } else {
+            for (uint64_t i = a; i < b; i++) dst[i - beg] = (char)(dst[i - beg] | 0x20);
+        }
+    }
+}
+
+/*
+ * Write n bases of sequence tid starting at beg to dst as 2-bit codes, and
+ * the ambiguity mask if not NULL, laid out as for faidx_simd_pack.
+ */
+static inline void faidx_pack_codes(const faidx_pack_t *pk, int tid, uint64_t beg, size_t n,
+                                    uint8_t *dst, uint8_t *mask, int mode) {
+    const faidx_pack_seq_t *s = &pk->seqs[tid];
+    const uint8_t *codes = (const uint8_t*)pk->base + s->data + beg / 4;
+    size_t bytes = (n + 3) / 4, last = (size_t)((beg % 4 + n + 3) / 4) - 1;
+    unsigned shift = (unsigned)(beg % 4) * 2;
+    const faidx_pack_run_t *runs;
+    uint64_t r, n_runs, end = beg + n;
+    
+    /* Whole bytes are copied; otherwise each byte joins the tail of one and the head of the next */
+    if (shift == 0) {
+        memcpy(dst, codes, bytes);
+    } else {
+        for (size_t j = 0; j < bytes; j++) {
+            unsigned v = codes[j] >> shift;
+            if (j + 1 <= last) v |= (unsigned)codes[j + 1] << (8 - shift);
+            dst[j] = (uint8_t)v;
+        }
+    }
+    if (n % 4) dst[bytes - 1] &= (uint8_t)((1u << 2 * (n % 4)) - 1);
+    if (mask) memset(mask, 0, (n + 7) / 8);
+    
+    /* Exceptions are already stored as 0, so only the mask needs them */
+    runs = pk->xruns + s->xrun;
+    n_runs = s->n_xrun;
+    for (r = faidx_pack_first_run(runs, n_runs, beg); mask && r < n_runs && runs[r].beg < end; r++) {
+        uint64_t a = runs[r].beg > beg ? runs[r].beg : beg;
+        uint64_t b = runs[r].beg + runs[r].len < end ? runs[r].beg + runs[r].len : end;
+        faidx_pack_fill_bits(mask, a - beg, b - beg, 1);
+    }
+    if (mode != FAIDX_SEQ_MASK_N) return;
+    
+    runs = pk->mruns + s->mrun;
+    n_runs = s->n_mrun;
+    for (r = faidx_pack_first_run(runs, n_runs, beg); r < n_runs && runs[r].beg < end; r++) {
+        uint64_t a = runs[r].beg > beg ? runs[r].beg : beg;
+        uint64_t b = runs[r].beg + runs[r].len < end ? runs[r].beg + runs[r].len : end;
+        faidx_pack_fill_bits(dst, 2 * (a - beg), 2 * (b - beg), 0);
+        if (mask) faidx_pack_fill_bits(mask, a - beg, b - beg, 1);
+    }
+}
+
+// Companion file being written, one sequence at a time in record order
+typedef struct {
+    int fd;
+    char *tmp;                   // Temporary path, renamed over the target when done
+    faidx_pack_hdr_t hdr;
+    uint64_t pos;                // Bytes written so far
+    faidx_pack_seq_t *seqs;      // hdr.n entries; cur is being written
+    uint64_t cur;
+    faidx_pack_run_t *xruns, *mruns;
+    uint64_t m_xruns, m_mruns;
+    uint8_t carry;               // Codes of a partly filled byte
+    int n_carry;                 // Bases in carry
+    uint8_t out[FAIDX_PACK_TILE]; // Codes waiting to be written
+    size_t n_out;
+} faidx_pack_writer_t;
+
+/* Helper: append one run, growing the array */
+static inline int faidx_pack_push_run(faidx_pack_run_t **runs, uint64_t *n, uint64_t *m,
+                                      uint64_t beg, uint32_t c) {
+    if (*n == *m) {
+        uint64_t m2 = *m ? *m * 2 : 1024;
+        faidx_pack_run_t *r = (faidx_pack_run_t*)realloc(*runs, m2 * sizeof(faidx_pack_run_t));
+        if (!r) return -1;
+        *runs = r;
+        *m = m2;
+    }
+    (*runs)[*n].beg = beg;
+    (*runs)[*n].len = 1;
+    (*runs)[*n].c = c;
+    (*n)++;
+    return 0;
+}
+
+/* Helper: write the buffered codes */
+static inline int faidx_pack_flush(faidx_pack_writer_t *w) {
+    if (w->n_out && faidx_snapshot_write_all(w->fd, w->out, w->n_out) < 0) return -1;
+    w->pos += w->n_out;
+    w->n_out = 0;
+    return 0;
+}
+
+/* Helper: queue packed code bytes */
+static inline int faidx_pack_put(faidx_pack_writer_t *w, const uint8_t *codes, size_t n) {
+    if (w->n_out + n > sizeof(w->out) && faidx_pack_flush(w) < 0) return -1;
+    if (n > sizeof(w->out)) {
+        if (faidx_snapshot_write_all(w->fd, codes, n) < 0) return -1;
+        w->pos += n;
+        return 0;
+    }
+    memcpy(w->out + w->n_out, codes, n);
+    w->n_out += n;
+    return 0;
+}
+
+/* Helper: pad the file to a multiple of 8 bytes */
+static inline int faidx_pack_align(faidx_pack_writer_t *w) {
+    static const uint8_t zeros[8] = {0};
+    uint64_t at = w->pos + w->n_out;
+    return at % 8 ? faidx_pack_put(w, zeros, (size_t)(8 - at % 8)) : 0;
+}
+
+/*
+ * Start writing a companion file for fasta_path to a temporary file next to
+ * path, with the name and record table of src and n sequences.
+ */
+static inline int faidx_pack_writer_open(faidx_pack_writer_t *w, const char *path,
+                                         const char *fasta_path, const faidx_snapshot_src_t *src) {
+    static const uint8_t zeros[FAIDX_PACK_HDR] = {0};
+    size_t tmp_len = strlen(path) + 32;
+    off_t end;
+    
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->tmp = (char*)malloc(tmp_len);
+    w->seqs = (faidx_pack_seq_t*)calloc(src->n ? src->n : 1, sizeof(faidx_pack_seq_t));
+    if (!w->tmp || !w->seqs) goto fail;
+    snprintf(w->tmp, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+    
+    memcpy(w->hdr.magic, FAIDX_PACK_MAGIC, sizeof(FAIDX_PACK_MAGIC));
+    w->hdr.version = FAIDX_PACK_VERSION;
+    w->hdr.byte_order = FAIDX_SNAPSHOT_BYTE_ORDER;
+    faidx_snapshot_stat(fasta_path, &w->hdr.src_size, &w->hdr.src_mtime);
+    w->hdr.n = src->n;
+    
+    /* The header is written last, once the offsets are known */
+    w->fd = open(w->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) goto fail;
+    if (faidx_snapshot_write_all(w->fd, zeros, sizeof(zeros)) < 0 ||
+        faidx_snapshot_emit(w->fd, src) < 0 || (end = lseek(w->fd, 0, SEEK_CUR)) < 0) {
+        goto fail;
+    }
+    w->hdr.off_snapshot = FAIDX_PACK_HDR;
+    w->hdr.snapshot_size = (uint64_t)end - FAIDX_PACK_HDR;
+    w->pos = (uint64_t)end;
+    if (faidx_pack_align(w) < 0) goto fail;
+    w->seqs[0].data = w->pos + w->n_out;
+    return 0;
+    
+fail:
+    if (w->fd >= 0) {
+        close(w->fd);
+        remove(w->tmp);
+    }
+    free(w->tmp);
+    free(w->seqs);
+    return -1;
+}
+
+/* Append n bases of the current sequence */
+static inline int faidx_pack_writer_add(faidx_pack_writer_t *w, const char *bases, size_t n) {
+    faidx_pack_seq_t *s = &w->seqs[w->cur];
+    uint8_t tile[FAIDX_PACK_TILE / 4];
+    size_t i = 0;
+    
+    /* Runs of lowercase letters and of anything but ACGT */
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = (unsigned char)bases[k];
+        uint64_t pos = s->len + k;
+        int lower = (unsigned char)(c - 'a') < 26;
+        unsigned u = lower ? c - 0x20u : c;
+    
+        if (lower) {
+            faidx_pack_run_t *last = s->n_mrun ? &w->mruns[s->mrun + s->n_mrun - 1] : NULL;
+            if (last && last->beg + last->len == pos && last->len < UINT32_MAX) {
+                last->len++;
+            } else {
+                if (faidx_pack_push_run(&w->mruns, &w->hdr.n_mruns, &w->m_mruns, pos, 0) < 0) return -1;
+                s->n_mrun++;
+            }
+        }
+        if (u != 'A' && u != 'C' && u != 'G' && u != 'T') {
+            faidx_pack_run_t *last = s->n_xrun ? &w->xruns[s->xrun + s->n_xrun - 1] : NULL;
+            if (last && last->beg + last->len == pos && last->c == u && last->len < UINT32_MAX) {
+                last->len++;
+            } else {
+                if (faidx_pack_push_run(&w->xruns, &w->hdr.n_xruns, &w->m_xruns, pos, u) < 0) return -1;
+                s->n_xrun++;
+            }
+        }
+    }
+    
+    /* Finish a partly filled byte, pack whole tiles, and keep what is left over */
+    for (; i < n && w->n_carry; i++) {
+        faidx_simd_pack_scalar(tile, NULL, bases + i, 0, 1, FAIDX_PACK_2BIT, FAIDX_SEQ_AS_IS);
+        w->carry |= (uint8_t)(tile[0] << 2 * w->n_carry);
+        if (++w->n_carry == 4) {
+            if (faidx_pack_put(w, &w->carry, 1) < 0) return -1;
+            w->carry = 0;
+            w->n_carry = 0;
+        }
+    }
+    while (n - i >= 4) {
+        size_t k = (n - i) / 4 * 4 < FAIDX_PACK_TILE ? (n - i) / 4 * 4 : FAIDX_PACK_TILE;
+        faidx_simd_pack(tile, NULL, bases + i, k, FAIDX_PACK_2BIT, FAIDX_SEQ_AS_IS);
+        if (faidx_pack_put(w, tile, k / 4) < 0) return -1;
+        i += k;
+    }
+    for (; i < n; i++) {
+        faidx_simd_pack_scalar(tile, NULL, bases + i, 0, 1, FAIDX_PACK_2BIT, FAIDX_SEQ_AS_IS);
+        w->carry |= (uint8_t)(tile[0] << 2 * w->n_carry);
+        w->n_carry++;
+    }
+    
+    s->len += n;
+    return 0;
+}
+
+/* Finish the current sequence; the next one starts on an 8-byte boundary */
+static inline int faidx_pack_writer_next(faidx_pack_writer_t *w) {
+    if (w->n_carry) {
+        if (faidx_pack_put(w, &w->carry, 1) < 0) return -1;
+        w->carry = 0;
+        w->n_carry = 0;
+    }
+    if (faidx_pack_align(w) < 0) return -1;
+    if (++w->cur < w->hdr.n) {
+        w->seqs[w->cur].data = w->pos + w->n_out;
+        w->seqs[w->cur].xrun = w->hdr.n_xruns;
+        w->seqs[w->cur].mrun = w->hdr.n_mruns;
+    }
+    return 0;
+}
+
+/* Helper: release a writer's memory */
+static inline void faidx_pack_writer_free(faidx_pack_writer_t *w) {
+    free(w->tmp);
+    free(w->seqs);
+    free(w->xruns);
+    free(w->mruns);
+}
+
+/* Abandon a companion file */
+static inline void faidx_pack_writer_abort(faidx_pack_writer_t *w) {
+    close(w->fd);
+    remove(w->tmp);
+    faidx_pack_writer_free(w);
+}
+
+/* Write the tables and header and move the file into place at path; every sequence must be done */
+static inline int faidx_pack_writer_close(faidx_pack_writer_t *w, const char *path) {
+    if (w->cur != w->hdr.n) goto fail;
+    w->hdr.off_seqs = w->pos + w->n_out;
+    if (faidx_pack_put(w, (const uint8_t*)w->seqs, w->hdr.n * sizeof(faidx_pack_seq_t)) < 0) goto fail;
+    w->hdr.off_xruns = w->pos + w->n_out;
+    if (faidx_pack_put(w, (const uint8_t*)w->xruns, w->hdr.n_xruns * sizeof(faidx_pack_run_t)) < 0) goto fail;
+    w->hdr.off_mruns = w->pos + w->n_out;
+    if (faidx_pack_put(w, (const uint8_t*)w->mruns, w->hdr.n_mruns * sizeof(faidx_pack_run_t)) < 0) goto fail;
+    if (faidx_pack_flush(w) < 0) goto fail;
+    w->hdr.size = w->pos;
+    
+    if (lseek(w->fd, 0, SEEK_SET) != 0 ||
+        faidx_snapshot_write_all(w->fd, &w->hdr, sizeof(w->hdr)) < 0) {
+        goto fail;
+    }
+    if (close(w->fd) != 0 || rename(w->tmp, path) != 0) {
+        remove(w->tmp);
+        faidx_pack_writer_free(w);
+        return -1;
+    }
+    faidx_pack_writer_free(w);
+    return 0;
+    
+fail:
+    faidx_pack_writer_abort(w);
+    return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_PACK_H */
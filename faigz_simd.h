@@ -0,0 +1,369 @@
+#ifndef FAIGZ_SIMD_H
+#define FAIGZ_SIMD_H
+
+/*
+ * Line-stripping, case-normalising and nucleotide-packing kernels shared by
+ * faigz.h and faigz_minimal.c. Everything here is static inline, so each
+ * translation unit gets its own copy and no linking is needed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FAIGZ_SIMD_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FAIGZ_SIMD_AVX2 1
+#define FAIGZ_SIMD_SSSE3 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define FAIGZ_SIMD_NEON 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// How fetched bases are transformed on the way out
+enum faidx_seq_mode {
+    FAIDX_SEQ_AS_IS = 0,         // Bases exactly as stored
+    FAIDX_SEQ_UPPER = 1,         // Soft-masked (lowercase) bases uppercased
+    FAIDX_SEQ_MASK_N = 2         // Soft-masked (lowercase) bases replaced by 'N'
+};
+
+/* Scalar tail: transform lowercase ASCII letters according to mode */
+static inline void faidx_simd_case_scalar(char *dst, const char *src, size_t n, int mode) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)src[i];
+        if ((unsigned char)(c - 'a') < 26) c = mode == FAIDX_SEQ_UPPER ? (unsigned char)(c - 0x20) : 'N';
+        dst[i] = (char)c;
+    }
+}
+
+/*
+ * The vector kernels bias each byte so that 'a'..'z' land on the 26 lowest
+ * signed values, find them with one signed compare, then either clear the
+ * case bit or blend in 'N'. Each returns how many bytes it handled.
+ */
+#ifdef FAIGZ_SIMD_SSE2
+static inline size_t faidx_simd_case_sse2(char *dst, const char *src, size_t n, int mode) {
+    const __m128i bias = _mm_set1_epi8((char)(0x80 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i fill = _mm_set1_epi8(mode == FAIDX_SEQ_UPPER ? 0x20 : 'N');
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lower = _mm_cmpgt_epi8(limit, _mm_add_epi8(x, bias));
+        __m128i y = mode == FAIDX_SEQ_UPPER
+                  ? _mm_xor_si128(x, _mm_and_si128(lower, fill))
+                  : _mm_or_si128(_mm_andnot_si128(lower, x), _mm_and_si128(lower, fill));
+        _mm_storeu_si128((__m128i*)(dst + i), y);
+    }
+    return i;
+}
+#endif
+
+#ifdef FAIGZ_SIMD_AVX2
+__attribute__((target("avx2")))
+static inline size_t faidx_simd_case_avx2(char *dst, const char *src, size_t n, int mode) {
+    const __m256i bias = _mm256_set1_epi8((char)(0x80 - 'a'));
+    const __m256i limit = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i fill = _mm256_set1_epi8(mode == FAIDX_SEQ_UPPER ? 0x20 : 'N');
+    size_t i = 0;
+    
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(x, bias));
+        __m256i y = mode == FAIDX_SEQ_UPPER
+                  ? _mm256_xor_si256(x, _mm256_and_si256(lower, fill))
+                  : _mm256_blendv_epi8(x, fill, lower);
+        _mm256_storeu_si256((__m256i*)(dst + i), y);
+    }
+    return i;
+}
+
+/* Whether the running CPU has AVX2, probed once */
+static inline int faidx_simd_have_avx2(void) {
+    static int have = -1;
+    int v = __atomic_load_n(&have, __ATOMIC_RELAXED);
+    
+    if (v < 0) {
+        __builtin_cpu_init();
+        v = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&have, v, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+#endif
+
+#ifdef FAIGZ_SIMD_NEON
+static inline size_t faidx_simd_case_neon(char *dst, const char *src, size_t n, int mode) {
+    const uint8x16_t a = vdupq_n_u8('a'), span = vdupq_n_u8(26);
+    const uint8x16_t fill = vdupq_n_u8(mode == FAIDX_SEQ_UPPER ? 0x20 : 'N');
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t x = vld1q_u8((const uint8_t*)src + i);
+        uint8x16_t lower = vcltq_u8(vsubq_u8(x, a), span);
+        uint8x16_t y = mode == FAIDX_SEQ_UPPER
+                     ? veorq_u8(x, vandq_u8(lower, fill))
+                     : vbslq_u8(lower, fill, x);
+        vst1q_u8((uint8_t*)dst + i, y);
+    }
+    return i;
+}
+#endif
+
+/* Copy n bytes from src to dst, transforming soft-masked bases according to mode */
+static inline void faidx_simd_copy(char *dst, const char *src, size_t n, int mode) {
+    size_t i = 0;
+    
+    if (mode == FAIDX_SEQ_AS_IS) {
+        memcpy(dst, src, n);
+        return;
+    }
+    
+#ifdef FAIGZ_SIMD_AVX2
+    if (faidx_simd_have_avx2()) i = faidx_simd_case_avx2(dst, src, n, mode);
+#endif
+#if defined(FAIGZ_SIMD_SSE2)
+    i += faidx_simd_case_sse2(dst + i, src + i, n - i, mode);
+#elif defined(FAIGZ_SIMD_NEON)
+    i += faidx_simd_case_neon(dst + i, src + i, n - i, mode);
+#endif
+    faidx_simd_case_scalar(dst + i, src + i, n - i, mode);
+}
+
+/*
+ * Copy n bases starting at base beg from src, the raw file bytes beginning
+ * at beg, for a record with line_blen bases per line_len-byte line. Line
+ * terminators are skipped by position, so they are never scanned for.
+ */
+static inline void faidx_simd_copy_lines(char *dst, const char *src, int64_t n, uint64_t beg,
+                                         size_t line_blen, size_t line_len, int mode) {
+    size_t skip = line_len - line_blen;
+    size_t chunk = line_blen - beg % line_blen;
+    int64_t copied = 0;
+    
+    /* Regions within one line need no stripping at all */
+    if ((int64_t)chunk >= n) {
+        faidx_simd_copy(dst, src, (size_t)n, mode);
+        return;
+    }
+    
+    while (copied < n) {
+        if ((int64_t)chunk > n - copied) chunk = (size_t)(n - copied);
+        faidx_simd_copy(dst + copied, src, chunk, mode);
+        copied += chunk;
+        src += chunk + skip;
+        chunk = line_blen;
+    }
+}
+
+// Packed layouts; the first base of a region is always in the lowest bits of byte 0
+enum faidx_pack_type {
+    FAIDX_PACK_2BIT = 1,         // A=0 C=1 G=2 T=3, four bases per byte, anything else 0
+    FAIDX_PACK_4BIT = 2          // IUPAC codes as in htslib's seq_nt16_str, two bases per byte
+};
+
+/* Bases stripped into a scratch tile before packing; a multiple of 8 so tiles start on a byte */
+#define FAIDX_PACK_TILE 4096
+
+/* 4-bit IUPAC code of each letter, indexed by c & 0x1f; U reads as T */
+static const uint8_t faidx_simd_nt16[32] = {
+    15, 1, 14, 2, 13, 15, 15, 4, 11, 15, 15, 12, 15, 3, 15, 15,
+    15, 15, 5, 6, 8, 8, 7, 9, 15, 10, 15, 15, 15, 15, 15, 15
+};
+
+/*
+ * Scalar pack of bases [i, n) of src, which starts at base 0 of dst and
+ * mask. A base counts as unambiguous if it is A, C, G or T, in either case
+ * unless mode is FAIDX_SEQ_MASK_N, which treats soft-masked bases as N.
+ */
+static inline void faidx_simd_pack_scalar(uint8_t *dst, uint8_t *mask, const char *src,
+                                          size_t i, size_t n, int type, int mode) {
+    for (; i < n; i++) {
+        unsigned char c = (unsigned char)src[i], u = (unsigned char)(c & 0xdf);
+        int letter = (unsigned char)(u - 'A') < 26 && (mode != FAIDX_SEQ_MASK_N || c == u);
+        int acgt = letter && (u == 'A' || u == 'C' || u == 'G' || u == 'T');
+        
+        if (type == FAIDX_PACK_2BIT) {
+            unsigned code = acgt ? ((u >> 1) ^ (u >> 2)) & 3 : 0;
+            if (i % 4 == 0) dst[i / 4] = 0;
+            dst[i / 4] |= (uint8_t)(code << 2 * (i % 4));
+        } else {
+            unsigned code = letter ? faidx_simd_nt16[u & 0x1f] : 15;
+            if (i % 2 == 0) dst[i / 2] = 0;
+            dst[i / 2] |= (uint8_t)(code << 4 * (i % 2));
+        }
+        if (mask) {
+            if (i % 8 == 0) mask[i / 8] = 0;
+            if (!acgt) mask[i / 8] |= (uint8_t)(1 << i % 8);
+        }
+    }
+}
+
+/*
+ * ((c >> 1) ^ (c >> 2)) & 3 maps A, C, G and T, upper or lower case, to
+ * 0..3, so 2-bit codes need only shifts. Codes of other bytes are cleared
+ * with the compare mask, then pairs and quads of codes are folded together
+ * within 16- and 32-bit lanes and narrowed to one byte per four bases.
+ * The inverted compare mask is the ambiguity mask, two bytes per 16 bases.
+ */
+#ifdef FAIGZ_SIMD_SSE2
+static inline size_t faidx_simd_pack2_sse2(uint8_t *dst, uint8_t *mask, const char *src,
+                                           size_t n, int mode) {
+    const __m128i fold = _mm_set1_epi8(mode == FAIDX_SEQ_MASK_N ? (char)0xff : (char)0xdf);
+    const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G'), t = _mm_set1_epi8('T');
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i lo4 = _mm_set1_epi16(0x0f), lo8 = _mm_set1_epi32(0xff);
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i u = _mm_and_si128(x, fold);
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, a), _mm_cmpeq_epi8(u, c)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(u, g), _mm_cmpeq_epi8(u, t)));
+        __m128i code = _mm_xor_si128(_mm_srli_epi16(x, 1), _mm_srli_epi16(x, 2));
+        code = _mm_and_si128(_mm_and_si128(code, three), ok);
+        code = _mm_and_si128(_mm_or_si128(code, _mm_srli_epi16(code, 6)), lo4);
+        code = _mm_and_si128(_mm_or_si128(code, _mm_srli_epi32(code, 12)), lo8);
+        code = _mm_packus_epi16(_mm_packs_epi32(code, code), code);
+        uint32_t packed = (uint32_t)_mm_cvtsi128_si32(code);
+        memcpy(dst + i / 4, &packed, 4);
+        if (mask) {
+            unsigned bits = ~(unsigned)_mm_movemask_epi8(ok);
+            mask[i / 8] = (uint8_t)bits;
+            mask[i / 8 + 1] = (uint8_t)(bits >> 8);
+        }
+    }
+    return i;
+}
+#endif
+
+/*
+ * 4-bit codes are looked up with two byte shuffles on the low four bits of
+ * c & 0x1f, picking between them on bit 4; non-letters become 15. Each pair
+ * of codes is then folded into one byte within its 16-bit lane.
+ */
+#ifdef FAIGZ_SIMD_SSSE3
+__attribute__((target("ssse3")))
+static inline size_t faidx_simd_pack4_ssse3(uint8_t *dst, uint8_t *mask, const char *src,
+                                            size_t n, int mode) {
+    const __m128i lut0 = _mm_loadu_si128((const __m128i*)faidx_simd_nt16);
+    const __m128i lut1 = _mm_loadu_si128((const __m128i*)(faidx_simd_nt16 + 16));
+    const __m128i fold = _mm_set1_epi8(mode == FAIDX_SEQ_MASK_N ? (char)0xff : (char)0xdf);
+    const __m128i bias = _mm_set1_epi8((char)(0x80 - 'A'));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G'), t = _mm_set1_epi8('T');
+    const __m128i lo4 = _mm_set1_epi8(0x0f), bit4 = _mm_set1_epi8(0x10);
+    const __m128i fifteen = _mm_set1_epi8(15), lo8 = _mm_set1_epi16(0xff);
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i u = _mm_and_si128(x, fold);
+        __m128i letter = _mm_cmpgt_epi8(limit, _mm_add_epi8(u, bias));
+        __m128i idx = _mm_and_si128(x, lo4);
+        __m128i hi = _mm_cmpeq_epi8(_mm_and_si128(x, bit4), bit4);
+        __m128i code = _mm_or_si128(_mm_andnot_si128(hi, _mm_shuffle_epi8(lut0, idx)),
+                                    _mm_and_si128(hi, _mm_shuffle_epi8(lut1, idx)));
+        code = _mm_or_si128(_mm_and_si128(letter, code), _mm_andnot_si128(letter, fifteen));
+        code = _mm_and_si128(_mm_or_si128(code, _mm_srli_epi16(code, 4)), lo8);
+        _mm_storel_epi64((__m128i*)(dst + i / 2), _mm_packus_epi16(code, code));
+        if (mask) {
+            __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, a), _mm_cmpeq_epi8(u, c)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(u, g), _mm_cmpeq_epi8(u, t)));
+            unsigned bits = ~(unsigned)_mm_movemask_epi8(ok);
+            mask[i / 8] = (uint8_t)bits;
+            mask[i / 8 + 1] = (uint8_t)(bits >> 8);
+        }
+    }
+    return i;
+}
+
+/* Whether the running CPU has SSSE3, probed once */
+static inline int faidx_simd_have_ssse3(void) {
+    static int have = -1;
+    int v = __atomic_load_n(&have, __ATOMIC_RELAXED);
+    
+    if (v < 0) {
+        __builtin_cpu_init();
+        v = __builtin_cpu_supports("ssse3") ? 1 : 0;
+        __atomic_store_n(&have, v, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+#endif
+
+/* Pack n bases of src into dst (and the ambiguity mask, if not NULL), starting at base 0 */
+static inline void faidx_simd_pack(uint8_t *dst, uint8_t *mask, const char *src, size_t n,
+                                   int type, int mode) {
+    size_t i = 0;
+    
+#ifdef FAIGZ_SIMD_SSE2
+    if (type == FAIDX_PACK_2BIT) i = faidx_simd_pack2_sse2(dst, mask, src, n, mode);
+#endif
+#ifdef FAIGZ_SIMD_SSSE3
+    if (type == FAIDX_PACK_4BIT && faidx_simd_have_ssse3()) {
+        i = faidx_simd_pack4_ssse3(dst, mask, src, n, mode);
+    }
+#endif
+    faidx_simd_pack_scalar(dst, mask, src, i, n, type, mode);
+}
+
+/*
+ * Pack n bases starting at base beg from src, the raw file bytes beginning
+ * at beg, laid out as for faidx_simd_copy_lines. Regions within one line are
+ * packed straight from src; longer ones are stripped a cache-resident tile
+ * at a time and packed from there, so no ASCII copy of the region is made.
+ */
+static inline void faidx_simd_pack_lines(uint8_t *dst, uint8_t *mask, const char *src, int64_t n,
+                                         uint64_t beg, size_t line_blen, size_t line_len,
+                                         int type, int mode) {
+    size_t per_byte = type == FAIDX_PACK_2BIT ? 4 : 2;
+    size_t skip = line_len - line_blen;
+    size_t col = beg % line_blen;
+    char tile[FAIDX_PACK_TILE];
+    int64_t done = 0;
+    
+    if ((int64_t)(line_blen - col) >= n) {
+        faidx_simd_pack(dst, mask, src, (size_t)n, type, mode);
+        return;
+    }
+    
+    while (done < n) {
+        size_t fill = n - done < FAIDX_PACK_TILE ? (size_t)(n - done) : FAIDX_PACK_TILE;
+        size_t got = 0;
+        
+        while (got < fill) {
+            size_t k = line_blen - col < fill - got ? line_blen - col : fill - got;
+            memcpy(tile + got, src, k);
+            got += k;
+            src += k;
+            col += k;
+            if (col == line_blen) {
+                src += skip;
+                col = 0;
+            }
+        }
+        faidx_simd_pack(dst + done / per_byte, mask ? mask + done / 8 : NULL, tile, fill, type, mode);
+        done += fill;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_SIMD_H */
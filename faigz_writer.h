@@ -0,0 +1,337 @@
+#ifndef FAIGZ_WRITER_H
+#define FAIGZ_WRITER_H
+
+/*
+ * Batched output for many threads writing FASTA records to one file. Each
+ * thread appends records to its own faidx_wbuf_t with no locking; a full
+ * chunk (FAIDX_WRITER_CHUNK bytes) is handed to the writer at the next
+ * record boundary, so records from different threads never interleave.
+ * A threaded writer drains handed-over chunks on its own thread with one
+ * writev per batch of chunks; otherwise the hand-over writes the chunk
+ * itself, which suits one writer per thread (shard files). Chunks are
+ * recycled, and producers wait once FAIDX_WRITER_QUEUE chunks are queued,
+ * so memory stays bounded when the disk is slower than the fetches.
+ * Everything is static inline, like faigz_index.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAIDX_WRITER_CHUNK (1 << 20) // Bytes a buffer collects before it is handed over
+#define FAIDX_WRITER_QUEUE 64        // Chunks queued before producers wait
+#define FAIDX_WRITER_IOV 64          // Chunks written by one writev
+
+typedef struct faidx_wchunk_t {
+    char *s;
+    size_t l, m;
+    struct faidx_wchunk_t *next;
+} faidx_wchunk_t;
+
+typedef struct {
+    int fd, own_fd;
+    int threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, space;
+    faidx_wchunk_t *head, *tail;     // Handed-over chunks, oldest first
+    faidx_wchunk_t *spare;           // Written chunks for reuse
+    int n_queued;
+    int shutdown;
+    int err;                         // errno of the first failed write
+    uint64_t bytes, writes;          // Bytes written and write calls made
+} faidx_writer_t;
+
+/* A thread's buffer in front of a writer; not shared between threads */
+typedef struct {
+    faidx_writer_t *w;
+    faidx_wchunk_t *c;
+} faidx_wbuf_t;
+
+/* Write a list of chunks with as few writev calls as possible */
+static inline int faidx_writer_writev(faidx_writer_t *w, faidx_wchunk_t *c) {
+    struct iovec iov[FAIDX_WRITER_IOV];
+    
+    while (c) {
+        int n = 0;
+        for (; c && n < FAIDX_WRITER_IOV; c = c->next) {
+            if (!c->l) continue;
+            iov[n].iov_base = c->s;
+            iov[n].iov_len = c->l;
+            n++;
+        }
+    
+        struct iovec *v = iov;
+        while (n > 0) {
+            ssize_t k = writev(w->fd, v, n);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            w->bytes += (uint64_t)k;
+            w->writes++;
+            // Skip what went out, finishing a partly written chunk next time round
+            while (n > 0 && (size_t)k >= v->iov_len) {
+                k -= (ssize_t)v->iov_len;
+                v++;
+                n--;
+            }
+            if (n > 0) {
+                v->iov_base = (char*)v->iov_base + k;
+                v->iov_len -= (size_t)k;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Return written chunks to the spare list; called with the lock held */
+static inline void faidx_writer_recycle(faidx_writer_t *w, faidx_wchunk_t *c, int n) {
+    while (c) {
+        faidx_wchunk_t *next = c->next;
+        c->l = 0;
+        c->next = w->spare;
+        w->spare = c;
+        c = next;
+    }
+    w->n_queued -= n;
+    pthread_cond_broadcast(&w->space);
+}
+
+static inline void *faidx_writer_thread(void *arg) {
+    faidx_writer_t *w = (faidx_writer_t*)arg;
+    
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->head && !w->shutdown) pthread_cond_wait(&w->ready, &w->lock);
+        if (!w->head) break;
+    
+        // Take everything queued so far and write it outside the lock
+        faidx_wchunk_t *c = w->head;
+        int n = w->n_queued;
+        w->head = w->tail = NULL;
+        int failed = w->err != 0;
+        pthread_mutex_unlock(&w->lock);
+    
+        int err = 0;
+        if (!failed && faidx_writer_writev(w, c) < 0) err = errno ? errno : EIO;
+    
+        pthread_mutex_lock(&w->lock);
+        if (err && !w->err) w->err = err;
+        faidx_writer_recycle(w, c, n);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Writer on an open descriptor; threaded starts a thread to do the writes */
+static inline faidx_writer_t *faidx_writer_fdopen(int fd, int threaded) {
+    faidx_writer_t *w = (faidx_writer_t*)calloc(1, sizeof(faidx_writer_t));
+    
+    if (!w) return NULL;
+    w->fd = fd;
+    w->threaded = threaded;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    pthread_cond_init(&w->space, NULL);
+    if (threaded && pthread_create(&w->thread, NULL, faidx_writer_thread, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->ready);
+        pthread_cond_destroy(&w->space);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/* Writer creating or truncating path; "-" is standard output */
+static inline faidx_writer_t *faidx_writer_open(const char *path, int threaded) {
+    int fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    
+    if (fd < 0) return NULL;
+    faidx_writer_t *w = faidx_writer_fdopen(fd, threaded);
+    if (!w) {
+        if (fd != STDOUT_FILENO) close(fd);
+        return NULL;
+    }
+    w->own_fd = fd != STDOUT_FILENO;
+    return w;
+}
+
+/* Queue a full chunk, or write it straight away without a writer thread */
+static inline int faidx_writer_submit(faidx_writer_t *w, faidx_wchunk_t *c) {
+    int ret = 0;
+    
+    c->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (!w->threaded) {
+        if (!w->err && faidx_writer_writev(w, c) < 0) w->err = errno ? errno : EIO;
+        w->n_queued++;
+        faidx_writer_recycle(w, c, 1);
+    } else {
+        while (w->n_queued >= FAIDX_WRITER_QUEUE && !w->err) pthread_cond_wait(&w->space, &w->lock);
+        if (w->tail) w->tail->next = c;
+        else w->head = c;
+        w->tail = c;
+        w->n_queued++;
+        pthread_cond_signal(&w->ready);
+    }
+    if (w->err) {
+        errno = w->err;
+        ret = -1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ret;
+}
+
+/* Take a spare chunk, or allocate one */
+static inline faidx_wchunk_t *faidx_writer_chunk(faidx_writer_t *w) {
+    faidx_wchunk_t *c;
+    
+    pthread_mutex_lock(&w->lock);
+    c = w->spare;
+    if (c) w->spare = c->next;
+    pthread_mutex_unlock(&w->lock);
+    if (c) return c;
+    
+    c = (faidx_wchunk_t*)calloc(1, sizeof(faidx_wchunk_t));
+    if (!c) return NULL;
+    c->m = FAIDX_WRITER_CHUNK;
+    c->s = (char*)malloc(c->m);
+    if (!c->s) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static inline void faidx_wbuf_init(faidx_wbuf_t *b, faidx_writer_t *w) {
+    b->w = w;
+    b->c = NULL;
+}
+
+/* Append bytes to the current record; returns 0, or -1 when out of memory */
+static inline int faidx_wbuf_put(faidx_wbuf_t *b, const char *s, size_t n) {
+    faidx_wchunk_t *c = b->c;
+    
+    if (!c && !(c = b->c = faidx_writer_chunk(b->w))) return -1;
+    if (c->l + n > c->m) {
+        // Records bigger than a chunk grow it; it keeps the size when recycled
+        size_t m = c->m * 2 > c->l + n ? c->m * 2 : c->l + n;
+        char *s2 = (char*)realloc(c->s, m);
+        if (!s2) return -1;
+        c->s = s2;
+        c->m = m;
+    }
+    memcpy(c->s + c->l, s, n);
+    c->l += n;
+    return 0;
+}
+
+/* Hand over everything buffered so far */
+static inline int faidx_wbuf_flush(faidx_wbuf_t *b) {
+    faidx_wchunk_t *c = b->c;
+    
+    if (!c || !c->l) return 0;
+    b->c = NULL;
+    return faidx_writer_submit(b->w, c);
+}
+
+/* Mark the end of a record: the buffer may be handed over here */
+static inline int faidx_wbuf_end(faidx_wbuf_t *b) {
+    if (b->c && b->c->l >= FAIDX_WRITER_CHUNK) return faidx_wbuf_flush(b);
+    return 0;
+}
+
+/* Append len bytes as lines of width bytes (0 for one line), each ending in a newline */
+static inline int faidx_wbuf_lines(faidx_wbuf_t *b, const char *seq, size_t len, size_t width) {
+    if (!width) width = len ? len : 1;
+    for (size_t i = 0; i < len; i += width) {
+        size_t n = len - i < width ? len - i : width;
+        if (faidx_wbuf_put(b, seq + i, n) < 0 || faidx_wbuf_put(b, "\n", 1) < 0) return -1;
+    }
+    return 0;
+}
+
+/* Append a FASTA record, wrapping the sequence at width bases (0 for one line) */
+static inline int faidx_wbuf_fasta(faidx_wbuf_t *b, const char *name, const char *seq, size_t len,
+                                   size_t width) {
+    if (faidx_wbuf_put(b, ">", 1) < 0 || faidx_wbuf_put(b, name, strlen(name)) < 0 ||
+        faidx_wbuf_put(b, "\n", 1) < 0 || faidx_wbuf_lines(b, seq, len, width) < 0) {
+        return -1;
+    }
+    return faidx_wbuf_end(b);
+}
+
+/*
+ * Detach everything buffered so far without handing it over, for callers
+ * that order output themselves: chunks given to faidx_writer_submit are
+ * written in the order they are submitted. NULL if nothing is buffered.
+ */
+static inline faidx_wchunk_t *faidx_wbuf_take(faidx_wbuf_t *b) {
+    faidx_wchunk_t *c = b->c;
+    
+    b->c = NULL;
+    return c;
+}
+
+/* Hand over what is left and give up the buffer */
+static inline int faidx_wbuf_free(faidx_wbuf_t *b) {
+    int ret = faidx_wbuf_flush(b);
+    
+    if (b->c) {
+        free(b->c->s);
+        free(b->c);
+        b->c = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Write everything handed over and destroy the writer; buffers must have
+ * been freed. Returns 0, or -1 with errno set if any write failed.
+ */
+static inline int faidx_writer_close(faidx_writer_t *w) {
+    int err;
+    
+    if (!w) return 0;
+    if (w->threaded) {
+        pthread_mutex_lock(&w->lock);
+        w->shutdown = 1;
+        pthread_cond_signal(&w->ready);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+    err = w->err;
+    if (w->own_fd && close(w->fd) < 0 && !err) err = errno;
+    while (w->spare) {
+        faidx_wchunk_t *next = w->spare->next;
+        free(w->spare->s);
+        free(w->spare);
+        w->spare = next;
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->ready);
+    pthread_cond_destroy(&w->space);
+    free(w);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAIGZ_WRITER_H */
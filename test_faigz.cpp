@@ -1,20 +1,424 @@
 // test_faigz.cpp - C++ test for faigz library
+//
+// Checks the files faigz writes next to a FASTA on small files in the
+// current directory, then, given a FASTA/FASTQ file, fetches from that.
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cstdio>
+#include <zlib.h>
+#include <utime.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 // Include the faigz.h header with implementation
 #define REENTRANT_FAIDX_IMPLEMENTATION
 #include "faigz.h"
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <fasta_file>\n";
-        return 1;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+        failures++; \
+    } \
+} while (0)
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static void write_file(const std::string &path, const std::string &data) {
+    std::ofstream(path, std::ios::binary) << data;
+}
+
+static bool file_exists(const std::string &path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+// One BGZF block holding n bytes of data
+static std::string bgzf_block(const char *data, size_t n) {
+    std::vector<unsigned char> cd(compressBound((uLong)n) + 16);
+    z_stream zs = z_stream();
+    deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)n;
+    zs.next_out = cd.data();
+    zs.avail_out = (uInt)cd.size();
+    deflate(&zs, Z_FINISH);
+    size_t clen = zs.total_out;
+    deflateEnd(&zs);
+    
+    unsigned bsize = (unsigned)clen + 25;
+    unsigned char hdr[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0,
+                             (unsigned char)bsize, (unsigned char)(bsize >> 8)};
+    uLong crc = crc32(0, (const Bytef*)data, (uInt)n);
+    unsigned char tail[8];
+    for (int k = 0; k < 4; k++) {
+        tail[k] = (unsigned char)(crc >> (8 * k));
+        tail[4 + k] = (unsigned char)(n >> (8 * k));
+    }
+    return std::string((const char*)hdr, 18) + std::string((const char*)cd.data(), clen) +
+           std::string((const char*)tail, 8);
+}
+
+// data compressed in BGZF blocks of block bytes, then the empty EOF block
+static std::string bgzf_compress(const std::string &data, size_t block) {
+    std::string out;
+    for (size_t i = 0; i < data.size(); i += block) {
+        out += bgzf_block(data.data() + i, std::min(block, data.size() - i));
     }
+    return out + bgzf_block("", 0);
+}
+
+// A FASTA with records of a few lines each
+static std::string make_fasta(int n_seqs) {
+    std::string fa;
+    const char bases[] = "ACGTACGTNacgt";
+    unsigned x = 1;
+    for (int i = 0; i < n_seqs; i++) {
+        fa += ">seq" + std::to_string(i) + " test\n";
+        for (int j = 0; j < 500 + 37 * i; j++) {
+            x = x * 1103515245 + 12345;
+            fa += bases[(x >> 16) % 13];
+            if (j % 60 == 59) fa += '\n';
+        }
+        if (fa.back() != '\n') fa += '\n';
+    }
+    return fa;
+}
+
+/* A failed rebuild keeps the index that was there and leaves no temporary files */
+static void test_build_failure() {
+    const std::string fa = "faigz_test_build.fa.gz", fai = fa + ".fai", gzi = fa + ".gzi";
+    const std::string gz = bgzf_compress(make_fasta(20), 1000);
+    const std::string tmp = ".tmp." + std::to_string((long)getpid());
+    int before = failures;
+    
+    write_file(fa, gz);
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    faidx_meta_t *meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(meta && faidx_meta_nseq(meta) == 20);
+    faidx_meta_destroy(meta);
+    const std::string good = read_file(fai);
+    CHECK(!good.empty() && file_exists(gzi));
+    
+    // Only the .gzi is missing, so the load rebuilds both, which fails on a truncated file
+    std::remove(gzi.c_str());
+    write_file(fa, gz.substr(0, gz.size() / 2 + 7));
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(!meta);
+    faidx_meta_destroy(meta);
+    CHECK(read_file(fai) == good);
+    CHECK(!file_exists(gzi) && !file_exists(fai + tmp) && !file_exists(gzi + tmp));
+    
+    // Once the file is whole again the rebuild puts the same index in place
+    write_file(fa, gz);
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(meta && faidx_meta_nseq(meta) == 20);
+    faidx_meta_destroy(meta);
+    CHECK(read_file(fai) == good && file_exists(gzi));
+    
+    std::remove(fa.c_str());
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    std::cout << "Index rebuilds: " << (failures == before ? "ok" : "FAILED") << std::endl;
+}
 
-    const char *fasta_file = argv[1];
+// Sequences with soft-masked runs, N runs and other characters, in lines of several widths
+static std::string make_masked_fasta() {
+    std::string fa;
+    const char *extra = "RYnN-*";
+    unsigned x = 7;
+    auto next = [&x](unsigned n) { x = x * 1103515245 + 12345; return (x >> 16) % n; };
+    const int lens[] = {1, 4, 3000, 20000, 777};
+    const int widths[] = {60, 60, 61, 80, 7};
+    for (int i = 0; i < 5; i++) {
+        std::string seq;
+        while ((int)seq.size() < lens[i]) {
+            unsigned kind = next(10), n = 1 + next(300);
+            for (unsigned j = 0; j < n; j++) {
+                char c = "ACGT"[next(4)];
+                if (kind == 0) c = 'N';
+                else if (kind == 1) c = (char)(c | 0x20);
+                else if (kind == 2 && j == 0) c = extra[next(6)];
+                seq += c;
+            }
+        }
+        seq.resize(lens[i]);
+        if (i == 1) seq = "NNnn";
+        fa += ">m" + std::to_string(i) + "\n";
+        for (size_t j = 0; j < seq.size(); j += widths[i]) fa += seq.substr(j, widths[i]) + "\n";
+    }
+    return fa;
+}
+
+// A region that outlives the metadata it was made from
+struct test_region_t {
+    std::string name;
+    hts_pos_t beg, end;
+};
+
+// Regions covering each sequence whole, at its end and at random
+static std::vector<test_region_t> pack_regions(faidx_meta_t *meta) {
+    std::vector<test_region_t> regions;
+    unsigned x = 3;
+    for (int i = 0; i < faidx_meta_nseq(meta); i++) {
+        const char *name = faidx_meta_iseq(meta, i);
+        hts_pos_t len = faidx_meta_seq_len_id(meta, i);
+        regions.push_back(test_region_t{name, 0, len - 1});
+        regions.push_back(test_region_t{name, len - 1, len - 1});
+        for (int j = 0; j < 40; j++) {
+            x = x * 1103515245 + 12345;
+            hts_pos_t beg = (x >> 8) % len;
+            x = x * 1103515245 + 12345;
+            regions.push_back(test_region_t{name, beg, std::min(len - 1, beg + (hts_pos_t)((x >> 8) % 700))});
+        }
+    }
+    return regions;
+}
+
+// Every region in every sequence mode, single fetches then one batch per mode
+static std::vector<std::string> pack_fetch_all(faidx_meta_t *meta, const std::vector<test_region_t> &wanted) {
+    const enum faidx_seq_mode modes[] = {FAIDX_SEQ_AS_IS, FAIDX_SEQ_UPPER, FAIDX_SEQ_MASK_N};
+    std::vector<faidx_region_t> regions;
+    std::vector<std::string> got;
+    for (const auto &r : wanted) {
+        faidx_region_t c = {r.name.c_str(), r.beg, r.end};
+        regions.push_back(c);
+    }
+    faidx_reader_t *reader = faidx_reader_create(meta);
+    CHECK(reader != NULL);
+    if (!reader) return got;
+    for (auto mode : modes) {
+        CHECK(faidx_reader_set_seq_mode(reader, mode) == 0);
+        for (const auto &r : regions) {
+            hts_pos_t len;
+            char *seq = faidx_reader_fetch_seq(reader, r.name, r.beg, r.end, &len);
+            got.push_back(seq ? std::string(seq, len) : std::string("(failed)"));
+            free(seq);
+        }
+        std::vector<kstring_t> out(regions.size());
+        std::vector<hts_pos_t> lens(regions.size());
+        for (auto &ks : out) ks = kstring_t{0, 0, NULL};
+        CHECK(faidx_reader_fetch_batch(reader, regions.data(), regions.size(), out.data(),
+                                       lens.data()) == (int64_t)regions.size());
+        for (size_t i = 0; i < regions.size(); i++) {
+            got.push_back(out[i].s ? std::string(out[i].s, out[i].l) : std::string());
+            free(out[i].s);
+        }
+    }
+    faidx_reader_destroy(reader);
+    return got;
+}
+
+/* A .pk2 written by FAI_PACK serves the same sequence as the FASTA, and is ignored once stale */
+static void test_pack(bool bgzf) {
+    const std::string fa = bgzf ? "faigz_test_pack.fa.gz" : "faigz_test_pack.fa";
+    const std::string pk2 = fa + ".pk2", fai = fa + ".fai", gzi = fa + ".gzi";
+    const std::string text = make_masked_fasta();
+    int before = failures;
+    
+    write_file(fa, bgzf ? bgzf_compress(text, 4000) : text);
+    std::remove(pk2.c_str());
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    
+    // The FASTA path first, while there is no .pk2
+    faidx_meta_t *meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(meta && !meta->pack.base);
+    if (!meta) return;
+    std::vector<test_region_t> regions = pack_regions(meta);
+    std::vector<std::string> expect = pack_fetch_all(meta, regions);
+    CHECK(std::find(expect.begin(), expect.end(), "(failed)") == expect.end());
+    faidx_meta_destroy(meta);
+    CHECK(!file_exists(pk2));
+    
+    // FAI_PACK writes it, and a plain load maps it from then on
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_PACK);
+    CHECK(meta && meta->pack.base && file_exists(pk2));
+    if (meta) CHECK(pack_fetch_all(meta, regions) == expect);
+    faidx_meta_destroy(meta);
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, 0);
+    CHECK(meta && meta->pack.base);
+    if (meta) CHECK(pack_fetch_all(meta, regions) == expect);
+    faidx_meta_destroy(meta);
+    
+    // A FASTA newer than its .pk2 is read directly until FAI_PACK rewrites it
+    struct utimbuf times;
+    times.actime = times.modtime = time(NULL) + 10;
+    CHECK(utime(fa.c_str(), &times) == 0);
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, 0);
+    CHECK(meta && !meta->pack.base);
+    if (meta) CHECK(pack_fetch_all(meta, regions) == expect);
+    faidx_meta_destroy(meta);
+    meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_PACK);
+    CHECK(meta && meta->pack.base);
+    if (meta) CHECK(pack_fetch_all(meta, regions) == expect);
+    faidx_meta_destroy(meta);
+    
+    std::remove(fa.c_str());
+    std::remove(pk2.c_str());
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    std::cout << "Packed companion (" << (bgzf ? "BGZF" : "plain") << "): "
+              << (failures == before ? "ok" : "FAILED") << std::endl;
+}
+
+// Names, lengths and a few fetches, to compare loads of the same file
+static std::vector<std::string> index_summary(faidx_meta_t *meta) {
+    std::vector<std::string> out;
+    faidx_reader_t *reader = faidx_reader_create(meta);
+    CHECK(reader != NULL);
+    if (!reader) return out;
+    for (int i = 0; i < faidx_meta_nseq(meta); i++) {
+        const char *name = faidx_meta_iseq(meta, i);
+        hts_pos_t len = faidx_meta_seq_len(meta, name), n;
+        out.push_back(std::string(name) + ":" + std::to_string(len));
+        char *seq = faidx_reader_fetch_seq(reader, name, len / 3, len / 3 + 99, &n);
+        out.push_back(seq ? std::string(seq, n) : std::string("(failed)"));
+        free(seq);
+    }
+    faidx_reader_destroy(reader);
+    return out;
+}
+
+// Apply f to the header and bytes of the snapshot at path, in place
+template <class F>
+static void edit_snapshot(const std::string &path, F f) {
+    std::string b = read_file(path);
+    CHECK(b.size() >= sizeof(faidx_snapshot_hdr_t));
+    if (b.size() < sizeof(faidx_snapshot_hdr_t)) return;
+    faidx_snapshot_hdr_t h;
+    memcpy(&h, b.data(), sizeof(h));
+    f(h, b);
+    write_file(path, b);
+}
+
+/* A .fai.bin snapshot loads the same index, and a damaged or stale one is rebuilt */
+static void test_snapshot(bool bgzf) {
+    const std::string fa = bgzf ? "faigz_test_snap.fa.gz" : "faigz_test_snap.fa";
+    const std::string fai = fa + ".fai", gzi = fa + ".gzi", bin = fai + ".bin";
+    const std::string text = make_fasta(30);
+    int before = failures;
+    
+    write_file(fa, bgzf ? bgzf_compress(text, 3000) : text);
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    std::remove(bin.c_str());
+    faidx_meta_t *meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(meta != NULL);
+    if (!meta) return;
+    const std::vector<std::string> expect = index_summary(meta);
+    faidx_meta_destroy(meta);
+    CHECK(!file_exists(bin));
+    
+    // The first load writes the snapshot, the second maps it; check is run on both
+    auto load = [&](bool mapped) {
+        faidx_meta_t *m = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_SNAPSHOT);
+        CHECK(m && !m->snapshot.base == !mapped);
+        if (m) CHECK(index_summary(m) == expect);
+        faidx_meta_destroy(m);
+    };
+    load(false);
+    CHECK(file_exists(bin));
+    const std::string good = read_file(bin);
+    load(true);
+    
+    // Truncated
+    write_file(bin, good.substr(0, good.size() / 2));
+    load(false);
+    CHECK(read_file(bin) == good);
+    load(true);
+    
+    // Sections that fit but don't hold together
+    edit_snapshot(bin, [](const faidx_snapshot_hdr_t &h, std::string &b) {
+        faidx_snapshot_rec_t *rec = (faidx_snapshot_rec_t*)&b[h.off_seq];
+        rec[1].line_blen = 0;
+    });
+    load(false);
+    CHECK(read_file(bin) == good);
+    edit_snapshot(bin, [](const faidx_snapshot_hdr_t &h, std::string &b) {
+        faidx_name_slot_t *slots = (faidx_name_slot_t*)&b[h.off_slots];
+        for (uint64_t k = 0; k <= h.mask; k++) slots[k].id = (int32_t)h.n;
+    });
+    load(false);
+    CHECK(read_file(bin) == good);
+    edit_snapshot(bin, [](const faidx_snapshot_hdr_t &h, std::string &b) {
+        ((uint64_t*)&b[h.off_name_off])[2] = h.names_len + 100;
+    });
+    load(false);
+    load(true);
+    
+    // Stale once the .fai changes, even if the snapshot itself is intact
+    struct utimbuf times;
+    times.actime = times.modtime = time(NULL) + 10;
+    CHECK(utime(fai.c_str(), &times) == 0);
+    load(false);
+    CHECK(read_file(bin) != good);
+    load(true);
+    
+    std::remove(fa.c_str());
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    std::remove(bin.c_str());
+    std::cout << "Index snapshot (" << (bgzf ? "BGZF" : "plain") << "): "
+              << (failures == before ? "ok" : "FAILED") << std::endl;
+}
+
+/* FAI_SHM metas share one segment, which goes away with the last of them */
+static void test_shm() {
+    const std::string fa = "faigz_test_shm.fa.gz", fai = fa + ".fai", gzi = fa + ".gzi";
+    int before = failures;
+    
+    write_file(fa, bgzf_compress(make_fasta(25), 2000));
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    faidx_meta_t *meta = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_CREATE);
+    CHECK(meta != NULL);
+    if (!meta) return;
+    const std::vector<std::string> expect = index_summary(meta);
+    faidx_meta_destroy(meta);
+    
+    faidx_meta_t *a = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_SHM);
+    CHECK(a && a->shm_name && a->snapshot.base);
+    if (!a || !a->shm_name) {
+        faidx_meta_destroy(a);
+        return;
+    }
+    const std::string name = a->shm_name;
+    faidx_meta_t *b = faidx_meta_load(fa.c_str(), FAI_FASTA, FAI_SHM);
+    CHECK(b && b->shm_name && name == b->shm_name && b->snapshot.base);
+    CHECK(index_summary(a) == expect);
+    if (b) CHECK(index_summary(b) == expect);
+    
+    auto segment_exists = [&name]() {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd >= 0) close(fd);
+        return fd >= 0;
+    };
+    CHECK(segment_exists());
+    faidx_meta_destroy(a);
+    CHECK(segment_exists());
+    if (b) CHECK(index_summary(b) == expect);
+    faidx_meta_destroy(b);
+    CHECK(!segment_exists());
+    
+    std::remove(fa.c_str());
+    std::remove(fai.c_str());
+    std::remove(gzi.c_str());
+    std::cout << "Shared memory index: " << (failures == before ? "ok" : "FAILED") << std::endl;
+}
+
+/* Fetch from a FASTA/FASTQ file given on the command line */
+static int test_file(const char *fasta_file) {
     std::cout << "Testing faigz C++ integration with file: " << fasta_file << std::endl;
     
     // Load metadata
@@ -53,10 +457,81 @@ int main(int argc, char **argv) {
         
         if (seq) {
             std::cout << "Sequence: " << seq << " (length: " << len << ")" << std::endl;
-            free(seq);
         } else {
             std::cout << "Failed to fetch sequence" << std::endl;
         }
+        
+        // The same region through a reusable caller-owned buffer
+        kstring_t buf = {0, 0, NULL};
+        for (int i = 0; i < 3; i++) {
+            hts_pos_t n = faidx_reader_fetch_seq_into(reader, seq_name, 0, 9, &buf);
+            if (n != len || (seq && std::string(buf.s, buf.l) != seq)) {
+                std::cerr << "faidx_reader_fetch_seq_into mismatch" << std::endl;
+                free(seq);
+                free(buf.s);
+                faidx_reader_destroy(reader);
+                faidx_meta_destroy(meta);
+                return 1;
+            }
+        }
+        std::cout << "Buffered fetch matches (" << buf.l << " bases, "
+                  << buf.m << " bytes allocated)" << std::endl;
+        free(buf.s);
+        
+        // And by id, which skips the name lookup
+        hts_pos_t id_len;
+        char *by_id = faidx_reader_fetch_seq_id(reader, 0, 0, 9, &id_len);
+        bool id_ok = by_id && seq && id_len == len && std::string(by_id) == seq &&
+                     faidx_meta_seq_len_id(meta, 0) == faidx_meta_seq_len(meta, seq_name);
+        free(by_id);
+        std::cout << "Fetch by id: " << (id_ok ? "matches" : "MISMATCH") << std::endl;
+        if (!id_ok) {
+            free(seq);
+            faidx_reader_destroy(reader);
+            faidx_meta_destroy(meta);
+            return 1;
+        }
+        free(seq);
+    }
+    
+    // Fetch several regions in one batch and compare with single fetches
+    if (faidx_meta_nseq(meta) > 0) {
+        int nseq = faidx_meta_nseq(meta);
+        std::vector<faidx_region_t> regions;
+        for (int i = 0; i < 8; i++) {
+            const char *name = faidx_meta_iseq(meta, (i * 7) % nseq);
+            hts_pos_t seq_len = faidx_meta_seq_len(meta, name);
+            hts_pos_t beg = (seq_len / 8) * (7 - i);
+            faidx_region_t r = {name, beg, beg + 20};
+            regions.push_back(r);
+        }
+        
+        std::vector<kstring_t> out(regions.size());
+        std::vector<hts_pos_t> lens(regions.size());
+        for (auto &ks : out) {
+            ks.l = ks.m = 0;
+            ks.s = NULL;
+        }
+        int64_t n_ok = faidx_reader_fetch_batch(reader, regions.data(), regions.size(),
+                                                out.data(), lens.data());
+        
+        bool batch_ok = n_ok == (int64_t)regions.size();
+        for (size_t i = 0; batch_ok && i < regions.size(); i++) {
+            hts_pos_t len;
+            char *seq = faidx_reader_fetch_seq(reader, regions[i].name, regions[i].beg,
+                                               regions[i].end, &len);
+            batch_ok = seq && len == lens[i] && std::string(out[i].s, out[i].l) == seq;
+            free(seq);
+        }
+        for (auto &ks : out) free(ks.s);
+        
+        std::cout << "\nBatched fetch of " << regions.size() << " regions: "
+                  << (batch_ok ? "matches" : "MISMATCH") << std::endl;
+        if (!batch_ok) {
+            faidx_reader_destroy(reader);
+            faidx_meta_destroy(meta);
+            return 1;
+        }
     }
     
     // Test reference counting
@@ -84,7 +559,25 @@ int main(int argc, char **argv) {
     // Clean up
     faidx_reader_destroy(reader);
     faidx_meta_destroy(meta);
-    
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        std::cerr << "Usage: " << argv[0] << " [fasta_file]\n";
+        return 1;
+    }
+    test_build_failure();
+    test_pack(false);
+    test_pack(true);
+    test_snapshot(false);
+    test_snapshot(true);
+    test_shm();
+    if (argc > 1 && test_file(argv[1]) != 0) return 1;
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
     std::cout << "\nC++ test completed successfully!" << std::endl;
     return 0;
 }
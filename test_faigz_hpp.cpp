@@ -0,0 +1,229 @@
+// test_faigz_hpp.cpp - tests for the faigz.hpp C++ wrapper
+//
+// With no arguments a small FASTA with known contents is written to the
+// current directory and checked exactly; given a FASTA/FASTQ file, the
+// wrapper is checked against the C API on that file instead.
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define REENTRANT_FAIDX_IMPLEMENTATION
+#include "faigz.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+        failures++; \
+    } \
+} while (0)
+
+// Write a FASTA with mixed line widths and return its sequences
+static std::vector<std::pair<std::string, std::string>> make_fasta(const std::string &path) {
+    std::vector<std::pair<std::string, std::string>> seqs;
+    std::mt19937 rng(1);
+    const char alphabet[] = "ACGTacgtN";
+    const int lens[] = {1, 59, 60, 61, 1000, 12345};
+    const int widths[] = {60, 60, 60, 7, 80, 50};
+
+    std::ofstream out(path);
+    for (int i = 0; i < 6; i++) {
+        std::string name = "seq" + std::to_string(i), seq;
+        for (int j = 0; j < lens[i]; j++) seq += alphabet[rng() % 9];
+        out << '>' << name << " description\n";
+        for (size_t j = 0; j < seq.size(); j += widths[i]) out << seq.substr(j, widths[i]) << '\n';
+        seqs.emplace_back(name, seq);
+    }
+    return seqs;
+}
+
+// Exact checks against the generated file
+static void test_known(const std::string &path,
+                       const std::vector<std::pair<std::string, std::string>> &seqs) {
+    faigz::Meta meta(path);
+    CHECK(meta.size() == (int)seqs.size());
+    for (int i = 0; i < (int)seqs.size(); i++) {
+        CHECK(seqs[i].first == meta.name(i));
+        CHECK(meta.length(i) == (hts_pos_t)seqs[i].second.size());
+        CHECK(meta.contains(seqs[i].first));
+    }
+    CHECK(!meta.contains("absent"));
+
+    faigz::Reader reader(meta);
+    const std::string &s5 = seqs[5].second;
+    auto v = reader.fetch("seq5", 100, 199);
+    CHECK(v && *v == s5.substr(100, 100));
+    v = reader.fetch(5, 0, (hts_pos_t)s5.size() - 1);
+    CHECK(v && *v == s5);
+    v = reader.fetch(faigz::Region{"seq3", 5, 20});
+    CHECK(v && *v == seqs[3].second.substr(5, 16));
+    v = reader.fetch("seq0", 0, 0);
+    CHECK(v && *v == seqs[0].second);
+    CHECK(!reader.fetch("absent", 0, 10));
+
+    // Regions parse 1-based and come back 0-based, end inclusive
+    auto r = meta.parse("seq4:11-20");
+    CHECK(r && r->name == "seq4" && r->beg == 10 && r->end == 19);
+    v = reader.fetch(*r);
+    CHECK(v && *v == seqs[4].second.substr(10, 10));
+    r = meta.parse("seq2");
+    CHECK(r && r->beg == 0 && r->end == 59);
+
+    // A single-line region comes straight from the mapping where there is one
+    v = reader.view("seq4", 5, 50);
+    CHECK(v && *v == seqs[4].second.substr(5, 46));
+    v = reader.view("seq4", 70, 90);
+    CHECK(v && *v == seqs[4].second.substr(70, 21));
+
+    // fetch_into keeps the caller's capacity once it is big enough
+    std::string out;
+    CHECK(reader.fetch_into(out, "seq5", 0, 9999) == 10000);
+    CHECK(out == s5.substr(0, 10000));
+    const char *data = out.data();
+    CHECK(reader.fetch_into(out, "seq5", 10, 19) == 10);
+    CHECK(out == s5.substr(10, 10) && out.data() == data);
+    CHECK(reader.fetch_into(out, "absent", 0, 9) == -2 && out.empty());
+    CHECK(reader.fetch_into(out, "seq4", 5, 50) == 46 && out == seqs[4].second.substr(5, 46));
+
+    CHECK(reader.set_seq_mode(FAIDX_SEQ_UPPER));
+    v = reader.fetch("seq5", 0, 99);
+    std::string upper = s5.substr(0, 100);
+    for (auto &c : upper) c = (char)toupper((unsigned char)c);
+    CHECK(v && *v == upper);
+
+    // Copies share the index, moves hand it over
+    faigz::Meta copy = meta, moved;
+    moved = std::move(meta);
+    CHECK(!meta && copy && moved.get() == copy.get());
+    {
+        faigz::Reader a(copy), b;
+        b = std::move(a);
+        CHECK(!a && b);
+        v = b.fetch("seq1", 0, 58);
+        CHECK(v && *v == seqs[1].second);
+    }
+    faigz::Reader kept(copy);
+    moved = faigz::Meta();
+    copy = faigz::Meta();
+    v = kept.fetch("seq2", 0, 59);
+    CHECK(v && *v == seqs[2].second);
+
+    // parallel_fetch hands every region to the callback once
+    faigz::Meta pmeta(path);
+    std::vector<faigz::Region> regions;
+    std::mt19937 rng(2);
+    for (int i = 0; i < 2000; i++) {
+        const auto &e = seqs[rng() % seqs.size()];
+        hts_pos_t beg = rng() % e.second.size();
+        hts_pos_t end = beg + rng() % (e.second.size() - beg);
+        regions.push_back(faigz::Region{e.first, beg, end});
+    }
+    regions.push_back(faigz::Region{"absent", 0, 10});
+    std::vector<std::string> got(regions.size());
+    std::vector<hts_pos_t> lens(regions.size(), -100);
+    size_t n_ok = faigz::parallel_fetch(pmeta, regions, 4,
+        [&](size_t i, std::string_view seq, hts_pos_t len) {
+            got[i].assign(seq);
+            lens[i] = len;
+        }, 0, 64);
+    CHECK(n_ok == regions.size() - 1);
+    CHECK(lens.back() == -2 && got.back().empty());
+    for (size_t i = 0; i + 1 < regions.size(); i++) {
+        const faigz::Region &q = regions[i];
+        const std::string *seq = nullptr;
+        for (const auto &e : seqs) if (e.first == q.name) seq = &e.second;
+        CHECK(seq && lens[i] == q.end - q.beg + 1 && got[i] == seq->substr(q.beg, q.end - q.beg + 1));
+    }
+
+    // An exception from the callback reaches the caller
+    bool caught = false;
+    try {
+        faigz::parallel_fetch(pmeta, regions, 3, [](size_t i, std::string_view, hts_pos_t) {
+            if (i == 1000) throw std::runtime_error("stop");
+        }, 0, 16);
+    } catch (const std::runtime_error &e) {
+        caught = std::string(e.what()) == "stop";
+    }
+    CHECK(caught);
+    CHECK(faigz::parallel_fetch(pmeta, std::vector<faigz::Region>(), 4,
+                                [](size_t, std::string_view, hts_pos_t) {}) == 0);
+
+    bool threw = false;
+    try {
+        faigz::Meta missing(path + ".missing", 0);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+// Checks of the wrapper against the C API on any file
+static void test_file(const std::string &path) {
+    faigz::Meta meta(path);
+    faigz::Reader reader(meta);
+    faidx_reader_t *c = faidx_reader_create(meta.get());
+    CHECK(c != nullptr);
+
+    std::vector<faigz::Region> regions;
+    std::mt19937 rng(3);
+    for (int i = 0; i < 1000 && meta.size() > 0; i++) {
+        int tid = (int)(rng() % meta.size());
+        hts_pos_t len = meta.length(tid);
+        if (len <= 0) continue;
+        hts_pos_t beg = rng() % len, end = std::min(len - 1, beg + (hts_pos_t)(rng() % 1000));
+        regions.push_back(faigz::Region{meta.name(tid), beg, end});
+    }
+
+    std::vector<std::string> expect;
+    std::string into;
+    for (const auto &r : regions) {
+        hts_pos_t n;
+        char *seq = faidx_reader_fetch_seq(c, r.name.c_str(), r.beg, r.end, &n);
+        expect.push_back(seq ? std::string(seq, n) : std::string());
+        auto v = reader.fetch(r);
+        CHECK(seq ? v && *v == expect.back() : !v);
+        hts_pos_t m = reader.fetch_into(into, r.name, r.beg, r.end);
+        CHECK(seq ? m == n && into == expect.back() : m < 0 && into.empty());
+        free(seq);
+    }
+    faidx_reader_destroy(c);
+
+    std::vector<std::string> got(regions.size());
+    faigz::parallel_fetch(meta, regions, 4, [&](size_t i, std::string_view seq, hts_pos_t) {
+        got[i].assign(seq);
+    });
+    CHECK(got == expect);
+    std::cout << "Checked " << regions.size() << " regions of " << path << std::endl;
+}
+
+int main(int argc, char **argv) {
+    try {
+        if (argc > 1) {
+            test_file(argv[1]);
+        } else {
+            const std::string path = "faigz_hpp_test.fa";
+            std::remove((path + ".fai").c_str());
+            auto seqs = make_fasta(path);
+            test_known(path, seqs);
+            test_file(path);
+            std::remove(path.c_str());
+            std::remove((path + ".fai").c_str());
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Unexpected exception: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All faigz.hpp tests passed" << std::endl;
+    return 0;
+}